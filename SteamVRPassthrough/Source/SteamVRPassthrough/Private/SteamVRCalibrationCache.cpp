@@ -0,0 +1,175 @@
+#include "SteamVRCalibrationCache.h"
+#include "SteamVRPassthrough.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+// Bump when the calibration layout changes, older caches are then discarded.
+#define CALIBRATION_CACHE_MAGIC 0x53565043
+#define CALIBRATION_CACHE_VERSION 2
+
+// One entry per headset and frame type, the cache is cleared if it grows past this.
+#define CALIBRATION_CACHE_MAX_ENTRIES 64
+
+
+FCriticalSection FSteamVRCalibrationCache::FileLock;
+
+
+bool FSteamVRCameraCalibration::Matches(const FSteamVRCameraCalibration& Other) const
+{
+	const float Tolerance = 1.e-4f;
+
+	if (FrameWidth != Other.FrameWidth || FrameHeight != Other.FrameHeight || FrameBufferSize != Other.FrameBufferSize || FrameLayout != Other.FrameLayout)
+	{
+		return false;
+	}
+
+	if (!HMDViewLeft.Equals(Other.HMDViewLeft, Tolerance) || !HMDViewRight.Equals(Other.HMDViewRight, Tolerance) ||
+		!CameraLeftToHMDPose.Equals(Other.CameraLeftToHMDPose, Tolerance) || !CameraLeftToRightPose.Equals(Other.CameraLeftToRightPose, Tolerance))
+	{
+		return false;
+	}
+
+	for (int32 Index = 0; Index < 2; Index++)
+	{
+		if (!FocalLength[Index].Equals(Other.FocalLength[Index], Tolerance) || !Center[Index].Equals(Other.Center[Index], Tolerance))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+FArchive& operator<<(FArchive& Ar, FSteamVRCameraCalibration& Calibration)
+{
+	Ar << Calibration.FrameWidth;
+	Ar << Calibration.FrameHeight;
+	Ar << Calibration.FrameBufferSize;
+	Ar << Calibration.FrameLayout;
+	Ar << Calibration.HMDViewLeft;
+	Ar << Calibration.HMDViewRight;
+	Ar << Calibration.CameraLeftToHMDPose;
+	Ar << Calibration.CameraLeftToRightPose;
+
+	for (int32 Index = 0; Index < 2; Index++)
+	{
+		Ar << Calibration.FocalLength[Index];
+		Ar << Calibration.Center[Index];
+	}
+
+	return Ar;
+}
+
+
+FString FSteamVRCalibrationCache::MakeKey(const FString& SerialNumber, const FString& DriverVersion, int32 FrameType)
+{
+	return FString::Printf(TEXT("%s|%s|%i"), *SerialNumber, *DriverVersion, FrameType);
+}
+
+
+FString FSteamVRCalibrationCache::GetCachePath()
+{
+	return FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("SteamVRPassthrough"), TEXT("CalibrationCache.bin"));
+}
+
+
+bool FSteamVRCalibrationCache::LoadEntries(TMap<FString, FSteamVRCameraCalibration>& OutEntries)
+{
+	TArray<uint8> Data;
+
+	if (!FFileHelper::LoadFileToArray(Data, *GetCachePath(), FILEREAD_Silent))
+	{
+		return false;
+	}
+
+	FMemoryReader Reader(Data);
+
+	uint32 Magic = 0;
+	uint32 Version = 0;
+	Reader << Magic;
+	Reader << Version;
+
+	if (Magic != CALIBRATION_CACHE_MAGIC || Version != CALIBRATION_CACHE_VERSION)
+	{
+		UE_LOG(LogSteamVRPassthrough, Log, TEXT("Discarding camera calibration cache with an unknown version."));
+		return false;
+	}
+
+	// The map allocates for the stored count before reading, so a corrupted count is rejected first.
+	const int64 EntriesOffset = Reader.Tell();
+	int32 NumEntries = 0;
+	Reader << NumEntries;
+
+	if (Reader.IsError() || NumEntries < 0 || NumEntries > CALIBRATION_CACHE_MAX_ENTRIES)
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Camera calibration cache is corrupted, discarding it."));
+		return false;
+	}
+
+	Reader.Seek(EntriesOffset);
+	Reader << OutEntries;
+
+	if (Reader.IsError())
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Camera calibration cache is corrupted, discarding it."));
+		OutEntries.Reset();
+		return false;
+	}
+
+	return true;
+}
+
+
+bool FSteamVRCalibrationCache::Load(const FString& Key, FSteamVRCameraCalibration& OutCalibration)
+{
+	FScopeLock Lock(&FileLock);
+
+	TMap<FString, FSteamVRCameraCalibration> Entries;
+
+	if (!LoadEntries(Entries))
+	{
+		return false;
+	}
+
+	if (const FSteamVRCameraCalibration* Entry = Entries.Find(Key))
+	{
+		OutCalibration = *Entry;
+		return true;
+	}
+
+	return false;
+}
+
+
+void FSteamVRCalibrationCache::Save(const FString& Key, const FSteamVRCameraCalibration& Calibration)
+{
+	FScopeLock Lock(&FileLock);
+
+	// Keep the entries for other headsets, so switching between them stays fast.
+	TMap<FString, FSteamVRCameraCalibration> Entries;
+	LoadEntries(Entries);
+
+	if (Entries.Num() >= CALIBRATION_CACHE_MAX_ENTRIES && !Entries.Contains(Key))
+	{
+		Entries.Reset();
+	}
+
+	Entries.Add(Key, Calibration);
+
+	TArray<uint8> Data;
+	FMemoryWriter Writer(Data);
+
+	uint32 Magic = CALIBRATION_CACHE_MAGIC;
+	uint32 Version = CALIBRATION_CACHE_VERSION;
+	Writer << Magic;
+	Writer << Version;
+	Writer << Entries;
+
+	if (!FFileHelper::SaveArrayToFile(Data, *GetCachePath()))
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Failed to write the camera calibration cache to %s"), *GetCachePath());
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+
+/** Static camera calibration read from OpenVR, which stays the same between startups on the same headset and driver. */
+struct FSteamVRCameraCalibration
+{
+	uint32 FrameWidth = 0;
+	uint32 FrameHeight = 0;
+	uint32 FrameBufferSize = 0;
+	int32 FrameLayout = 0;
+
+	FMatrix HMDViewLeft = FMatrix::Identity;
+	FMatrix HMDViewRight = FMatrix::Identity;
+
+	FMatrix CameraLeftToHMDPose = FMatrix::Identity;
+	FMatrix CameraLeftToRightPose = FMatrix::Identity;
+
+	FVector2D FocalLength[2] = { FVector2D::ZeroVector, FVector2D::ZeroVector };
+	FVector2D Center[2] = { FVector2D::ZeroVector, FVector2D::ZeroVector };
+
+	/** Returns true if the calibrations are the same, ignoring float noise from the runtime. */
+	bool Matches(const FSteamVRCameraCalibration& Other) const;
+
+	friend FArchive& operator<<(FArchive& Ar, FSteamVRCameraCalibration& Calibration);
+};
+
+
+/** Stores camera calibrations in the saved directory, keyed by headset serial number, driver version and frame type. */
+class FSteamVRCalibrationCache
+{
+public:
+	static FString MakeKey(const FString& SerialNumber, const FString& DriverVersion, int32 FrameType);
+
+	static bool Load(const FString& Key, FSteamVRCameraCalibration& OutCalibration);
+	static void Save(const FString& Key, const FSteamVRCameraCalibration& Calibration);
+
+private:
+	static FString GetCachePath();
+	static bool LoadEntries(TMap<FString, FSteamVRCameraCalibration>& OutEntries);
+
+	static FCriticalSection FileLock;
+};
@@ -124,6 +124,8 @@ void FSteamVRExternalTextureResource::InitRHI()
 	TextureRHI = Texture2DRHI;
 	TextureRHI->SetName(Owner->GetFName());
 	RHIUpdateTextureReference(Owner->TextureReference.TextureReferenceRHI, TextureRHI);
+
+	GammaSRV.SafeRelease();
 }
 
 
@@ -132,6 +134,7 @@ void FSteamVRExternalTextureResource::ReleaseRHI()
 	RHIUpdateTextureReference(Owner->TextureReference.TextureReferenceRHI, nullptr);
 	FTextureResource::ReleaseRHI();
 	Texture2DRHI.SafeRelease();
+	GammaSRV.SafeRelease();
 }
 
 
@@ -162,6 +165,9 @@ void FSteamVRExternalTextureResource::UpdateTextureSRV(void* TextureSRV)
 		TextureRHI->SetName(Owner->GetFName());
 		RHIUpdateTextureReference(Owner->TextureReference.TextureReferenceRHI, TextureRHI);
 
+		// Recreated from the new texture by GetGammaSRV when it is next used.
+		GammaSRV.SafeRelease();
+
 		OldRHITexture.SafeRelease();
 	}
 }
@@ -171,3 +177,99 @@ FTexture2DRHIRef FSteamVRExternalTextureResource::GetTexture2DRHI()
 {
 	return Texture2DRHI;
 }
+
+
+FShaderResourceViewRHIRef FSteamVRExternalTextureResource::GetGammaSRV()
+{
+	if (!GammaSRV.IsValid() && Texture2DRHI.IsValid())
+	{
+		FRHITextureSRVCreateInfo CreateInfo;
+		CreateInfo.SRGBOverride = SRGBO_ForceDisable;
+		GammaSRV = RHICreateShaderResourceView(Texture2DRHI, CreateInfo);
+	}
+
+	return GammaSRV;
+}
+
+
+
+
+
+USteamVRPreprocessedTexture2D::USteamVRPreprocessedTexture2D(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{}
+
+
+USteamVRPreprocessedTexture2D* USteamVRPreprocessedTexture2D::Create(int32 InSizeX, int32 InSizeY)
+{
+	check(InSizeX > 0 && InSizeY > 0);
+
+	auto NewTexture = NewObject<USteamVRPreprocessedTexture2D>(GetTransientPackage(), NAME_None, RF_Transient);
+
+	NewTexture->Filter = TF_Bilinear;
+	NewTexture->SamplerAddressMode = AM_Clamp;
+	NewTexture->SRGB = 1;
+	NewTexture->CompressionSettings = TC_Default;
+	NewTexture->bNoTiling = true;
+
+#if WITH_EDITORONLY_DATA
+	NewTexture->CompressionNone = true;
+	NewTexture->MipGenSettings = TMGS_NoMipmaps;
+	NewTexture->CompressionNoAlpha = true;
+	NewTexture->DeferCompression = false;
+#endif
+
+	NewTexture->Init(InSizeX, InSizeY, EPixelFormat::PF_R8G8B8A8, false);
+
+	return NewTexture;
+}
+
+
+FTextureResource* USteamVRPreprocessedTexture2D::CreateResource()
+{
+	return (FTextureResource*) new FSteamVRPreprocessedTextureResource(this);
+}
+
+
+
+
+FSteamVRPreprocessedTextureResource::FSteamVRPreprocessedTextureResource(USteamVRPreprocessedTexture2D* InOwner)
+{
+	Owner = InOwner;
+}
+
+
+void FSteamVRPreprocessedTextureResource::InitRHI()
+{
+	FSamplerStateInitializerRHI SamplerStateInitializer
+	(
+		ESamplerFilter::SF_Bilinear,
+		Owner->SamplerAddressMode,
+		Owner->SamplerAddressMode,
+		Owner->SamplerAddressMode
+	);
+	SamplerStateRHI = GetOrCreateSamplerState(SamplerStateInitializer);
+
+	// The sRGB texture is created typeless, so the compute pass can still write to it through a plain format UAV.
+	ETextureCreateFlags Flags = TexCreate_ShaderResource | TexCreate_UAV | TexCreate_SRGB;
+
+	FRHIResourceCreateInfo CreateInfo;
+	Texture2DRHI = RHICreateTexture2D(GetSizeX(), GetSizeY(), Owner->Format, 1, 1, Flags, CreateInfo);
+
+	TextureRHI = Texture2DRHI;
+	TextureRHI->SetName(Owner->GetFName());
+	RHIUpdateTextureReference(Owner->TextureReference.TextureReferenceRHI, TextureRHI);
+
+	FRHITextureSRVCreateInfo SRVCreateInfo;
+	SRVCreateInfo.SRGBOverride = SRGBO_ForceDisable;
+	GammaSRV = RHICreateShaderResourceView(Texture2DRHI, SRVCreateInfo);
+}
+
+
+void FSteamVRPreprocessedTextureResource::ReleaseRHI()
+{
+	RHIUpdateTextureReference(Owner->TextureReference.TextureReferenceRHI, nullptr);
+	FTextureResource::ReleaseRHI();
+	GammaSRV.SafeRelease();
+	Texture2DRHI.SafeRelease();
+}
@@ -21,6 +21,18 @@ public:
 };
 
 
+/** Camera texture written by the preprocessing compute pass, sampled with sRGB decoding like the source frames. */
+UCLASS(MinimalAPI)
+class USteamVRPreprocessedTexture2D : public UTexture2DDynamic
+{
+	GENERATED_UCLASS_BODY()
+
+public:
+	static USteamVRPreprocessedTexture2D* Create(int32 InSizeX, int32 InSizeY);
+	FTextureResource* CreateResource();
+};
+
+
 class FSteamVRExternalTextureResource : public FTextureResource
 {
 public:
@@ -30,6 +42,9 @@ public:
 	void UpdateTextureSRV(void* TextureSRV);
 	FTexture2DRHIRef GetTexture2DRHI();
 
+	/** Returns a view of the current texture that skips the sRGB to linear conversion on sampling. */
+	FShaderResourceViewRHIRef GetGammaSRV();
+
 	uint32 GetSizeX() const
 	{
 		return Owner->SizeX;
@@ -43,4 +58,40 @@ public:
 private:
 	USteamVRExternalTexture2D* Owner;
 	FTexture2DRHIRef Texture2DRHI;
+	FShaderResourceViewRHIRef GammaSRV;
+};
+
+
+class FSteamVRPreprocessedTextureResource : public FTextureResource
+{
+public:
+	FSteamVRPreprocessedTextureResource(USteamVRPreprocessedTexture2D* InOwner);
+	void InitRHI();
+	void ReleaseRHI();
+
+	FTexture2DRHIRef GetTexture2DRHI()
+	{
+		return Texture2DRHI;
+	}
+
+	/** Returns a view of the texture that skips the sRGB to linear conversion on sampling. */
+	FShaderResourceViewRHIRef GetGammaSRV()
+	{
+		return GammaSRV;
+	}
+
+	uint32 GetSizeX() const
+	{
+		return Owner->SizeX;
+	}
+
+	uint32 GetSizeY() const
+	{
+		return Owner->SizeY;
+	}
+
+private:
+	USteamVRPreprocessedTexture2D* Owner;
+	FTexture2DRHIRef Texture2DRHI;
+	FShaderResourceViewRHIRef GammaSRV;
 };
@@ -1,9 +1,11 @@
 
 #include "SteamVRPassthrough.h"
+#include "SteamVRPassthroughRendering.h"
 #include "CoreMinimal.h"
 #include "openvr.h"
 #include "Modules/ModuleManager.h"
 #include "Misc/Paths.h"
+#include "Misc/CoreDelegates.h"
 
 DEFINE_LOG_CATEGORY(LogSteamVRPassthrough);
 
@@ -17,6 +19,12 @@ void FSteamVRPassthroughModule::StartupModule()
 	FString PluginShaderDir = FPaths::Combine(FPaths::ProjectDir(), TEXT("Plugins/SteamVRPassthrough/Shaders"));
 	AddShaderSourceDirectoryMapping(TEXT("/Plugin/SteamVRPassthrough"), PluginShaderDir);
 
+	// The cook builds the shader maps of every material in the project, so report what the location filter saved.
+	if (IsRunningCommandlet())
+	{
+		FCoreDelegates::OnPreExit.AddStatic(&FSteamVRPassthroughRenderer::LogMaterialShaderCounts);
+	}
+
 	if (FModuleManager::Get().IsModuleLoaded("SteamVR"))
 	{
 		bIsOpenVRLoaded = true;
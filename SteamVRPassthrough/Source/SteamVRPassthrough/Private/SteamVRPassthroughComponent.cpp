@@ -6,18 +6,31 @@
 #include "HeadMountedDisplayFunctionLibrary.h"
 #include "openvr.h"
 #include "SteamVRPassthroughRendering.h"
+#include "LatentActions.h"
+#include "Containers/Ticker.h"
+
+// How long the asynchronous enable waits for the first camera frame before completing anyway.
+#define FIRST_FRAME_TIMEOUT 5.0f
 
 
 
 USteamVRPassthroughComponent::USteamVRPassthroughComponent()
 {
-	PrimaryComponentTick.bCanEverTick = true;
-	PrimaryComponentTick.bStartWithTickEnabled = false;
+	// Camera frames are picked up by the renderer right before post processing, so no tick is needed.
+	PrimaryComponentTick.bCanEverTick = false;
 	FrameType = ESteamVRTrackedCameraFrameType::VRFrameType_MaximumUndistorted;
 	PostProcessProjectionDistance = FVector2D(600.0, 100.0);
 	StencilTestValue = -1;
 	SceneAlphaMask = false;
+	ClearColor = FLinearColor::Black;
+	PostProcessInjectionPoint = Injection_AfterTonemap;
+	CameraExposure = 0.0f;
+	CameraWhiteBalance = FLinearColor::White;
+	CameraColorLUT = nullptr;
 	bEnableSharedCameraTexture = true;
+	FirstFrameWaitStartTime = 0.0;
+	EnableRequestId = 0;
+	StreamUserHandle = 0;
 }
 
 
@@ -33,27 +46,53 @@ void USteamVRPassthroughComponent::BeginPlay()
 }
 
 
+void USteamVRPassthroughComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (FirstFrameTickerHandle.IsValid())
+	{
+		FTicker::GetCoreTicker().RemoveTicker(FirstFrameTickerHandle);
+		FirstFrameTickerHandle.Reset();
+	}
+
+	DisableVideo();
+	CompleteEnableVideoAsync(false);
+
+	// The renderer may be shared with other components, so the parameters referencing this one's materials are removed from it.
+	if (PassthroughRenderer.IsValid())
+	{
+		for (const FSteamVRPassthoughUVTransformParameter& Parameter : TransformParameters)
+		{
+			PassthroughRenderer->RemovePassthoughTransformParameters(Parameter.Instance);
+		}
+
+		PassthroughRenderer.Reset();
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
+
 bool USteamVRPassthroughComponent::HasCamera()
 {
 	return FSteamVRPassthroughRenderer::HasCamera();
 }
 
 
-void USteamVRPassthroughComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+TEnumAsByte<ESteamVRPassthroughQualityTier> USteamVRPassthroughComponent::GetQualityTier() const
 {
-	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+	return PassthroughRenderer.IsValid() ? PassthroughRenderer->GetQualityTier() : QualityTier_Full;
+}
 
-	if (bEnabled)
-	{
-		ENQUEUE_RENDER_COMMAND(UpdatePassthrough)(
-			[=](FRHICommandListImmediate& RHICmdList)
-		{
-			if (PassthroughRenderer.Get() != nullptr)
-			{
-				PassthroughRenderer.Get()->UpdateFrame_RenderThread();
-			}
-		});
-	}
+
+FSteamVRPassthroughLatencyStats USteamVRPassthroughComponent::GetLatencyStats() const
+{
+	return PassthroughRenderer.IsValid() ? PassthroughRenderer->GetLatencyStats() : FSteamVRPassthroughLatencyStats();
+}
+
+
+void USteamVRPassthroughComponent::OnRendererQualityTierChanged(ESteamVRPassthroughQualityTier NewTier, float FrameBudgetRatio)
+{
+	OnQualityTierChanged.Broadcast(NewTier, FrameBudgetRatio);
 }
 
 
@@ -64,58 +103,262 @@ bool USteamVRPassthroughComponent::EnableVideo()
 		return true;
 	}
 
+	if (PendingEnablePromises.Num() > 0)
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Passthrough video is already being enabled asynchronously."));
+		return false;
+	}
+
 	if (!PassthroughRenderer.IsValid())
 	{
-		PassthroughRenderer = FSceneViewExtensions::NewExtension<FSteamVRPassthroughRenderer>(FrameType, bEnableSharedCameraTexture);
+		// Components using the same frame type share a renderer, so the frames are only streamed and uploaded once.
+		PassthroughRenderer = FSteamVRPassthroughRenderer::GetSharedRenderer(FrameType, bEnableSharedCameraTexture);
 	}
 
 	if (PassthroughRenderer.Get()->Initialize())
 	{
-		PassthroughRenderer->SetDepthStencilTestValue(StencilTestValue);
-		PassthroughRenderer->SetSceneAlphaMask(SceneAlphaMask);
-		PassthroughRenderer->SetPostProcessOverlayMode(PostProcessOverlayMode);
+		ApplyRendererSettings();
 
-		if (PostProcessMaterial)
-		{
-			if (!PostProcessMatInstance)
-			{
-				PostProcessMatInstance = UMaterialInstanceDynamic::Create(PostProcessMaterial, this);
-			}
+		bEnabled = true;
+		OnVideoEnabled.Broadcast();
 
-			PassthroughRenderer->SetPostProcessMaterial(PostProcessMatInstance);
-		}
+		return true;
+	}
+	else
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Error enabling passthrough video!"));
+		PassthroughRenderer.Reset();
+
+		return false;
+	}
+}
+
+
+TFuture<bool> USteamVRPassthroughComponent::EnableVideoAsync()
+{
+	TSharedRef<TPromise<bool>, ESPMode::ThreadSafe> Promise = MakeShared<TPromise<bool>, ESPMode::ThreadSafe>();
+	TFuture<bool> Future = Promise->GetFuture();
+
+	if (bEnabled && PendingEnablePromises.Num() == 0)
+	{
+		Promise->SetValue(true);
+		return Future;
+	}
 
-		float WorldToMeters = GetWorld()->GetWorldSettings()->WorldToMeters;
-		PassthroughRenderer->SetPostProcessProjectionDistance(PostProcessProjectionDistance.X / WorldToMeters, PostProcessProjectionDistance.Y / WorldToMeters);
+	PendingEnablePromises.Add(Promise);
+
+	if (PendingEnablePromises.Num() > 1)
+	{
+		return Future;
+	}
 
-		for (FSteamVRPassthoughUVTransformParameter Parameter : TransformParameters)
+	if (!PassthroughRenderer.IsValid())
+	{
+		PassthroughRenderer = FSteamVRPassthroughRenderer::GetSharedRenderer(FrameType, bEnableSharedCameraTexture);
+	}
+
+	TWeakObjectPtr<USteamVRPassthroughComponent> WeakThis(this);
+	const uint32 RequestId = ++EnableRequestId;
+
+	// The renderer sets the result on the game thread, so the continuation runs there.
+	PassthroughRenderer->InitializeAsync().Then([WeakThis, RequestId](TFuture<bool> Result)
+	{
+		if (USteamVRPassthroughComponent* This = WeakThis.Get())
 		{
-			PassthroughRenderer->AddPassthoughTransformParameter(Parameter);
+			This->OnAsyncInitialized(Result.Get(), RequestId);
 		}
+	});
 
-		for (FSteamVRPassthoughTextureParameter Parameter : TextureParameters)
+	return Future;
+}
+
+
+class FSteamVRPassthroughEnableVideoAction : public FPendingLatentAction
+{
+public:
+	FSteamVRPassthroughEnableVideoAction(TFuture<bool>&& InResult, bool& InSuccess, const FLatentActionInfo& LatentInfo)
+		: Result(MoveTemp(InResult))
+		, bSuccess(InSuccess)
+		, ExecutionFunction(LatentInfo.ExecutionFunction)
+		, OutputLink(LatentInfo.Linkage)
+		, CallbackTarget(LatentInfo.CallbackTarget)
+	{}
+
+	virtual void UpdateOperation(FLatentResponse& Response) override
+	{
+		if (Result.IsReady())
 		{
-			Parameter.Instance->SetTextureParameterValue(Parameter.TextureParameter, PassthroughRenderer->GetCameraTexture());
+			bSuccess = Result.Get();
+			Response.FinishAndTriggerIf(true, ExecutionFunction, OutputLink, CallbackTarget);
 		}
+	}
 
-		bEnabled = true;
-		PrimaryComponentTick.SetTickFunctionEnable(true);
-		OnVideoEnabled.Broadcast();
+private:
+	TFuture<bool> Result;
+	bool& bSuccess;
+	FName ExecutionFunction;
+	int32 OutputLink;
+	FWeakObjectPtr CallbackTarget;
+};
 
-		return true;
+
+void USteamVRPassthroughComponent::EnableVideoLatent(bool& bSuccess, FLatentActionInfo LatentInfo)
+{
+	UWorld* World = GetWorld();
+
+	if (!World)
+	{
+		bSuccess = false;
+		return;
 	}
-	else
+
+	FLatentActionManager& LatentManager = World->GetLatentActionManager();
+
+	if (LatentManager.FindExistingAction<FSteamVRPassthroughEnableVideoAction>(LatentInfo.CallbackTarget, LatentInfo.UUID) == nullptr)
+	{
+		LatentManager.AddNewAction(LatentInfo.CallbackTarget, LatentInfo.UUID, new FSteamVRPassthroughEnableVideoAction(EnableVideoAsync(), bSuccess, LatentInfo));
+	}
+}
+
+
+void USteamVRPassthroughComponent::OnAsyncInitialized(bool bSuccess, uint32 RequestId)
+{
+	// The enable was cancelled by DisableVideo, which has already completed its promises.
+	if (RequestId != EnableRequestId)
+	{
+		return;
+	}
+
+	if (!bSuccess || !PassthroughRenderer.IsValid())
 	{
 		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Error enabling passthrough video!"));
 		PassthroughRenderer.Reset();
+		CompleteEnableVideoAsync(false);
+
+		return;
+	}
+
+	ApplyRendererSettings();
+	bEnabled = true;
+
+	FirstFrameWaitStartTime = FPlatformTime::Seconds();
+	FirstFrameTickerHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &USteamVRPassthroughComponent::WaitForFirstFrame));
+}
+
+
+bool USteamVRPassthroughComponent::WaitForFirstFrame(float DeltaTime)
+{
+	if (!bEnabled || !PassthroughRenderer.IsValid())
+	{
+		FirstFrameTickerHandle.Reset();
+		CompleteEnableVideoAsync(false);
 
 		return false;
 	}
+
+	if (!PassthroughRenderer->HasReceivedFrame())
+	{
+		// Keeps waiting, since the enable only completes with a frame to show. DisableVideo cancels it.
+		if (FPlatformTime::Seconds() - FirstFrameWaitStartTime > FIRST_FRAME_TIMEOUT)
+		{
+			UE_LOG(LogSteamVRPassthrough, Warning, TEXT("No camera frames received within %.1f seconds of enabling passthrough video, still waiting."), FIRST_FRAME_TIMEOUT);
+			FirstFrameWaitStartTime = FPlatformTime::Seconds();
+		}
+
+		return true;
+	}
+
+	FirstFrameTickerHandle.Reset();
+	OnVideoEnabled.Broadcast();
+	CompleteEnableVideoAsync(true);
+
+	return false;
+}
+
+
+void USteamVRPassthroughComponent::CompleteEnableVideoAsync(bool bSuccess)
+{
+	TArray<TSharedRef<TPromise<bool>, ESPMode::ThreadSafe>> Promises = MoveTemp(PendingEnablePromises);
+	PendingEnablePromises.Reset();
+
+	for (const TSharedRef<TPromise<bool>, ESPMode::ThreadSafe>& Promise : Promises)
+	{
+		Promise->SetValue(bSuccess);
+	}
+}
+
+
+void USteamVRPassthroughComponent::ApplyRendererSettings()
+{
+	StreamUserHandle = PassthroughRenderer->AddStreamUser();
+
+	if (!QualityTierChangedHandle.IsValid())
+	{
+		QualityTierChangedHandle = PassthroughRenderer->OnQualityTierChanged().AddUObject(this, &USteamVRPassthroughComponent::OnRendererQualityTierChanged);
+	}
+
+	if (PostProcessMaterial && !PostProcessMatInstance)
+	{
+		PostProcessMatInstance = UMaterialInstanceDynamic::Create(PostProcessMaterial, this);
+	}
+
+	PushRendererSettings();
+
+	for (FSteamVRPassthoughUVTransformParameter Parameter : TransformParameters)
+	{
+		PassthroughRenderer->AddPassthoughTransformParameter(Parameter);
+	}
+
+	for (FSteamVRPassthoughTextureParameter Parameter : TextureParameters)
+	{
+		Parameter.Instance->SetTextureParameterValue(Parameter.TextureParameter, PassthroughRenderer->GetCameraTexture());
+	}
+}
+
+
+void USteamVRPassthroughComponent::PushRendererSettings()
+{
+	if (!PassthroughRenderer.IsValid() || StreamUserHandle == 0)
+	{
+		return;
+	}
+
+	const float WorldToMeters = GetWorld()->GetWorldSettings()->WorldToMeters;
+
+	FSteamVRPassthroughUserSettings Settings;
+	Settings.PostProcessMode = PostProcessOverlayMode;
+	Settings.ProjectionDistanceFar = PostProcessProjectionDistance.X / WorldToMeters;
+	Settings.ProjectionDistanceNear = PostProcessProjectionDistance.Y / WorldToMeters;
+	Settings.StencilTestValue = StencilTestValue;
+	Settings.bSceneAlphaMask = SceneAlphaMask;
+	Settings.ClearColor = ClearColor;
+	Settings.InjectionPoint = PostProcessInjectionPoint;
+	Settings.Preprocess = Preprocess;
+	Settings.CameraExposure = CameraExposure;
+	Settings.CameraWhiteBalance = CameraWhiteBalance;
+	Settings.PostProcessMaterial = PostProcessMaterial ? PostProcessMatInstance : nullptr;
+	Settings.CameraColorLUT = CameraColorLUT;
+
+	PassthroughRenderer->SetUserSettings(StreamUserHandle, Settings);
 }
 
 
 void USteamVRPassthroughComponent::DisableVideo()
 {
+	// Cancels an asynchronous enable in progress, so it does not turn the passthrough on after this.
+	if (PendingEnablePromises.Num() > 0)
+	{
+		EnableRequestId++;
+
+		if (FirstFrameTickerHandle.IsValid())
+		{
+			FTicker::GetCoreTicker().RemoveTicker(FirstFrameTickerHandle);
+			FirstFrameTickerHandle.Reset();
+		}
+
+		CompleteEnableVideoAsync(false);
+	}
+
 	if (bEnabled)
 	{
 		// Reset materials to prevent them acessing the texture
@@ -134,8 +377,20 @@ void USteamVRPassthroughComponent::DisableVideo()
 		}
 	}
 
+	if (PassthroughRenderer.IsValid() && StreamUserHandle != 0)
+	{
+		PassthroughRenderer->RemoveStreamUser(StreamUserHandle);
+	}
+
+	StreamUserHandle = 0;
+
+	if (PassthroughRenderer.IsValid() && QualityTierChangedHandle.IsValid())
+	{
+		PassthroughRenderer->OnQualityTierChanged().Remove(QualityTierChangedHandle);
+		QualityTierChangedHandle.Reset();
+	}
+
 	bEnabled = false;
-	PrimaryComponentTick.SetTickFunctionEnable(false);
 	OnVideoDisabled.Broadcast();
 }
 
@@ -192,7 +447,7 @@ void USteamVRPassthroughComponent::SetStencilTestValue(int32 InStencilTestValue)
 
 	if (PassthroughRenderer.IsValid())
 	{
-		PassthroughRenderer->SetDepthStencilTestValue(StencilTestValue);
+		PushRendererSettings();
 	}
 }
 
@@ -203,7 +458,7 @@ void USteamVRPassthroughComponent::SetSceneAlphaMask(bool InSceneAlphaMask)
 
 	if (PassthroughRenderer.IsValid())
 	{
-		PassthroughRenderer->SetSceneAlphaMask(SceneAlphaMask);
+		PushRendererSettings();
 	}
 }
 
@@ -226,7 +481,7 @@ void USteamVRPassthroughComponent::SetPostProcessMaterial(UMaterialInterface* Ma
 
 	if (PassthroughRenderer.IsValid())
 	{		
-		PassthroughRenderer->SetPostProcessMaterial(PostProcessMatInstance);
+		PushRendererSettings();
 	}
 }
 
@@ -237,8 +492,7 @@ void USteamVRPassthroughComponent::SetPostProcessProjectionDistance(FVector2D In
 
 	if (PassthroughRenderer.IsValid())
 	{
-		float WorldToMeters = GetWorld()->GetWorldSettings()->WorldToMeters;
-		PassthroughRenderer->SetPostProcessProjectionDistance(PostProcessProjectionDistance.X / WorldToMeters, PostProcessProjectionDistance.Y / WorldToMeters);
+		PushRendererSettings();
 	}
 }
 
@@ -249,7 +503,79 @@ void USteamVRPassthroughComponent::SetPostProcessMode(ESteamVRPostProcessPassthr
 
 	if (PassthroughRenderer.IsValid())
 	{
-		PassthroughRenderer->SetPostProcessOverlayMode(PostProcessOverlayMode);
+		PushRendererSettings();
+	}
+}
+
+
+void USteamVRPassthroughComponent::SetClearColor(FLinearColor InClearColor)
+{
+	ClearColor = InClearColor;
+
+	if (PassthroughRenderer.IsValid())
+	{
+		PushRendererSettings();
+	}
+}
+
+
+void USteamVRPassthroughComponent::SetInjectionPoint(ESteamVRPassthroughInjectionPoint InInjectionPoint)
+{
+	PostProcessInjectionPoint = InInjectionPoint;
+
+	if (PassthroughRenderer.IsValid())
+	{
+		PushRendererSettings();
+	}
+}
+
+
+void USteamVRPassthroughComponent::SetPreprocessSettings(FSteamVRPassthroughPreprocessSettings InSettings)
+{
+	Preprocess = InSettings;
+
+	if (PassthroughRenderer.IsValid() && bEnabled)
+	{
+		PushRendererSettings();
+
+		// Enabling or disabling preprocessing switches the texture the materials need to sample.
+		for (FSteamVRPassthoughTextureParameter Parameter : TextureParameters)
+		{
+			Parameter.Instance->SetTextureParameterValue(Parameter.TextureParameter, PassthroughRenderer->GetCameraTexture());
+		}
+	}
+}
+
+
+void USteamVRPassthroughComponent::SetCameraExposure(float InExposure)
+{
+	CameraExposure = InExposure;
+
+	if (PassthroughRenderer.IsValid())
+	{
+		PushRendererSettings();
+	}
+}
+
+
+void USteamVRPassthroughComponent::SetCameraWhiteBalance(FLinearColor InWhiteBalance)
+{
+	CameraWhiteBalance = InWhiteBalance;
+
+	if (PassthroughRenderer.IsValid())
+	{
+		PushRendererSettings();
+	}
+}
+
+
+void USteamVRPassthroughComponent::SetCameraColorLUT(UVolumeTexture* InColorLUT)
+{
+	CameraColorLUT = InColorLUT;
+
+	if (PassthroughRenderer.IsValid())
+	{
+		PushRendererSettings();
 	}
 }
 
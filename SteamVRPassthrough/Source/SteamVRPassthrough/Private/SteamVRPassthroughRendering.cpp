@@ -16,23 +16,88 @@
 #include "PostProcess/PostProcessing.h"
 #include "PostProcess/PostProcessMaterial.h"
 #include "SceneRendering.h"
+#include "SceneRenderTargets.h"
 #include "Materials/MaterialInstanceSupport.h"
+#include "Engine/VolumeTexture.h"
 #include "Materials/Material.h"
 #include "MaterialShaderType.h"
 #include "MaterialShader.h"
 #include "HardwareInfo.h"
 #include "SceneTextureParameters.h"
 #include "IXRTrackingSystem.h"
+#include "CommonRenderResources.h"
+#include "PostProcess/SceneFilterRendering.h"
+#include "RenderGraphUtils.h"
+#include "HeadMountedDisplayTypes.h"
+#include "StereoRendering.h"
+#include "PipelineStateCache.h"
+#include "RenderCore.h"
+#include "Misc/CoreDelegates.h"
+#include "Misc/App.h"
+#include "ProfilingDebugging/CsvProfiler.h"
+#include "Async/Async.h"
+#include "SteamVRCalibrationCache.h"
+#include "SteamVRRuntimeSession.h"
 
 
 
 DECLARE_CYCLE_STAT(TEXT("SteamVRPassthrough_FrameBufferCopy"), STAT_FrameBufferCopy, STATGROUP_SteamVRPassthrough);
 DECLARE_CYCLE_STAT(TEXT("SteamVRPassthrough_FrameTextureUpdate"), STAT_FrameTextureUpdate, STATGROUP_SteamVRPassthrough);
 DECLARE_CYCLE_STAT(TEXT("SteamVRPassthrough_PoseUpdate"), STAT_PoseUpdate, STATGROUP_SteamVRPassthrough);
+DECLARE_CYCLE_STAT(TEXT("SteamVRPassthrough_FrameWait"), STAT_FrameWait, STATGROUP_SteamVRPassthrough);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("SteamVRPassthrough_DisplayedFrameAge (ms)"), STAT_DisplayedFrameAge, STATGROUP_SteamVRPassthrough);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("SteamVRPassthrough_CameraFramePeriod (ms)"), STAT_CameraFramePeriod, STATGROUP_SteamVRPassthrough);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("SteamVRPassthrough_FrameMissedBy (ms)"), STAT_FrameMissedBy, STATGROUP_SteamVRPassthrough);
+DECLARE_DWORD_COUNTER_STAT(TEXT("SteamVRPassthrough_ExactParameterTransforms"), STAT_ExactParameterTransforms, STATGROUP_SteamVRPassthrough);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("SteamVRPassthrough_PipelinesNotPrecached"), STAT_PipelinesNotPrecached, STATGROUP_SteamVRPassthrough);
+DECLARE_CYCLE_STAT(TEXT("SteamVRPassthrough_PipelinePrecache"), STAT_PipelinePrecache, STATGROUP_SteamVRPassthrough);
+DECLARE_DWORD_COUNTER_STAT(TEXT("SteamVRPassthrough_QualityTier"), STAT_QualityTier, STATGROUP_SteamVRPassthrough);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("SteamVRPassthrough_FrameBudgetRatio"), STAT_FrameBudgetRatio, STATGROUP_SteamVRPassthrough);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("SteamVRPassthrough_QualityTierChanges"), STAT_QualityTierChanges, STATGROUP_SteamVRPassthrough);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("SteamVRPassthrough_SkippedUploads"), STAT_SkippedUploads, STATGROUP_SteamVRPassthrough);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("SteamVRPassthrough_CameraLatency (ms)"), STAT_CameraLatency, STATGROUP_SteamVRPassthrough);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("SteamVRPassthrough_CameraLatencyP50 (ms)"), STAT_CameraLatencyP50, STATGROUP_SteamVRPassthrough);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("SteamVRPassthrough_CameraLatencyP95 (ms)"), STAT_CameraLatencyP95, STATGROUP_SteamVRPassthrough);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("SteamVRPassthrough_CameraLatencyP99 (ms)"), STAT_CameraLatencyP99, STATGROUP_SteamVRPassthrough);
+
+CSV_DEFINE_CATEGORY(SteamVRPassthrough, true);
+
+// Separate GPU stats for comparing the draw paths with "stat gpu".
+DECLARE_GPU_STAT_NAMED(SteamVRPassthrough_PerPixel, TEXT("SteamVR Passthrough (per pixel)"));
+DECLARE_GPU_STAT_NAMED(SteamVRPassthrough_WarpGrid, TEXT("SteamVR Passthrough (warp grid)"));
+DECLARE_GPU_STAT_NAMED(SteamVRPassthrough_FilterBicubic, TEXT("SteamVR Passthrough (bicubic filter)"));
+DECLARE_GPU_STAT_NAMED(SteamVRPassthrough_FilterSharpen, TEXT("SteamVR Passthrough (sharpen filter)"));
+DECLARE_GPU_STAT_NAMED(SteamVRPassthrough_Preprocess, TEXT("SteamVR Passthrough (preprocess)"));
 
 
 #define MAX_PROJECTION_MATRIX_CACHE_SIZE 8
 
+// Range of projection distances in meters covered by the material transform table, other distances are solved exactly.
+#define UV_TRANSFORM_TABLE_MIN_DISTANCE 0.1f
+#define UV_TRANSFORM_TABLE_MAX_DISTANCE 100.0f
+
+// Largest change in the camera to clip space transform before the table segments are checked against the error limit again.
+#define UV_TRANSFORM_TABLE_VERIFY_TOLERANCE 0.01f
+
+// Draws timed per measurement by the warp grid benchmark, when not given.
+#define WARP_GRID_BENCHMARK_DEFAULT_DRAWS 20
+
+// The undistortion map is smooth enough to be stored at a lower resolution than the camera frame.
+#define UNDISTORTION_MAP_DOWNSCALE 2
+
+// Seconds the frame time needs to stay past the governor thresholds before the quality tier is changed.
+// The upgrade delay doubles up to the maximum each time an upgrade is undone soon after.
+#define QUALITY_DOWNGRADE_DELAY 1.0
+#define QUALITY_UPGRADE_DELAY 5.0
+#define QUALITY_MAX_UPGRADE_DELAY 60.0
+
+// Used for the frame budget if the headset does not report its refresh rate.
+#define DEFAULT_DISPLAY_FREQUENCY 90.0f
+
+// Number of displayed frames the latency percentiles are taken over, and how often they are recalculated.
+#define LATENCY_HISTORY_SIZE 256
+#define LATENCY_PERCENTILE_INTERVAL 30
+
 
 static TAutoConsoleVariable<bool> CVarAllowBackgroundRuntime(
 	TEXT("vr.SteamVRPassthrough.AllowBackgroundRuntime"),
@@ -44,6 +109,177 @@ static TAutoConsoleVariable<bool> CVarAllowBackgroundRuntime(
 );
 
 
+static TAutoConsoleVariable<bool> CVarWarpGrid(
+	TEXT("vr.SteamVRPassthrough.WarpGrid"),
+	false,
+	TEXT("Draw the simple passthrough mode as a grid mesh with the camera UVs calculated per vertex,\n")
+	TEXT("instead of projecting them per pixel. Less accurate, but reduces the pixel shader to a single texture fetch.")
+);
+
+
+static TAutoConsoleVariable<int32> CVarWarpGridColumns(
+	TEXT("vr.SteamVRPassthrough.WarpGridColumns"),
+	32,
+	TEXT("Number of horizontal cells in the warp grid.")
+);
+
+
+static TAutoConsoleVariable<int32> CVarWarpGridRows(
+	TEXT("vr.SteamVRPassthrough.WarpGridRows"),
+	32,
+	TEXT("Number of vertical cells in the warp grid.")
+);
+
+
+static FAutoConsoleCommand CCmdBenchmarkWarpGrid(
+	TEXT("vr.SteamVRPassthrough.BenchmarkWarpGrid"),
+	TEXT("Times the simple passthrough shader drawn per pixel and with the warp grid at several render target sizes, and logs the GPU time of each.\n")
+	TEXT("Uses the current camera frame, filter and grid size. Optional argument: draws per measurement, 20 by default."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&FSteamVRPassthroughRenderer::RequestWarpGridBenchmark)
+);
+
+
+static TAutoConsoleVariable<int32> CVarCameraFilter(
+	TEXT("vr.SteamVRPassthrough.CameraFilter"),
+	0,
+	TEXT("Filter used when sampling the camera frames in the simple passthrough mode.\n")
+	TEXT("0: Bilinear, single texture fetch.\n")
+	TEXT("1: Catmull-Rom bicubic, five texture fetches. Sharper when the camera frames are magnified.\n")
+	TEXT("2: Bilinear with contrast adaptive sharpening, five texture fetches.")
+);
+
+
+static TAutoConsoleVariable<float> CVarCameraSharpness(
+	TEXT("vr.SteamVRPassthrough.CameraSharpness"),
+	0.5f,
+	TEXT("Sharpening strength between 0 and 1, used with vr.SteamVRPassthrough.CameraFilter 2.")
+);
+
+
+static TAutoConsoleVariable<bool> CVarPreprocessAsyncCompute(
+	TEXT("vr.SteamVRPassthrough.PreprocessAsyncCompute"),
+	true,
+	TEXT("Run the camera frame preprocessing on the async compute queue when the platform supports it efficiently.")
+);
+
+
+static TAutoConsoleVariable<int32> CVarDepthPlanes(
+	TEXT("vr.SteamVRPassthrough.DepthPlanes"),
+	0,
+	TEXT("Number of projection planes the simple passthrough mode selects between based on scene depth, up to 8.\n")
+	TEXT("The planes are spaced evenly in inverse depth between the near and far projection distances.\n")
+	TEXT("Values below 2 project everything at the far distance. Not used with the warp grid or when drawing after the upscale.")
+);
+
+
+static TAutoConsoleVariable<bool> CVarScissorToCameraFootprint(
+	TEXT("vr.SteamVRPassthrough.ScissorToCameraFootprint"),
+	true,
+	TEXT("Limit the simple passthrough mode to the part of the view the camera can see,\n")
+	TEXT("and fill the rest with the clear color instead of stretching the frame border.")
+);
+
+
+static TAutoConsoleVariable<bool> CVarUseEngineViewMatrices(
+	TEXT("vr.SteamVRPassthrough.UseEngineViewMatrices"),
+	false,
+	TEXT("Project the camera frames using the view matrices the engine rendered the frame with,\n")
+	TEXT("instead of querying the HMD pose and projection from OpenVR. Matches the rendered frame exactly, including late updates,\n")
+	TEXT("but assumes the OpenVR standing or seated universe matches the engine tracking origin.")
+);
+
+
+static TAutoConsoleVariable<int32> CVarTransformTableSize(
+	TEXT("vr.SteamVRPassthrough.TransformTableSize"),
+	16,
+	TEXT("Number of log-spaced projection distances the material transform parameters are interpolated from.\n")
+	TEXT("The table is only used for an eye when its parameters have more distinct distances than this.\n")
+	TEXT("Less than 2 solves every parameter transform exactly.")
+);
+
+
+static TAutoConsoleVariable<float> CVarTransformTableMaxError(
+	TEXT("vr.SteamVRPassthrough.TransformTableMaxError"),
+	0.0005f,
+	TEXT("Largest camera UV error allowed when interpolating material transform parameters.\n")
+	TEXT("Parameters in table segments exceeding it are solved exactly.")
+);
+
+
+static TAutoConsoleVariable<bool> CVarCalibrationCache(
+	TEXT("vr.SteamVRPassthrough.CalibrationCache"),
+	true,
+	TEXT("Store the static camera calibration on disk, keyed by the headset serial number and driver version, and use it on later startups.\n")
+	TEXT("The cache is checked against the runtime in the background after it is used, and the live calibration is applied if it differs.")
+);
+
+
+static TAutoConsoleVariable<float> CVarMaxFrameWait(
+	TEXT("vr.SteamVRPassthrough.MaxFrameWait"),
+	0.0f,
+	TEXT("Longest time in milliseconds the render thread may wait for a camera frame predicted to arrive just before the passthrough is drawn.\n")
+	TEXT("Catches frames that would otherwise be displayed a frame later, at the cost of render thread time. 0 disables waiting.")
+);
+
+
+static TAutoConsoleVariable<float> CVarSuspendDelay(
+	TEXT("vr.SteamVRPassthrough.SuspendDelay"),
+	0.5f,
+	TEXT("Seconds without a passthrough mode enabled or a material sampling the camera texture before the camera frame pickup and upload are suspended.\n")
+	TEXT("They resume on the frame the camera frames are used again. Negative values disable suspending.")
+);
+
+
+static TAutoConsoleVariable<float> CVarReleaseStreamDelay(
+	TEXT("vr.SteamVRPassthrough.ReleaseStreamDelay"),
+	10.0f,
+	TEXT("Seconds the camera stream stays suspended before the streaming service is released, which also stops the camera and its USB traffic.\n")
+	TEXT("Resuming a released stream takes longer than a camera frame. Negative values keep the stream acquired while suspended.")
+);
+
+
+static TAutoConsoleVariable<bool> CVarPrecachePipelines(
+	TEXT("vr.SteamVRPassthrough.PrecachePipelines"),
+	true,
+	TEXT("Create the shaders and pipeline states the passthrough can switch between when it is initialized and whenever its settings change, instead of on the first draw using them.\n")
+	TEXT("All quality tiers are covered, so the quality governor never creates them. The target formats are derived from the injection point until a draw has seen the actual ones.")
+);
+
+
+static TAutoConsoleVariable<int32> CVarMaterialShaderLocation(
+	TEXT("vr.SteamVRPassthrough.MaterialShaderLocation"),
+	-1,
+	TEXT("Only compile the passthrough material shaders for post process materials with this blendable location, instead of for all of them.\n")
+	TEXT("-1: All post process materials, 0: After tonemapping, 1: Before tonemapping, 2: Before translucency, 3: Replacing the tonemapper, 4: SSR input\n")
+	TEXT("The material passthrough mode ignores the location, so one not otherwise used in the project can mark the passthrough materials.\n")
+	TEXT("Every other post process material with the same location also gets the passthrough shaders, so the location should be reserved for passthrough materials.\n")
+	TEXT("Set in DefaultEngine.ini. The location is part of the material shader map key, so changing it rebuilds the affected shader maps instead of reusing cached ones."),
+	ECVF_ReadOnly
+);
+
+
+static TAutoConsoleVariable<bool> CVarQualityGovernor(
+	TEXT("vr.SteamVRPassthrough.QualityGovernor"),
+	true,
+	TEXT("Automatically reduce the passthrough quality while the frames run over the headset frame budget, and restore it once they are back under it.\n")
+	TEXT("The current tier is shown by stat SteamVRPassthrough.")
+);
+
+
+static TAutoConsoleVariable<float> CVarQualityDowngradeRatio(
+	TEXT("vr.SteamVRPassthrough.QualityDowngradeRatio"),
+	0.95f,
+	TEXT("Fraction of the frame budget the GPU or render thread time needs to stay above for the quality governor to step the quality down.")
+);
+
+
+static TAutoConsoleVariable<float> CVarQualityUpgradeRatio(
+	TEXT("vr.SteamVRPassthrough.QualityUpgradeRatio"),
+	0.8f,
+	TEXT("Fraction of the frame budget the GPU and render thread times need to stay below for the quality governor to step the quality back up.")
+);
+
+
 static TAutoConsoleVariable<float> CVarFallbackTimingOffset(
 	TEXT("vr.SteamVRPassthrough.FallbackTimingOffset"),
 	0.081f,
@@ -53,9 +289,66 @@ static TAutoConsoleVariable<float> CVarFallbackTimingOffset(
 
 
 
-bool FSteamVRPassthroughRenderer::bIsSteamVRRuntimeInitialized = false;
-bool FSteamVRPassthroughRenderer::bDeferredRuntimeShutdown = false;
 int FSteamVRPassthroughRenderer::HMDDeviceId = -1;
+TMap<uint32, TWeakPtr<FSteamVRPassthroughRenderer, ESPMode::ThreadSafe>> FSteamVRPassthroughRenderer::SharedRenderers;
+
+
+enum class EPassthroughCameraFilter : int32
+{
+	Bilinear,
+	Bicubic,
+	Sharpen,
+	MAX
+};
+
+
+static EPassthroughCameraFilter GetCameraFilter_RenderThread(const ESteamVRPassthroughQualityTier QualityTier)
+{
+	if (QualityTier >= QualityTier_ReducedFiltering)
+	{
+		return EPassthroughCameraFilter::Bilinear;
+	}
+
+	return (EPassthroughCameraFilter)FMath::Clamp(CVarCameraFilter.GetValueOnRenderThread(), 0, (int32)EPassthroughCameraFilter::MAX - 1);
+}
+
+
+static bool IsWarpGridEnabled_RenderThread(const ESteamVRPassthroughQualityTier QualityTier)
+{
+	return (CVarWarpGrid.GetValueOnRenderThread() || QualityTier >= QualityTier_WarpGrid) && CVarWarpGridColumns.GetValueOnRenderThread() > 0 && CVarWarpGridRows.GetValueOnRenderThread() > 0;
+}
+
+
+static int32 GetNumDepthPlanes_RenderThread(const ESteamVRPassthroughQualityTier QualityTier)
+{
+	if (QualityTier >= QualityTier_ReducedFiltering)
+	{
+		return 1;
+	}
+
+	return FMath::Min(CVarDepthPlanes.GetValueOnRenderThread(), MAX_PROJECTION_PLANES);
+}
+
+
+/** Scale of the sharpening weights in the camera shader, or 0 when the filter doesn't sharpen. */
+static float GetCameraSharpening_RenderThread(const EPassthroughCameraFilter CameraFilter)
+{
+	if (CameraFilter != EPassthroughCameraFilter::Sharpen)
+	{
+		return 0.0f;
+	}
+
+	return 1.0f / FMath::Lerp(8.0f, 5.0f, FMath::Clamp(CVarCameraSharpness.GetValueOnRenderThread(), 0.0f, 1.0f));
+}
+
+
+/** Combined exposure and white balance multiplier for the camera frames. */
+static FVector GetCameraColorScale(const FSteamVRPassthroughSettings& Settings)
+{
+	const float ExposureScale = FMath::Pow(2.0f, Settings.CameraExposure);
+
+	return FVector(Settings.CameraWhiteBalance.R, Settings.CameraWhiteBalance.G, Settings.CameraWhiteBalance.B) * ExposureScale;
+}
 
 
 FORCEINLINE FMatrix ToFMatrix(const vr::HmdMatrix34_t& tm)
@@ -120,6 +413,39 @@ FORCEINLINE FVector2D GetFrameUVOffset(const EStereoscopicPass StereoPass, const
 }
 
 
+// OpenVR camera index of the left (0) or right (1) camera. The distorted frames of the vertical layout have the right camera at index 0.
+// Only remapped for distorted frames, since the undistorted frame types display correctly with the indices as-is.
+FORCEINLINE uint32 GetOpenVRCameraIndex(const uint32 CameraId, const ESteamVRStereoFrameLayout FrameLayout, const vr::EVRTrackedCameraFrameType FrameType)
+{
+	return (FrameType == vr::VRTrackedCameraFrameType_Distorted && FrameLayout == ESteamVRStereoFrameLayout::StereoVerticalLayout) ? 1 - CameraId : CameraId;
+}
+
+
+// Size of a single camera image relative to the whole frame.
+FORCEINLINE FVector2D GetFrameUVScale(const ESteamVRStereoFrameLayout FrameLayout)
+{
+	switch (FrameLayout)
+	{
+	case ESteamVRStereoFrameLayout::StereoHorizontalLayout:
+		return FVector2D(0.5, 1);
+
+	case ESteamVRStereoFrameLayout::StereoVerticalLayout:
+		return FVector2D(1, 0.5);
+
+	default:
+		return FVector2D(1, 1);
+	}
+}
+
+
+// Selects the camera frame UV offset at compile time.
+class FPassthroughFrameLayoutDim : SHADER_PERMUTATION_INT("FRAME_LAYOUT", 3);
+class FPassthroughRightEyeDim : SHADER_PERMUTATION_BOOL("RIGHT_EYE");
+
+// Remaps the UVs through the undistortion map when using distorted frames.
+class FPassthroughUndistortDim : SHADER_PERMUTATION_BOOL("UNDISTORT_FRAME");
+
+
 class FPassthroughFullsceenVS : public FGlobalShader
 {
 public:
@@ -129,950 +455,3771 @@ public:
 
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		SHADER_PARAMETER(FMatrix, FrameTransformMatrixFar)
-		//SHADER_PARAMETER(FMatrix, FrameTransformMatrixNear)
-		SHADER_PARAMETER_STRUCT_REF(FViewUniformShaderParameters, View)
 	END_SHADER_PARAMETER_STRUCT()
 };
 
 
+/**
+ * Draws a grid covering the viewport without a vertex buffer, and does the camera UV projection 
+ * and undistortion per vertex, so the pixel shader only needs a single texture fetch.
+ */
+class FPassthroughGridVS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FPassthroughGridVS);
+	SHADER_USE_PARAMETER_STRUCT(FPassthroughGridVS, FGlobalShader);
+
+	using FPermutationDomain = TShaderPermutationDomain<FPassthroughFrameLayoutDim, FPassthroughRightEyeDim, FPassthroughUndistortDim>;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(FMatrix, FrameTransformMatrixFar)
+		SHADER_PARAMETER(FIntPoint, GridSize)
+		SHADER_PARAMETER(FVector4, GridUVRect)
+		SHADER_PARAMETER_TEXTURE(Texture2D, UndistortionMap)
+		SHADER_PARAMETER_SAMPLER(SamplerState, UndistortionMapSampler)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static FPermutationDomain RemapPermutation(FPermutationDomain PermutationVector)
+	{
+		// Both eyes sample the same area on mono frames.
+		if (PermutationVector.Get<FPassthroughFrameLayoutDim>() == ESteamVRStereoFrameLayout::Mono)
+		{
+			PermutationVector.Set<FPassthroughRightEyeDim>(false);
+		}
+
+		return PermutationVector;
+	}
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		FPermutationDomain PermutationVector(Parameters.PermutationId);
+
+		if (RemapPermutation(PermutationVector) != PermutationVector)
+		{
+			return false;
+		}
+
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("WARP_GRID"), 1);
+	}
+
+	static FPermutationDomain GetPermutation(const ESteamVRStereoFrameLayout FrameLayout, const uint32 CameraId, const bool bUndistort)
+	{
+		FPermutationDomain PermutationVector;
+		PermutationVector.Set<FPassthroughFrameLayoutDim>((int32)FrameLayout);
+		PermutationVector.Set<FPassthroughRightEyeDim>(CameraId != 0);
+		PermutationVector.Set<FPassthroughUndistortDim>(bUndistort);
+
+		return RemapPermutation(PermutationVector);
+	}
+};
+
+
 class FPassthroughFullsceenPS : public FGlobalShader
 {
 public:
 	DECLARE_GLOBAL_SHADER(FPassthroughFullsceenPS);
 	SHADER_USE_PARAMETER_STRUCT(FPassthroughFullsceenPS, FGlobalShader);
 
+	// Only enables early depth stencil testing when the custom stencil is bound. 
+	// Scene alpha masking is done purely through the blend state, so it needs no permutation.
+	class FStencilMaskDim : SHADER_PERMUTATION_BOOL("STENCIL_MASK");
+
+	// Reads the final camera UVs from the grid vertex shader.
+	class FWarpGridDim : SHADER_PERMUTATION_BOOL("WARP_GRID");
+
+	// Selects the projection plane per pixel from the scene depth.
+	class FDepthPlanesDim : SHADER_PERMUTATION_BOOL("DEPTH_PLANES");
+
+	// The bicubic filter fetches a different footprint, the sharpening and bilinear paths share a permutation.
+	// The linear output, exposure and white balance are cheap uniform branches instead of permutations.
+	class FBicubicFilterDim : SHADER_PERMUTATION_BOOL("BICUBIC_FILTER");
+
+	// Grades the camera frames through a color LUT.
+	class FColorLUTDim : SHADER_PERMUTATION_BOOL("COLOR_LUT");
+
+	using FPermutationDomain = TShaderPermutationDomain<FPassthroughFrameLayoutDim, FPassthroughRightEyeDim, FStencilMaskDim, FPassthroughUndistortDim, FWarpGridDim, FBicubicFilterDim, FColorLUTDim, FDepthPlanesDim>;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		SHADER_PARAMETER_STRUCT_REF(FViewUniformShaderParameters, View)
-		SHADER_PARAMETER_TEXTURE(FTexture2D, CameraTexture)
+		SHADER_PARAMETER_SRV(Texture2D, CameraTexture)
 		SHADER_PARAMETER_SAMPLER(SamplerState, CameraTextureSampler)
-		SHADER_PARAMETER(FVector2D, FrameUVOffset)
+		SHADER_PARAMETER_TEXTURE(Texture2D, UndistortionMap)
+		SHADER_PARAMETER_SAMPLER(SamplerState, UndistortionMapSampler)
+		SHADER_PARAMETER(float, CameraSharpening)
+		SHADER_PARAMETER(uint32, bLinearOutput)
+		SHADER_PARAMETER_ARRAY(FMatrix, PlaneTransforms, [MAX_PROJECTION_PLANES])
+		SHADER_PARAMETER_ARRAY(FVector4, PlaneDepths, [MAX_PROJECTION_PLANES / 4])
+		SHADER_PARAMETER(uint32, NumPlanes)
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, SceneDepthTexture)
+		SHADER_PARAMETER(FVector, CameraColorScale)
+		SHADER_PARAMETER_TEXTURE(Texture3D, CameraColorLUT)
+		SHADER_PARAMETER_SAMPLER(SamplerState, CameraColorLUTSampler)
+		// Not read by the shader, which samples the camera texture through an sRGB reinterpreting view.
+		// Makes the pass wait on the preprocess dispatch this frame, and transitions the texture for reading.
+		SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, PreprocessedFrame)
 		RENDER_TARGET_BINDING_SLOTS()
 	END_SHADER_PARAMETER_STRUCT()
-};
 
+	static FPermutationDomain RemapPermutation(FPermutationDomain PermutationVector)
+	{
+		// The grid vertex shader handles the frame layout and undistortion, and only projects the far plane.
+		if (PermutationVector.Get<FWarpGridDim>())
+		{
+			PermutationVector.Set<FPassthroughFrameLayoutDim>(ESteamVRStereoFrameLayout::Mono);
+			PermutationVector.Set<FPassthroughUndistortDim>(false);
+			PermutationVector.Set<FDepthPlanesDim>(false);
+		}
 
-IMPLEMENT_GLOBAL_SHADER(FPassthroughFullsceenVS, "/Plugin/SteamVRPassthrough/Private/PassthroughFullsceen.usf", "MainVS", SF_Vertex)
-IMPLEMENT_GLOBAL_SHADER(FPassthroughFullsceenPS, "/Plugin/SteamVRPassthrough/Private/PassthroughFullsceen.usf", "MainPS", SF_Pixel)
+		// Both eyes sample the same area on mono frames.
+		if (PermutationVector.Get<FPassthroughFrameLayoutDim>() == ESteamVRStereoFrameLayout::Mono)
+		{
+			PermutationVector.Set<FPassthroughRightEyeDim>(false);
+		}
 
+		return PermutationVector;
+	}
 
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		FPermutationDomain PermutationVector(Parameters.PermutationId);
 
-FScreenPassTexture FSteamVRPassthroughRenderer::DrawFullscreenPassthrough_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& InView, const FPostProcessMaterialInputs& Inputs)
-{
-	FScopeLock Lock(&RenderLock);
+		if (RemapPermutation(PermutationVector) != PermutationVector)
+		{
+			return false;
+		}
 
-	// This gets passed as a FViewInfo from postprocessing
-	FViewInfo& View = (FViewInfo&)InView;
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
 
-	const FScreenPassTexture SceneColor = Inputs.GetInput(EPostProcessMaterialInput::SceneColor);
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("MAX_PROJECTION_PLANES"), MAX_PROJECTION_PLANES);
+	}
 
-	if (!IsValid(CameraTexture) || CameraTexture->Resource == nullptr)
+	static FPermutationDomain GetPermutation(const FSteamVRPassthroughSettings& Settings, const ESteamVRStereoFrameLayout FrameLayout, const uint32 CameraId, const bool bUndistort, const bool bWarpGrid, const EPassthroughCameraFilter CameraFilter, const bool bColorLUT, const bool bDepthPlanes)
 	{
-		return SceneColor;
+		FPermutationDomain PermutationVector;
+		PermutationVector.Set<FPassthroughFrameLayoutDim>((int32)FrameLayout);
+		PermutationVector.Set<FPassthroughRightEyeDim>(CameraId != 0);
+		PermutationVector.Set<FStencilMaskDim>(Settings.StencilTestValue >= 0);
+		PermutationVector.Set<FPassthroughUndistortDim>(bUndistort);
+		PermutationVector.Set<FWarpGridDim>(bWarpGrid);
+		PermutationVector.Set<FBicubicFilterDim>(CameraFilter == EPassthroughCameraFilter::Bicubic);
+		PermutationVector.Set<FColorLUTDim>(bColorLUT);
+		PermutationVector.Set<FDepthPlanesDim>(bDepthPlanes);
+
+		return RemapPermutation(PermutationVector);
 	}
+};
 
-	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
-	TShaderMapRef< FPassthroughFullsceenVS > VertexShader(GlobalShaderMap);
-	TShaderMapRef< FPassthroughFullsceenPS > PixelShader(GlobalShaderMap);
 
-	FScreenPassRenderTarget SceneColorRenderTarget = Inputs.OverrideOutput;
+class FPassthroughPreprocessCS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FPassthroughPreprocessCS);
+	SHADER_USE_PARAMETER_STRUCT(FPassthroughPreprocessCS, FGlobalShader);
 
-	if (!SceneColorRenderTarget.IsValid())
+	class FDenoiseDim : SHADER_PERMUTATION_BOOL("DENOISE");
+	class FSharpenDim : SHADER_PERMUTATION_BOOL("SHARPEN");
+	class FLensShadingDim : SHADER_PERMUTATION_BOOL("LENS_SHADING");
+	class FSaturationDim : SHADER_PERMUTATION_BOOL("SATURATION");
+
+	using FPermutationDomain = TShaderPermutationDomain<FPassthroughFrameLayoutDim, FDenoiseDim, FSharpenDim, FLensShadingDim, FSaturationDim>;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, InputTexture)
+		SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<float4>, OutputTexture)
+		SHADER_PARAMETER(FIntPoint, TextureSize)
+		SHADER_PARAMETER(float, DenoiseStrength)
+		SHADER_PARAMETER(float, SharpenStrength)
+		SHADER_PARAMETER(float, LensShadingCorrection)
+		SHADER_PARAMETER(float, Saturation)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static const int32 ThreadGroupSize = 8;
+
+	static FPermutationDomain RemapPermutation(FPermutationDomain PermutationVector)
 	{
-		ERenderTargetLoadAction Action = View.bHMDHiddenAreaMaskActive ? ERenderTargetLoadAction::EClear : ERenderTargetLoadAction::ENoAction;
+		// Only the lens shading correction needs to know where each camera image is.
+		if (!PermutationVector.Get<FLensShadingDim>())
+		{
+			PermutationVector.Set<FPassthroughFrameLayoutDim>(ESteamVRStereoFrameLayout::Mono);
+		}
 
-		SceneColorRenderTarget = FScreenPassRenderTarget::CreateFromInput(GraphBuilder, SceneColor, Action, TEXT("Passthrough"));
+		return PermutationVector;
 	}
 
-	AddDrawTexturePass(GraphBuilder, View, SceneColor, SceneColorRenderTarget);
-	SceneColorRenderTarget.LoadAction = ERenderTargetLoadAction::ELoad;
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		FPermutationDomain PermutationVector(Parameters.PermutationId);
 
-	FPassthroughFullsceenPS::FParameters* PSPassParameters = GraphBuilder.AllocParameters<FPassthroughFullsceenPS::FParameters>();
-	PSPassParameters->CameraTexture = CameraTexture->Resource->TextureRHI;
-	PSPassParameters->CameraTextureSampler = TStaticSamplerState<SF_Bilinear>::GetRHI();
-	PSPassParameters->View = View.ViewUniformBuffer;
-	PSPassParameters->RenderTargets[0] = SceneColorRenderTarget.GetRenderTargetBinding();
+		if (RemapPermutation(PermutationVector) != PermutationVector)
+		{
+			return false;
+		}
 
-	FPassthroughFullsceenVS::FParameters* VSPassParameters = GraphBuilder.AllocParameters<FPassthroughFullsceenVS::FParameters>();
-		
-	VSPassParameters->View = View.ViewUniformBuffer;
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
 
-	if (View.StereoPass == EStereoscopicPass::eSSP_LEFT_EYE)
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
 	{
-		VSPassParameters->FrameTransformMatrixFar = LeftFrameTransformFar;
-		//VSPassParameters->FrameTransformMatrixNear = LeftFrameTransformNear;
-
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE"), ThreadGroupSize);
 	}
-	else
+
+	static FPermutationDomain GetPermutation(const FSteamVRPassthroughPreprocessSettings& Settings, const ESteamVRStereoFrameLayout FrameLayout)
 	{
-		VSPassParameters->FrameTransformMatrixFar = RightFrameTransformFar;
-		//VSPassParameters->FrameTransformMatrixNear = RightFrameTransformNear;
+		FPermutationDomain PermutationVector;
+		PermutationVector.Set<FPassthroughFrameLayoutDim>((int32)FrameLayout);
+		PermutationVector.Set<FDenoiseDim>(Settings.DenoiseStrength > 0.0f);
+		PermutationVector.Set<FSharpenDim>(Settings.SharpenStrength > 0.0f);
+		PermutationVector.Set<FLensShadingDim>(Settings.LensShadingCorrection > 0.0f);
+		PermutationVector.Set<FSaturationDim>(Settings.Saturation != 1.0f);
+
+		return RemapPermutation(PermutationVector);
 	}
+};
 
-	PSPassParameters->FrameUVOffset = GetFrameUVOffset(View.StereoPass, FrameLayout);
 
-	FRHIBlendState* BlendState = TStaticBlendState<>::GetRHI();
-	FRHIDepthStencilState* StencilState = TStaticDepthStencilState<>::GetRHI();
+class FPassthroughClearPS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FPassthroughClearPS);
+	SHADER_USE_PARAMETER_STRUCT(FPassthroughClearPS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(FLinearColor, ClearColor)
+		RENDER_TARGET_BINDING_SLOTS()
+	END_SHADER_PARAMETER_STRUCT()
 
-	if (SceneAlphaMask)
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
 	{
-		// Blend based on the inverse render target alpha.
-		BlendState = TStaticBlendState<CW_RGB, BO_Add, BF_DestAlpha, BF_InverseDestAlpha>::GetRHI();
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
 	}
+};
 
-	if (StencilTestValue >= 0)
-	{
-		PSPassParameters->RenderTargets.DepthStencil = FDepthStencilBinding(Inputs.CustomDepthTexture, ERenderTargetLoadAction::ELoad, ERenderTargetLoadAction::ELoad, FExclusiveDepthStencil::DepthRead_StencilRead);
 
-		StencilState = TStaticDepthStencilState<false, CF_Always, true, CF_Equal>::GetRHI();
-	}
+IMPLEMENT_GLOBAL_SHADER(FPassthroughFullsceenVS, "/Plugin/SteamVRPassthrough/Private/PassthroughFullsceen.usf", "MainVS", SF_Vertex)
+IMPLEMENT_GLOBAL_SHADER(FPassthroughGridVS, "/Plugin/SteamVRPassthrough/Private/PassthroughFullsceen.usf", "MainGridVS", SF_Vertex)
+IMPLEMENT_GLOBAL_SHADER(FPassthroughFullsceenPS, "/Plugin/SteamVRPassthrough/Private/PassthroughFullsceen.usf", "MainPS", SF_Pixel)
+IMPLEMENT_GLOBAL_SHADER(FPassthroughClearPS, "/Plugin/SteamVRPassthrough/Private/PassthroughFullsceen.usf", "MainClearPS", SF_Pixel)
+IMPLEMENT_GLOBAL_SHADER(FPassthroughPreprocessCS, "/Plugin/SteamVRPassthrough/Private/PassthroughPreprocess.usf", "MainCS", SF_Compute)
 
-	FScreenPassPipelineState PipelineState = FScreenPassPipelineState(VertexShader, PixelShader, BlendState, StencilState);
 
-	int32 StencilVal = StencilTestValue;
 
-	AddDrawScreenPass(
-		GraphBuilder,
-		RDG_EVENT_NAME("SteamVRPassthrough"),
-		View,
-		FScreenPassTextureViewport(SceneColorRenderTarget),
-		FScreenPassTextureViewport(SceneColor),
-		PipelineState,
-		PSPassParameters,
-		EScreenPassDrawFlags::AllowHMDHiddenAreaMask,
-		[VertexShader, PixelShader, PSPassParameters, VSPassParameters, StencilVal](FRHICommandList& RHICmdList)
-	{
-		SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), *VSPassParameters);
-		SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), *PSPassParameters);
-		if (StencilVal >= 0)
-		{
-			RHICmdList.SetStencilRef((uint32)StencilVal);
-		}
-	});
+/**
+ * Projects the corners of the camera image back into the view through the inverse of the UV transform.
+ * Returns false if the footprint can't be bounded, in which case the whole view needs to be drawn.
+ */
+static bool GetCameraFootprint(const FMatrix& UVTransform, const FVector2D& CameraUVSize, FBox2D& OutFootprint)
+{
+	// The shaders multiply with the UVs as column vectors.
+	const FMatrix Transform = UVTransform.GetTransposed();
+	const FMatrix InverseTransform = Transform.Inverse();
 
+	// The homogeneous scale is arbitrary, so the sign at the view center tells which side is in front.
+	const float CenterSign = FMath::Sign(Transform.TransformFVector4(FVector4(0.5f, 0.5f, 1.0f, 1.0f)).Z);
 
-	return MoveTemp(SceneColorRenderTarget);
-}
+	const FVector2D Corners[4] = { FVector2D(0, 0), FVector2D(CameraUVSize.X, 0), CameraUVSize, FVector2D(0, CameraUVSize.Y) };
 
+	OutFootprint = FBox2D(ForceInit);
 
+	for (const FVector2D& Corner : Corners)
+	{
+		const FVector4 ViewUV = InverseTransform.TransformFVector4(FVector4(Corner.X, Corner.Y, 1.0f, 1.0f));
 
-BEGIN_SHADER_PARAMETER_STRUCT(FPassthroughPostProcessMatParameters, )
-	SHADER_PARAMETER_STRUCT_REF(FViewUniformShaderParameters, View)
-	SHADER_PARAMETER_STRUCT_INCLUDE(FSceneTextureShaderParameters, SceneTextures)
-	SHADER_PARAMETER_STRUCT(FScreenPassTextureViewportParameters, PostProcessOutput)
-	SHADER_PARAMETER_STRUCT_ARRAY(FScreenPassTextureInput, PostProcessInput, [kPostProcessMaterialInputCountMax])
-	SHADER_PARAMETER_SAMPLER(SamplerState, PostProcessInput_BilinearSampler)
-	SHADER_PARAMETER_RDG_TEXTURE(Texture2D, MobileCustomStencilTexture)
-	SHADER_PARAMETER_SAMPLER(SamplerState, MobileCustomStencilTextureSampler)
-	SHADER_PARAMETER_RDG_TEXTURE(Texture2D, EyeAdaptationTexture)
-	SHADER_PARAMETER_SRV(Buffer<float4>, EyeAdaptationBuffer)
-	SHADER_PARAMETER(int32, MobileStencilValueRef)
-	SHADER_PARAMETER(uint32, bFlipYAxis)
-	SHADER_PARAMETER(uint32, bMetalMSAAHDRDecode)
-	RENDER_TARGET_BINDING_SLOTS()
+		// The corner is behind the view, so the edges can extend past the view in any direction.
+		if (CenterSign == 0 || ViewUV.Z * CenterSign <= KINDA_SMALL_NUMBER)
+		{
+			return false;
+		}
 
-	SHADER_PARAMETER(FMatrix, FrameTransformMatrixFar)
-	SHADER_PARAMETER(FMatrix, FrameTransformMatrixNear)
-	SHADER_PARAMETER(FVector2D, FrameUVOffset)
-END_SHADER_PARAMETER_STRUCT()
+		OutFootprint += FVector2D(ViewUV.X, ViewUV.Y) / ViewUV.Z;
+	}
 
+	OutFootprint = FBox2D(
+		FVector2D(FMath::Clamp(OutFootprint.Min.X, 0.0f, 1.0f), FMath::Clamp(OutFootprint.Min.Y, 0.0f, 1.0f)),
+		FVector2D(FMath::Clamp(OutFootprint.Max.X, 0.0f, 1.0f), FMath::Clamp(OutFootprint.Max.Y, 0.0f, 1.0f)));
 
-class FPassthroughPostProcessShader : public FMaterialShader
-{
-public:
-	using FParameters = FPassthroughPostProcessMatParameters;
-	SHADER_USE_PARAMETER_STRUCT_WITH_LEGACY_BASE(FPassthroughPostProcessShader, FMaterialShader);
+	OutFootprint.bIsValid = OutFootprint.Max.X > OutFootprint.Min.X && OutFootprint.Max.Y > OutFootprint.Min.Y;
 
-	static bool ShouldCompilePermutation(const FMaterialShaderPermutationParameters& Parameters)
-	{
-		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5) && Parameters.MaterialParameters.MaterialDomain == MD_PostProcess;
-	}
+	return true;
+}
 
-	static void ModifyCompilationEnvironment(const FMaterialShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
-	{
-		FMaterialShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
-		OutEnvironment.SetDefine(TEXT("POST_PROCESS_MATERIAL"), 1);
-		OutEnvironment.SetDefine(TEXT("POST_PROCESS_MATERIAL_BEFORE_TONEMAP"), 0);
-		//OutEnvironment.SetDefine(TEXT("POST_PROCESS_AR_PASSTHROUGH"), 1);
-	}
 
-protected:
-	template <typename TRHIShader>
-	static void SetParameters(FRHICommandList& RHICmdList, const TShaderRef<FPassthroughPostProcessShader>& Shader, TRHIShader* ShaderRHI, const FViewInfo& View, const FMaterialRenderProxy* Proxy, const FParameters& Parameters)
+/** Splits the part of the view outside the drawn rectangle into up to four strips. */
+static int32 GetClearStrips(const FIntRect& OutputRect, const FIntRect& DrawRect, FIntRect OutStrips[4])
+{
+	const FIntRect Strips[4] =
 	{
-		FMaterialShader* MaterialShader = Shader.GetShader();
-		MaterialShader->SetParameters(RHICmdList, ShaderRHI, Proxy, *Proxy->GetMaterialNoFallback(View.GetFeatureLevel()), View);
-		SetShaderParameters(RHICmdList, Shader, ShaderRHI, Parameters);
-	}
-};
-
+		FIntRect(OutputRect.Min.X, OutputRect.Min.Y, OutputRect.Max.X, DrawRect.Min.Y),
+		FIntRect(OutputRect.Min.X, DrawRect.Max.Y, OutputRect.Max.X, OutputRect.Max.Y),
+		FIntRect(OutputRect.Min.X, DrawRect.Min.Y, DrawRect.Min.X, DrawRect.Max.Y),
+		FIntRect(DrawRect.Max.X, DrawRect.Min.Y, OutputRect.Max.X, DrawRect.Max.Y)
+	};
 
-class FPassthroughPostProcessMatVS : public FPassthroughPostProcessShader
-{
-public:
-	DECLARE_SHADER_TYPE(FPassthroughPostProcessMatVS, Material);
+	int32 NumStrips = 0;
 
-	static void SetParameters(FRHICommandList& RHICmdList, const TShaderRef<FPassthroughPostProcessMatVS>& Shader, const FViewInfo& View, const FMaterialRenderProxy* Proxy, const FParameters& Parameters)
+	for (const FIntRect& Strip : Strips)
 	{
-		FPassthroughPostProcessShader::SetParameters(RHICmdList, Shader, Shader.GetVertexShader(), View, Proxy, Parameters);
+		if (Strip.Area() > 0)
+		{
+			OutStrips[NumStrips++] = Strip;
+		}
 	}
 
-	FPassthroughPostProcessMatVS() = default;
-	FPassthroughPostProcessMatVS(const ShaderMetaType::CompiledShaderInitializerType & Initializer)
-		: FPassthroughPostProcessShader(Initializer)
-	{}
-};
+	return NumStrips;
+}
 
 
-class FPassthroughPostProcessMatPS : public FPassthroughPostProcessShader
+bool FSteamVRPassthroughRenderer::GetFootprintDrawRect(const FSteamVRPassthroughViewTransforms& ViewTransforms, const FIntRect& OutputRect, FIntRect& OutDrawRect) const
 {
-public:
-	DECLARE_SHADER_TYPE(FPassthroughPostProcessMatPS, Material);
+	OutDrawRect = OutputRect;
 
-	static void SetParameters(FRHICommandList& RHICmdList, const TShaderRef<FPassthroughPostProcessMatPS>& Shader, const FViewInfo& View, const FMaterialRenderProxy* Proxy, const FParameters& Parameters)
+	if (!CVarScissorToCameraFootprint.GetValueOnRenderThread())
 	{
-		FPassthroughPostProcessShader::SetParameters(RHICmdList, Shader, Shader.GetPixelShader(), View, Proxy, Parameters);
+		return false;
 	}
 
-	FPassthroughPostProcessMatPS() = default;
-	FPassthroughPostProcessMatPS(const ShaderMetaType::CompiledShaderInitializerType & Initializer)
-		: FPassthroughPostProcessShader(Initializer)
-	{}
-};
-
-
-IMPLEMENT_SHADER_TYPE(, FPassthroughPostProcessMatVS, TEXT("/Plugin/SteamVRPassthrough/Private/PassthroughPostProcess.usf"), TEXT("MainVS_Passthrough"), SF_Vertex);
-IMPLEMENT_SHADER_TYPE(, FPassthroughPostProcessMatPS, TEXT("/Plugin/SteamVRPassthrough/Private/PassthroughPostProcess.usf"), TEXT("MainPS_Passthrough"), SF_Pixel);
+	const FBox2D& Footprint = ViewTransforms.CameraFootprint;
+	const FVector2D OutputSize = FVector2D(OutputRect.Size());
 
+	if (Footprint.bIsValid)
+	{
+		// Rounded outwards so the edge pixels still get the camera frame.
+		OutDrawRect.Min = OutputRect.Min + FIntPoint(FMath::FloorToInt(Footprint.Min.X * OutputSize.X), FMath::FloorToInt(Footprint.Min.Y * OutputSize.Y));
+		OutDrawRect.Max = OutputRect.Min + FIntPoint(FMath::CeilToInt(Footprint.Max.X * OutputSize.X), FMath::CeilToInt(Footprint.Max.Y * OutputSize.Y));
+		OutDrawRect.Clip(OutputRect);
+	}
+	else
+	{
+		OutDrawRect = FIntRect(OutputRect.Min, OutputRect.Min);
+	}
 
+	return true;
+}
 
-// Copied from postprocessmaterial.cpp
 
-FRHIDepthStencilState* GetMaterialStencilState(const FMaterial* Material)
+FLinearColor FSteamVRPassthroughRenderer::GetOutputClearColor(const bool bLinearOutput, const float PreExposure) const
 {
-	static FRHIDepthStencilState* StencilStates[] =
+	if (bLinearOutput)
 	{
-		TStaticDepthStencilState<false, CF_Always, true, CF_Less>::GetRHI(),
-		TStaticDepthStencilState<false, CF_Always, true, CF_LessEqual>::GetRHI(),
-		TStaticDepthStencilState<false, CF_Always, true, CF_Greater>::GetRHI(),
-		TStaticDepthStencilState<false, CF_Always, true, CF_GreaterEqual>::GetRHI(),
-		TStaticDepthStencilState<false, CF_Always, true, CF_Equal>::GetRHI(),
-		TStaticDepthStencilState<false, CF_Always, true, CF_NotEqual>::GetRHI(),
-		TStaticDepthStencilState<false, CF_Always, true, CF_Never>::GetRHI(),
-		TStaticDepthStencilState<false, CF_Always, true, CF_Always>::GetRHI(),
-	};
-	static_assert(EMaterialStencilCompare::MSC_Count == UE_ARRAY_COUNT(StencilStates), "Ensure that all EMaterialStencilCompare values are accounted for.");
+		return RenderSettings.ClearColor * PreExposure;
+	}
 
-	return StencilStates[Material->GetStencilCompare()];
+	// Written directly to gamma space targets.
+	return FLinearColor(RenderSettings.ClearColor.ToFColor(true));
 }
 
 
-FRHIBlendState* GetMaterialBlendState(const FMaterial* Material)
+void FSteamVRPassthroughRenderer::AddClearPass_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& View, const FScreenPassRenderTarget& Target, const FIntRect& Rect, const FLinearColor& ClearColor, const FRenderTargetBindingSlots& RenderTargets, FRHIBlendState* BlendState, FRHIDepthStencilState* StencilState, int32 StencilVal)
 {
-	static FRHIBlendState* BlendStates[] =
+	if (Rect.Area() <= 0)
 	{
-		TStaticBlendState<>::GetRHI(),
-		TStaticBlendState<>::GetRHI(),
-		TStaticBlendState<CW_RGB, BO_Add, BF_SourceAlpha, BF_InverseSourceAlpha, BO_Add, BF_Zero, BF_One>::GetRHI(),
-		TStaticBlendState<CW_RGB, BO_Add, BF_One, BF_One>::GetRHI(),
-		TStaticBlendState<CW_RGB, BO_Add, BF_DestColor, BF_Zero>::GetRHI(),
-		TStaticBlendState<CW_RGBA, BO_Add, BF_One, BF_InverseSourceAlpha, BO_Add, BF_One, BF_InverseSourceAlpha>::GetRHI(),
-		TStaticBlendState<CW_RGBA, BO_Add, BF_Zero, BF_InverseSourceAlpha, BO_Add, BF_Zero, BF_InverseSourceAlpha>::GetRHI(),
-	};
-	static_assert(EBlendMode::BLEND_MAX == UE_ARRAY_COUNT(BlendStates), "Ensure that all EBlendMode values are accounted for.");
+		return;
+	}
 
-	return BlendStates[Material->GetBlendMode()];
+	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
+	TShaderMapRef< FPassthroughFullsceenVS > VertexShader(GlobalShaderMap);
+	TShaderMapRef< FPassthroughClearPS > PixelShader(GlobalShaderMap);
+
+	FPassthroughFullsceenVS::FParameters* VSPassParameters = GraphBuilder.AllocParameters<FPassthroughFullsceenVS::FParameters>();
+	VSPassParameters->FrameTransformMatrixFar = FMatrix::Identity;
+
+	FPassthroughClearPS::FParameters* PSPassParameters = GraphBuilder.AllocParameters<FPassthroughClearPS::FParameters>();
+	PSPassParameters->ClearColor = ClearColor;
+	PSPassParameters->RenderTargets = RenderTargets;
+
+	TrackPipelineUse_RenderThread(VertexShader.GetVertexShader(), PixelShader.GetPixelShader(), BlendState, StencilState, StencilVal >= 0);
+
+	const FScreenPassTextureViewport Viewport(Target.Texture, Rect);
+
+	AddDrawScreenPass(
+		GraphBuilder,
+		RDG_EVENT_NAME("SteamVRPassthrough Clear %dx%d", Rect.Width(), Rect.Height()),
+		View,
+		Viewport,
+		Viewport,
+		FScreenPassPipelineState(VertexShader, PixelShader, BlendState, StencilState),
+		PSPassParameters,
+		EScreenPassDrawFlags::None,
+		[VertexShader, PixelShader, PSPassParameters, VSPassParameters, StencilVal](FRHICommandList& RHICmdList)
+	{
+		SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), *VSPassParameters);
+		SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), *PSPassParameters);
+		if (StencilVal >= 0)
+		{
+			RHICmdList.SetStencilRef((uint32)StencilVal);
+		}
+	});
 }
 
 
 
-FScreenPassTexture FSteamVRPassthroughRenderer::DrawPostProcessMatPassthrough_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& InView, const FPostProcessMaterialInputs& Inputs)
+FScreenPassTexture FSteamVRPassthroughRenderer::DrawFullscreenPassthrough_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& InView, const FPostProcessMaterialInputs& Inputs)
 {
 	FScopeLock Lock(&RenderLock);
 
 	// This gets passed as a FViewInfo from postprocessing
 	FViewInfo& View = (FViewInfo&)InView;
 
-	Inputs.Validate();
-
 	const FScreenPassTexture SceneColor = Inputs.GetInput(EPostProcessMaterialInput::SceneColor);
 
-	const FMaterialRenderProxy* MaterialProxy = PostProcessMaterial->GetRenderProxy();
-	check(MaterialProxy);
+	if (!IsValid(CameraTexture) || CameraTexture->Resource == nullptr)
+	{
+		return SceneColor;
+	}
 
-	const FMaterial* const Material = MaterialProxy->GetMaterialNoFallback(InView.GetFeatureLevel());
-	
+	// Before tonemapping the scene color is linear and pre-exposed, after it the gamma space camera values can be written out as-is.
+	const bool bLinearOutput = RenderSettings.InjectionPoint == Injection_BeforeTonemap;
 
-	if (!IsValid(CameraTexture) || CameraTexture->Resource == nullptr || Material == nullptr)
+	FShaderResourceViewRHIRef CameraTextureSRV = bLinearOutput ? GetCameraTextureLinearSRV_RenderThread() : GetCameraTextureGammaSRV_RenderThread();
+
+	if (!CameraTextureSRV.IsValid())
 	{
 		return SceneColor;
 	}
 
-	const FMaterialShaderMap* MaterialShaderMap = Material->GetRenderingThreadShaderMap();
-
-	TShaderRef< FPassthroughPostProcessMatVS > VertexShader = MaterialShaderMap->GetShader<FPassthroughPostProcessMatVS>();
-	TShaderRef< FPassthroughPostProcessMatPS > PixelShader = MaterialShaderMap->GetShader<FPassthroughPostProcessMatPS>();
+	const FIntPoint GridSize = FIntPoint(CVarWarpGridColumns.GetValueOnRenderThread(), CVarWarpGridRows.GetValueOnRenderThread());
+	const bool bUseWarpGrid = IsWarpGridEnabled_RenderThread(QualityGovernor.Tier);
 
-	FScreenPassRenderTarget Output = Inputs.OverrideOutput;
+	const EPassthroughCameraFilter CameraFilter = GetCameraFilter_RenderThread(QualityGovernor.Tier);
+	FRHITexture* ColorLUT = GetCameraColorLUT_RenderThread();
 
+	const FSteamVRPassthroughViewTransforms& ViewTransforms = GetViewTransforms_RenderThread(View);
 
-	FRHIDepthStencilState* DefaultDepthStencilState = FScreenPassPipelineState::FDefaultDepthStencilState::GetRHI();
-	FRHIDepthStencilState* DepthStencilState = DefaultDepthStencilState;
+	const bool bDepthPlanes = ViewTransforms.NumPlanes > 1 && !bUseWarpGrid && Inputs.SceneTextures.SceneTextures != nullptr;
 
-	FRDGTextureRef DepthStencilTexture = nullptr;
+	FPassthroughFullsceenPS::FPermutationDomain PSPermutationVector = FPassthroughFullsceenPS::GetPermutation(RenderSettings, FrameLayout, ViewTransforms.CameraId, bUndistortFrames, bUseWarpGrid, CameraFilter, ColorLUT != nullptr, bDepthPlanes);
 
+	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
+	TShaderMapRef< FPassthroughFullsceenPS > PixelShader(GlobalShaderMap, PSPermutationVector);
 
+	FScreenPassRenderTarget SceneColorRenderTarget = Inputs.OverrideOutput;
 
-	if (Material->IsStencilTestEnabled())
+	if (!SceneColorRenderTarget.IsValid())
 	{
-		check(Inputs.CustomDepthTexture);
-		DepthStencilTexture = Inputs.CustomDepthTexture;
-		DepthStencilState = GetMaterialStencilState(Material);
+		ERenderTargetLoadAction Action = View.bHMDHiddenAreaMaskActive ? ERenderTargetLoadAction::EClear : ERenderTargetLoadAction::ENoAction;
+
+		SceneColorRenderTarget = FScreenPassRenderTarget::CreateFromInput(GraphBuilder, SceneColor, Action, TEXT("Passthrough"));
 	}
 
-	FRHIBlendState* DefaultBlendState = FScreenPassPipelineState::FDefaultBlendState::GetRHI();
-	FRHIBlendState* BlendState = DefaultBlendState;
+	AddDrawTexturePass(GraphBuilder, View, SceneColor, SceneColorRenderTarget);
+	SceneColorRenderTarget.LoadAction = ERenderTargetLoadAction::ELoad;
 
-	if (Material->GetBlendableOutputAlpha())
+	PipelineColorFormat = SceneColorRenderTarget.Texture->Desc.Format;
+	PipelineColorFlags = SceneColorRenderTarget.Texture->Desc.Flags;
+	PipelineFormatsInjectionPoint = RenderSettings.InjectionPoint;
+
+	FRHITexture* UndistortionMap = bUndistortFrames ? UndistortionMapRHI.GetReference() : GBlackTexture->TextureRHI.GetReference();
+	FRHISamplerState* UndistortionMapSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+
+	FPassthroughFullsceenPS::FParameters* PSPassParameters = GraphBuilder.AllocParameters<FPassthroughFullsceenPS::FParameters>();
+	PSPassParameters->CameraTexture = CameraTextureSRV;
+	PSPassParameters->CameraTextureSampler = TStaticSamplerState<SF_Bilinear>::GetRHI();
+	PSPassParameters->UndistortionMap = UndistortionMap;
+	PSPassParameters->UndistortionMapSampler = UndistortionMapSampler;
+	PSPassParameters->CameraSharpening = GetCameraSharpening_RenderThread(CameraFilter);
+	PSPassParameters->bLinearOutput = bLinearOutput;
+	PSPassParameters->CameraColorScale = GetCameraColorScale(RenderSettings);
+
+	if (bDepthPlanes)
 	{
-		BlendState = GetMaterialBlendState(Material);
-	}
+		for (int32 Index = 0; Index < ViewTransforms.NumPlanes; Index++)
+		{
+			PSPassParameters->PlaneTransforms[Index] = ViewTransforms.FrameTransformPlanes[Index];
 
+			// Compared against the scene depth, which is in world units.
+			PSPassParameters->PlaneDepths[Index / 4][Index % 4] = ViewTransforms.PlaneDistances[Index] * View.WorldToMetersScale;
+		}
 
-	const bool bCompositeWithInput = DepthStencilState != DefaultDepthStencilState || BlendState != DefaultBlendState;
+		PSPassParameters->NumPlanes = ViewTransforms.NumPlanes;
+		PSPassParameters->SceneDepthTexture = Inputs.SceneTextures.SceneTextures->GetParameters()->SceneDepthTexture;
+	}
+	PSPassParameters->CameraColorLUT = ColorLUT ? ColorLUT : GBlackVolumeTexture->TextureRHI.GetReference();
+	PSPassParameters->CameraColorLUTSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+	PSPassParameters->View = View.ViewUniformBuffer;
+	PSPassParameters->PreprocessedFrame = GetPreprocessedFrameSRV_RenderThread(GraphBuilder);
+	PSPassParameters->RenderTargets[0] = SceneColorRenderTarget.GetRenderTargetBinding();
 
+	const FMatrix& FrameTransform = ViewTransforms.FrameTransformFar;
 
-	if (!Output.IsValid() && !MaterialShaderMap->UsesSceneTexture(PPI_PostProcessInput0) && Inputs.bAllowSceneColorInputAsOutput)
+	FRHIBlendState* BlendState = TStaticBlendState<>::GetRHI();
+	FRHIDepthStencilState* StencilState = TStaticDepthStencilState<>::GetRHI();
+
+	if (RenderSettings.bSceneAlphaMask)
 	{
-		Output = FScreenPassRenderTarget(SceneColor, ERenderTargetLoadAction::ELoad);
+		// Blend based on the inverse render target alpha.
+		BlendState = TStaticBlendState<CW_RGB, BO_Add, BF_DestAlpha, BF_InverseDestAlpha>::GetRHI();
 	}
-	else if(!Output.IsValid())
+
+	if (RenderSettings.StencilTestValue >= 0)
 	{
+		PSPassParameters->RenderTargets.DepthStencil = FDepthStencilBinding(Inputs.CustomDepthTexture, ERenderTargetLoadAction::ELoad, ERenderTargetLoadAction::ELoad, FExclusiveDepthStencil::DepthRead_StencilRead);
 
-		ERenderTargetLoadAction Action = View.bHMDHiddenAreaMaskActive ? ERenderTargetLoadAction::EClear : ERenderTargetLoadAction::ENoAction;
+		StencilState = TStaticDepthStencilState<false, CF_Always, true, CF_Equal>::GetRHI();
 
-		Output = FScreenPassRenderTarget::CreateFromInput(GraphBuilder, SceneColor, Action, TEXT("Passthrough"));
-	}
-	else
-	{
-		AddDrawTexturePass(GraphBuilder, View, SceneColor, Output);
-		Output.LoadAction = ERenderTargetLoadAction::ELoad;
+		PipelineDepthStencilFormat = Inputs.CustomDepthTexture->Desc.Format;
+		PipelineDepthStencilFlags = Inputs.CustomDepthTexture->Desc.Flags;
 	}
 
+	int32 StencilVal = RenderSettings.StencilTestValue;
 
-	const FScreenPassTextureViewport OutputViewport(Output);
+	// The view rect can be smaller than the texture with dynamic resolution, and stereo views share a texture.
+	const FIntRect OutputRect = SceneColorRenderTarget.ViewRect;
+	FIntRect DrawRect;
 
-	const uint32 MaterialStencilRef = Material->GetStencilRefValue();
+	if (GetFootprintDrawRect(ViewTransforms, OutputRect, DrawRect))
+	{
+		const FLinearColor ClearColor = GetOutputClearColor(bLinearOutput, View.PreExposure);
 
-	FPassthroughPostProcessMatParameters* PassParameters = GraphBuilder.AllocParameters<FPassthroughPostProcessMatParameters>();
+		FIntRect Strips[4];
+		const int32 NumStrips = GetClearStrips(OutputRect, DrawRect, Strips);
 
-	PassParameters->EyeAdaptationTexture = GetEyeAdaptationTexture(GraphBuilder, View);
-	PassParameters->SceneTextures = Inputs.SceneTextures;
-	PassParameters->View = View.ViewUniformBuffer;
-	PassParameters->PostProcessOutput = GetScreenPassTextureViewportParameters(OutputViewport);
-	PassParameters->RenderTargets[0] = Output.GetRenderTargetBinding();
-	PassParameters->PostProcessInput_BilinearSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
-	PassParameters->bFlipYAxis = false;
+		for (int32 Index = 0; Index < NumStrips; Index++)
+		{
+			AddClearPass_RenderThread(GraphBuilder, View, SceneColorRenderTarget, Strips[Index], ClearColor, PSPassParameters->RenderTargets, BlendState, StencilState, StencilVal);
+		}
 
-	if (DepthStencilTexture)
-	{
-		PassParameters->RenderTargets.DepthStencil = FDepthStencilBinding(
-			DepthStencilTexture,
-			ERenderTargetLoadAction::ELoad,
-			ERenderTargetLoadAction::ELoad,
-			FExclusiveDepthStencil::DepthRead_StencilRead);
+		if (DrawRect.Area() <= 0)
+		{
+			return MoveTemp(SceneColorRenderTarget);
+		}
 	}
 
-	const FScreenPassTexture BlackDummy(RegisterExternalOrPassthroughTexture(&GraphBuilder, GSystemTextures.BlackDummy));
+	const FVector2D OutputSize = FVector2D(OutputRect.Size());
+	const FBox2D DrawUVRect = FBox2D(FVector2D(DrawRect.Min - OutputRect.Min) / OutputSize, FVector2D(DrawRect.Max - OutputRect.Min) / OutputSize);
 
-	GraphBuilder.RemoveUnusedTextureWarning(BlackDummy.Texture);
+	// Wrapped so the GPU stat of the camera filter can enclose either draw path.
+	auto AddPassthroughDraw = [&]()
+	{
+		if (bUseWarpGrid)
+		{
+			RDG_GPU_STAT_SCOPE(GraphBuilder, SteamVRPassthrough_WarpGrid);
 
-	FRHISamplerState* PointClampSampler = TStaticSamplerState<SF_Point, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+			TShaderMapRef< FPassthroughGridVS > VertexShader(GlobalShaderMap, FPassthroughGridVS::GetPermutation(FrameLayout, ViewTransforms.CameraId, bUndistortFrames));
 
-	for (uint32 InputIndex = 0; InputIndex < kPostProcessMaterialInputCountMax; ++InputIndex)
-	{
-		FScreenPassTexture Input = Inputs.GetInput((EPostProcessMaterialInput)InputIndex);
+			TrackPipelineUse_RenderThread(VertexShader.GetVertexShader(), PixelShader.GetPixelShader(), BlendState, StencilState, StencilVal >= 0);
 
-		if (!Input.Texture || !MaterialShaderMap->UsesSceneTexture(PPI_PostProcessInput0 + InputIndex))
-		{
-			Input = BlackDummy;
+			FPassthroughGridVS::FParameters* VSPassParameters = GraphBuilder.AllocParameters<FPassthroughGridVS::FParameters>();
+			VSPassParameters->FrameTransformMatrixFar = FrameTransform;
+			VSPassParameters->GridSize = GridSize;
+			VSPassParameters->GridUVRect = FVector4(DrawUVRect.Min, DrawUVRect.Max);
+			VSPassParameters->UndistortionMap = UndistortionMap;
+			VSPassParameters->UndistortionMapSampler = UndistortionMapSampler;
+
+			GraphBuilder.AddPass(
+				RDG_EVENT_NAME("SteamVRPassthrough (warp grid %dx%d)", GridSize.X, GridSize.Y),
+				PSPassParameters,
+				ERDGPassFlags::Raster,
+				[VertexShader, PixelShader, PSPassParameters, VSPassParameters, BlendState, StencilState, StencilVal, OutputRect, GridSize](FRHICommandList& RHICmdList)
+			{
+				RHICmdList.SetViewport(OutputRect.Min.X, OutputRect.Min.Y, 0.0f, OutputRect.Max.X, OutputRect.Max.Y, 1.0f);
+
+				FGraphicsPipelineStateInitializer GraphicsPSOInit;
+				RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+				GraphicsPSOInit.BlendState = BlendState;
+				GraphicsPSOInit.RasterizerState = TStaticRasterizerState<>::GetRHI();
+				GraphicsPSOInit.DepthStencilState = StencilState;
+				GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GEmptyVertexDeclaration.VertexDeclarationRHI;
+				GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader.GetVertexShader();
+				GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader.GetPixelShader();
+				GraphicsPSOInit.PrimitiveType = PT_TriangleList;
+				SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit);
+
+				SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), *VSPassParameters);
+				SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), *PSPassParameters);
+				if (StencilVal >= 0)
+				{
+					RHICmdList.SetStencilRef((uint32)StencilVal);
+				}
+
+				// Two triangles per grid cell
+				RHICmdList.DrawPrimitive(0, GridSize.X * GridSize.Y * 2, 1);
+			});
 		}
+		else
+		{
+			RDG_GPU_STAT_SCOPE(GraphBuilder, SteamVRPassthrough_PerPixel);
 
-		PassParameters->PostProcessInput[InputIndex] = GetScreenPassTextureInput(Input, PointClampSampler);
-	}
+			TShaderMapRef< FPassthroughFullsceenVS > VertexShader(GlobalShaderMap);
 
-	
-	if (View.StereoPass == EStereoscopicPass::eSSP_LEFT_EYE)
-	{
-		PassParameters->FrameTransformMatrixFar = LeftFrameTransformFar;
-		PassParameters->FrameTransformMatrixNear = LeftFrameTransformNear;
-	}
-	else
-	{
-		PassParameters->FrameTransformMatrixFar = RightFrameTransformFar;
-		PassParameters->FrameTransformMatrixNear = RightFrameTransformNear;
-	}
+			TrackPipelineUse_RenderThread(VertexShader.GetVertexShader(), PixelShader.GetPixelShader(), BlendState, StencilState, StencilVal >= 0);
 
-	PassParameters->FrameUVOffset = GetFrameUVOffset(View.StereoPass, FrameLayout);
+			FPassthroughFullsceenVS::FParameters* VSPassParameters = GraphBuilder.AllocParameters<FPassthroughFullsceenVS::FParameters>();
+			VSPassParameters->FrameTransformMatrixFar = FrameTransform;
 
-	ClearUnusedGraphResources(VertexShader, PixelShader, PassParameters);
+			FScreenPassPipelineState PipelineState = FScreenPassPipelineState(VertexShader, PixelShader, BlendState, StencilState);
 
-	AddDrawScreenPass(
-		GraphBuilder,
-		RDG_EVENT_NAME("SteamVR Passthrough, material=%s", *Material->GetFriendlyName()),
-		View,
-		OutputViewport,
-		FScreenPassTextureViewport(SceneColor),
+			// The UVs the transform takes are relative to the view rect, not the whole texture.
+			const FScreenPassTextureViewport ViewUVViewport(OutputRect.Size(), DrawRect - OutputRect.Min);
+
+			// The hidden area mesh covers the whole viewport, so it would be squeezed into a scissored draw rect.
+			const EScreenPassDrawFlags DrawFlags = (DrawRect == OutputRect) ? EScreenPassDrawFlags::AllowHMDHiddenAreaMask : EScreenPassDrawFlags::None;
+
+			AddDrawScreenPass(
+				GraphBuilder,
+				RDG_EVENT_NAME("SteamVRPassthrough"),
+				View,
+				FScreenPassTextureViewport(SceneColorRenderTarget.Texture, DrawRect),
+				ViewUVViewport,
+				PipelineState,
+				PSPassParameters,
+				DrawFlags,
+				[VertexShader, PixelShader, PSPassParameters, VSPassParameters, StencilVal](FRHICommandList& RHICmdList)
+			{
+				SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), *VSPassParameters);
+				SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), *PSPassParameters);
+				if (StencilVal >= 0)
+				{
+					RHICmdList.SetStencilRef((uint32)StencilVal);
+				}
+			});
+		}
+	};
+
+	switch (CameraFilter)
+	{
+	case EPassthroughCameraFilter::Bicubic:
+	{
+		RDG_GPU_STAT_SCOPE(GraphBuilder, SteamVRPassthrough_FilterBicubic);
+		AddPassthroughDraw();
+		break;
+	}
+	case EPassthroughCameraFilter::Sharpen:
+	{
+		RDG_GPU_STAT_SCOPE(GraphBuilder, SteamVRPassthrough_FilterSharpen);
+		AddPassthroughDraw();
+		break;
+	}
+	default:
+		AddPassthroughDraw();
+	}
+
+	return MoveTemp(SceneColorRenderTarget);
+}
+
+
+void FSteamVRPassthroughRenderer::PostRenderView_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneView& InView)
+{
+	if (!RenderSettings.bStreamEnabled || !bHasValidFrame || RenderSettings.PostProcessMode != Mode_Simple || RenderSettings.InjectionPoint != Injection_AfterUpscale)
+	{
+		return;
+	}
+
+	DrawPassthroughAfterUpscale_RenderThread(RHICmdList, InView);
+}
+
+
+void FSteamVRPassthroughRenderer::DrawPassthroughAfterUpscale_RenderThread(FRHICommandListImmediate& RHICmdList, const FSceneView& View)
+{
+	FScopeLock Lock(&RenderLock);
+
+	if (!IsValid(CameraTexture) || CameraTexture->Resource == nullptr || View.Family == nullptr || View.Family->RenderTarget == nullptr)
+	{
+		return;
+	}
+
+	FRHITexture* TargetTexture = View.Family->RenderTarget->GetRenderTargetTexture();
+	FShaderResourceViewRHIRef CameraTextureSRV = GetCameraTextureGammaSRV_RenderThread();
+
+	if (TargetTexture == nullptr || !CameraTextureSRV.IsValid())
+	{
+		return;
+	}
+
+	SCOPED_DRAW_EVENT(RHICmdList, SteamVRPassthroughAfterUpscale);
+	SCOPED_GPU_STAT(RHICmdList, SteamVRPassthrough_PerPixel);
+
+	const EPassthroughCameraFilter CameraFilter = GetCameraFilter_RenderThread(QualityGovernor.Tier);
+	FRHITexture* ColorLUT = GetCameraColorLUT_RenderThread();
+
+	const FSteamVRPassthroughViewTransforms& ViewTransforms = GetViewTransforms_RenderThread(View);
+
+	// The custom stencil is at the internal resolution, so only scene alpha masking is supported here.
+	FSteamVRPassthroughSettings Settings = RenderSettings;
+	Settings.StencilTestValue = -1;
+
+	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
+	TShaderMapRef< FPassthroughFullsceenVS > VertexShader(GlobalShaderMap);
+	TShaderMapRef< FPassthroughFullsceenPS > PixelShader(GlobalShaderMap, FPassthroughFullsceenPS::GetPermutation(Settings, FrameLayout, ViewTransforms.CameraId, bUndistortFrames, false, CameraFilter, ColorLUT != nullptr, false));
+	TShaderMapRef< FPassthroughClearPS > ClearPixelShader(GlobalShaderMap);
+
+	FPassthroughFullsceenVS::FParameters VSParameters;
+	VSParameters.FrameTransformMatrixFar = ViewTransforms.FrameTransformFar;
+
+	FPassthroughFullsceenPS::FParameters PSParameters;
+	PSParameters.CameraTexture = CameraTextureSRV;
+	PSParameters.CameraTextureSampler = TStaticSamplerState<SF_Bilinear>::GetRHI();
+	PSParameters.UndistortionMap = bUndistortFrames ? UndistortionMapRHI.GetReference() : GBlackTexture->TextureRHI.GetReference();
+	PSParameters.UndistortionMapSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+	PSParameters.CameraSharpening = GetCameraSharpening_RenderThread(CameraFilter);
+	PSParameters.bLinearOutput = false;
+	PSParameters.CameraColorScale = GetCameraColorScale(RenderSettings);
+	PSParameters.CameraColorLUT = ColorLUT ? ColorLUT : GBlackVolumeTexture->TextureRHI.GetReference();
+	PSParameters.CameraColorLUTSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+	PSParameters.View = View.ViewUniformBuffer;
+
+	FPassthroughClearPS::FParameters ClearPSParameters;
+	ClearPSParameters.ClearColor = GetOutputClearColor(false, 1.0f);
+
+	// The view is at display resolution after the upscale.
+	const FIntRect OutputRect = View.UnscaledViewRect;
+	const FIntPoint OutputSize = OutputRect.Size();
+
+	FIntRect DrawRect;
+	FIntRect Strips[4];
+	int32 NumStrips = 0;
+
+	if (GetFootprintDrawRect(ViewTransforms, OutputRect, DrawRect))
+	{
+		NumStrips = GetClearStrips(OutputRect, DrawRect, Strips);
+	}
+
+	FRHIBlendState* BlendState = RenderSettings.bSceneAlphaMask ? TStaticBlendState<CW_RGB, BO_Add, BF_DestAlpha, BF_InverseDestAlpha>::GetRHI() : TStaticBlendState<>::GetRHI();
+	FRHIDepthStencilState* DepthStencilState = TStaticDepthStencilState<false, CF_Always>::GetRHI();
+
+	PipelineColorFormat = TargetTexture->GetFormat();
+	PipelineColorFlags = TargetTexture->GetFlags();
+	PipelineFormatsInjectionPoint = RenderSettings.InjectionPoint;
+
+	FRHIRenderPassInfo RPInfo(TargetTexture, ERenderTargetActions::Load_Store);
+	RHICmdList.BeginRenderPass(RPInfo, TEXT("SteamVRPassthroughAfterUpscale"));
+
+	RHICmdList.SetViewport(OutputRect.Min.X, OutputRect.Min.Y, 0.0f, OutputRect.Max.X, OutputRect.Max.Y, 1.0f);
+
+	FGraphicsPipelineStateInitializer GraphicsPSOInit;
+	RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+	GraphicsPSOInit.BlendState = BlendState;
+	GraphicsPSOInit.RasterizerState = TStaticRasterizerState<>::GetRHI();
+	GraphicsPSOInit.DepthStencilState = DepthStencilState;
+	GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GFilterVertexDeclaration.VertexDeclarationRHI;
+	GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader.GetVertexShader();
+	GraphicsPSOInit.PrimitiveType = PT_TriangleList;
+
+	if (NumStrips > 0)
+	{
+		TrackPipelineUse_RenderThread(VertexShader.GetVertexShader(), ClearPixelShader.GetPixelShader(), BlendState, DepthStencilState, false);
+
+		GraphicsPSOInit.BoundShaderState.PixelShaderRHI = ClearPixelShader.GetPixelShader();
+		SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit);
+
+		SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), VSParameters);
+		SetShaderParameters(RHICmdList, ClearPixelShader, ClearPixelShader.GetPixelShader(), ClearPSParameters);
+
+		for (int32 Index = 0; Index < NumStrips; Index++)
+		{
+			const FIntRect Strip = Strips[Index] - OutputRect.Min;
+
+			DrawRectangle(RHICmdList, Strip.Min.X, Strip.Min.Y, Strip.Width(), Strip.Height(), Strip.Min.X, Strip.Min.Y, Strip.Width(), Strip.Height(), OutputSize, OutputSize, VertexShader);
+		}
+	}
+
+	if (DrawRect.Area() > 0)
+	{
+		TrackPipelineUse_RenderThread(VertexShader.GetVertexShader(), PixelShader.GetPixelShader(), BlendState, DepthStencilState, false);
+
+		GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader.GetPixelShader();
+		SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit);
+
+		SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), VSParameters);
+		SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), PSParameters);
+
+		// The texture size is the view size, so the UVs passed to the transform are relative to the view.
+		const FIntRect Rect = DrawRect - OutputRect.Min;
+
+		auto DrawPassthroughRect = [&]()
+		{
+			DrawRectangle(RHICmdList, Rect.Min.X, Rect.Min.Y, Rect.Width(), Rect.Height(), Rect.Min.X, Rect.Min.Y, Rect.Width(), Rect.Height(), OutputSize, OutputSize, VertexShader);
+		};
+
+		switch (CameraFilter)
+		{
+		case EPassthroughCameraFilter::Bicubic:
+		{
+			SCOPED_GPU_STAT(RHICmdList, SteamVRPassthrough_FilterBicubic);
+			DrawPassthroughRect();
+			break;
+		}
+		case EPassthroughCameraFilter::Sharpen:
+		{
+			SCOPED_GPU_STAT(RHICmdList, SteamVRPassthrough_FilterSharpen);
+			DrawPassthroughRect();
+			break;
+		}
+		default:
+			DrawPassthroughRect();
+		}
+	}
+
+	RHICmdList.EndRenderPass();
+}
+
+
+// Render target sizes the warp grid benchmark is run at, from low resolution headsets up to supersampled high resolution ones.
+static const FIntPoint WarpGridBenchmarkSizes[] = { FIntPoint(1024, 1024), FIntPoint(1440, 1600), FIntPoint(2016, 2240), FIntPoint(2880, 3200) };
+
+
+void FSteamVRPassthroughRenderer::RequestWarpGridBenchmark(const TArray<FString>& Args)
+{
+	const int32 NumDraws = Args.Num() > 0 ? FMath::Clamp(FCString::Atoi(*Args[0]), 1, 1000) : WARP_GRID_BENCHMARK_DEFAULT_DRAWS;
+
+	if (!GSupportsTimestampRenderQueries)
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("The warp grid benchmark needs GPU timestamp queries, which the RHI doesn't support."));
+		return;
+	}
+
+	int32 NumRenderers = 0;
+
+	for (const TPair<uint32, TWeakPtr<FSteamVRPassthroughRenderer, ESPMode::ThreadSafe>>& Entry : SharedRenderers)
+	{
+		TSharedPtr<FSteamVRPassthroughRenderer, ESPMode::ThreadSafe> Renderer = Entry.Value.Pin();
+
+		if (!Renderer.IsValid() || !Renderer->bIsInitialized)
+		{
+			continue;
+		}
+
+		NumRenderers++;
+
+		ENQUEUE_RENDER_COMMAND(RequestWarpGridBenchmark)(
+			[Renderer, NumDraws](FRHICommandListImmediate& RHICmdList)
+		{
+			FScopeLock Lock(&Renderer->RenderLock);
+			Renderer->PendingBenchmarkDraws = NumDraws;
+		});
+	}
+
+	if (NumRenderers == 0)
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("The warp grid benchmark needs passthrough to be running."));
+	}
+}
+
+
+void FSteamVRPassthroughRenderer::AddWarpGridBenchmarkPasses_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& View)
+{
+	const int32 NumDraws = PendingBenchmarkDraws;
+	PendingBenchmarkDraws = 0;
+
+	FShaderResourceViewRHIRef CameraTextureSRV = GetCameraTextureGammaSRV_RenderThread();
+
+	// Results of an earlier run are still being read back.
+	if (!CameraTextureSRV.IsValid() || BenchmarkSamples.Num() > 0)
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Skipping the warp grid benchmark, no camera frame is available or an earlier run hasn't finished."));
+		return;
+	}
+
+	const FIntPoint GridSize = FIntPoint(FMath::Max(CVarWarpGridColumns.GetValueOnRenderThread(), 1), FMath::Max(CVarWarpGridRows.GetValueOnRenderThread(), 1));
+	const EPassthroughCameraFilter CameraFilter = GetCameraFilter_RenderThread(QualityGovernor.Tier);
+	FRHITexture* ColorLUT = GetCameraColorLUT_RenderThread();
+
+	const FSteamVRPassthroughViewTransforms& ViewTransforms = GetViewTransforms_RenderThread(View);
+
+	// Only the shading is compared, so the stencil and depth planes are left out.
+	FSteamVRPassthroughSettings Settings = RenderSettings;
+	Settings.StencilTestValue = -1;
+
+	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
+	TShaderMapRef< FPassthroughFullsceenVS > FullscreenVertexShader(GlobalShaderMap);
+	TShaderMapRef< FPassthroughGridVS > GridVertexShader(GlobalShaderMap, FPassthroughGridVS::GetPermutation(FrameLayout, ViewTransforms.CameraId, bUndistortFrames));
+
+	FRHITexture* UndistortionMap = bUndistortFrames ? UndistortionMapRHI.GetReference() : GBlackTexture->TextureRHI.GetReference();
+	FRHISamplerState* UndistortionMapSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+
+	FPassthroughFullsceenVS::FParameters* FullscreenVSParameters = GraphBuilder.AllocParameters<FPassthroughFullsceenVS::FParameters>();
+	FullscreenVSParameters->FrameTransformMatrixFar = ViewTransforms.FrameTransformFar;
+
+	FPassthroughGridVS::FParameters* GridVSParameters = GraphBuilder.AllocParameters<FPassthroughGridVS::FParameters>();
+	GridVSParameters->FrameTransformMatrixFar = ViewTransforms.FrameTransformFar;
+	GridVSParameters->GridSize = GridSize;
+	GridVSParameters->GridUVRect = FVector4(0.0f, 0.0f, 1.0f, 1.0f);
+	GridVSParameters->UndistortionMap = UndistortionMap;
+	GridVSParameters->UndistortionMapSampler = UndistortionMapSampler;
+
+	BenchmarkDraws = NumDraws;
+
+	for (const FIntPoint& Size : WarpGridBenchmarkSizes)
+	{
+		FRDGTextureRef Target = GraphBuilder.CreateTexture(FRDGTextureDesc::Create2D(Size, PF_B8G8R8A8, FClearValueBinding::Black, TexCreate_RenderTargetable | TexCreate_ShaderResource), TEXT("SteamVRPassthroughBenchmark"));
+
+		for (int32 PathIndex = 0; PathIndex < 2; PathIndex++)
+		{
+			const bool bWarpGrid = PathIndex > 0;
+
+			TShaderMapRef< FPassthroughFullsceenPS > PixelShader(GlobalShaderMap, FPassthroughFullsceenPS::GetPermutation(Settings, FrameLayout, ViewTransforms.CameraId, bUndistortFrames, bWarpGrid, CameraFilter, ColorLUT != nullptr, false));
+
+			FPassthroughFullsceenPS::FParameters* PSPassParameters = GraphBuilder.AllocParameters<FPassthroughFullsceenPS::FParameters>();
+			PSPassParameters->CameraTexture = CameraTextureSRV;
+			PSPassParameters->CameraTextureSampler = TStaticSamplerState<SF_Bilinear>::GetRHI();
+			PSPassParameters->UndistortionMap = UndistortionMap;
+			PSPassParameters->UndistortionMapSampler = UndistortionMapSampler;
+			PSPassParameters->CameraSharpening = GetCameraSharpening_RenderThread(CameraFilter);
+			PSPassParameters->bLinearOutput = false;
+			PSPassParameters->CameraColorScale = GetCameraColorScale(RenderSettings);
+			PSPassParameters->CameraColorLUT = ColorLUT ? ColorLUT : GBlackVolumeTexture->TextureRHI.GetReference();
+			PSPassParameters->CameraColorLUTSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+			PSPassParameters->View = View.ViewUniformBuffer;
+			PSPassParameters->PreprocessedFrame = GetPreprocessedFrameSRV_RenderThread(GraphBuilder);
+			PSPassParameters->RenderTargets[0] = FRenderTargetBinding(Target, ERenderTargetLoadAction::ENoAction);
+
+			FSteamVRPassthroughBenchmarkSample& Sample = BenchmarkSamples.AddDefaulted_GetRef();
+			Sample.Size = Size;
+			Sample.bWarpGrid = bWarpGrid;
+			Sample.StartQuery = RHICreateRenderQuery(RQT_AbsoluteTime);
+			Sample.EndQuery = RHICreateRenderQuery(RQT_AbsoluteTime);
+
+			// The target is never read, so the pass needs to be kept from being culled.
+			GraphBuilder.AddPass(
+				RDG_EVENT_NAME("SteamVRPassthroughBenchmark (%s %dx%d)", bWarpGrid ? TEXT("warp grid") : TEXT("per pixel"), Size.X, Size.Y),
+				PSPassParameters,
+				ERDGPassFlags::Raster | ERDGPassFlags::NeverCull,
+				[FullscreenVertexShader, GridVertexShader, PixelShader, FullscreenVSParameters, GridVSParameters, PSPassParameters, StartQuery = Sample.StartQuery, EndQuery = Sample.EndQuery, Size, GridSize, bWarpGrid, NumDraws](FRHICommandList& RHICmdList)
+			{
+				RHICmdList.SetViewport(0, 0, 0.0f, Size.X, Size.Y, 1.0f);
+
+				FGraphicsPipelineStateInitializer GraphicsPSOInit;
+				RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+				GraphicsPSOInit.BlendState = TStaticBlendState<>::GetRHI();
+				GraphicsPSOInit.RasterizerState = TStaticRasterizerState<>::GetRHI();
+				GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CF_Always>::GetRHI();
+				GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = bWarpGrid ? GEmptyVertexDeclaration.VertexDeclarationRHI : GFilterVertexDeclaration.VertexDeclarationRHI;
+				GraphicsPSOInit.BoundShaderState.VertexShaderRHI = bWarpGrid ? GridVertexShader.GetVertexShader() : FullscreenVertexShader.GetVertexShader();
+				GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader.GetPixelShader();
+				GraphicsPSOInit.PrimitiveType = PT_TriangleList;
+				SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit);
+
+				if (bWarpGrid)
+				{
+					SetShaderParameters(RHICmdList, GridVertexShader, GridVertexShader.GetVertexShader(), *GridVSParameters);
+				}
+				else
+				{
+					SetShaderParameters(RHICmdList, FullscreenVertexShader, FullscreenVertexShader.GetVertexShader(), *FullscreenVSParameters);
+				}
+
+				SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), *PSPassParameters);
+
+				RHICmdList.EndRenderQuery(StartQuery);
+
+				for (int32 Index = 0; Index < NumDraws; Index++)
+				{
+					if (bWarpGrid)
+					{
+						// Two triangles per grid cell
+						RHICmdList.DrawPrimitive(0, GridSize.X * GridSize.Y * 2, 1);
+					}
+					else
+					{
+						DrawRectangle(RHICmdList, 0, 0, Size.X, Size.Y, 0, 0, Size.X, Size.Y, Size, Size, FullscreenVertexShader);
+					}
+				}
+
+				RHICmdList.EndRenderQuery(EndQuery);
+			});
+		}
+	}
+
+	UE_LOG(LogSteamVRPassthrough, Log, TEXT("Running the warp grid benchmark, %i draws per measurement."), NumDraws);
+}
+
+
+void FSteamVRPassthroughRenderer::ReportWarpGridBenchmark_RenderThread()
+{
+	// Timestamps in microseconds, read without waiting so the results are polled over the next frames.
+	TArray<double> DrawTimesMs;
+
+	for (const FSteamVRPassthroughBenchmarkSample& Sample : BenchmarkSamples)
+	{
+		uint64 StartTime = 0;
+		uint64 EndTime = 0;
+
+		if (!RHIGetRenderQueryResult(Sample.StartQuery, StartTime, false) || !RHIGetRenderQueryResult(Sample.EndQuery, EndTime, false))
+		{
+			return;
+		}
+
+		DrawTimesMs.Add(EndTime > StartTime ? (EndTime - StartTime) / (1000.0 * BenchmarkDraws) : 0.0);
+	}
+
+	UE_LOG(LogSteamVRPassthrough, Display, TEXT("Warp grid benchmark, GPU time per draw with camera filter %i and a %dx%d grid:"),
+		(int32)GetCameraFilter_RenderThread(QualityGovernor.Tier), CVarWarpGridColumns.GetValueOnRenderThread(), CVarWarpGridRows.GetValueOnRenderThread());
+
+	// Each size has the per pixel sample followed by the warp grid one.
+	for (int32 Index = 0; Index + 1 < BenchmarkSamples.Num(); Index += 2)
+	{
+		const FIntPoint Size = BenchmarkSamples[Index].Size;
+		const double PerPixelMs = DrawTimesMs[Index];
+		const double WarpGridMs = DrawTimesMs[Index + 1];
+
+		UE_LOG(LogSteamVRPassthrough, Display, TEXT("  %dx%d: per pixel %.3f ms, warp grid %.3f ms (%.0f%% of per pixel)"),
+			Size.X, Size.Y, PerPixelMs, WarpGridMs, PerPixelMs > 0.0 ? 100.0 * WarpGridMs / PerPixelMs : 0.0);
+	}
+
+	BenchmarkSamples.Reset();
+}
+
+
+
+BEGIN_SHADER_PARAMETER_STRUCT(FPassthroughPostProcessMatParameters, )
+	SHADER_PARAMETER_STRUCT_REF(FViewUniformShaderParameters, View)
+	SHADER_PARAMETER_STRUCT_INCLUDE(FSceneTextureShaderParameters, SceneTextures)
+	SHADER_PARAMETER_STRUCT(FScreenPassTextureViewportParameters, PostProcessOutput)
+	SHADER_PARAMETER_STRUCT_ARRAY(FScreenPassTextureInput, PostProcessInput, [kPostProcessMaterialInputCountMax])
+	SHADER_PARAMETER_SAMPLER(SamplerState, PostProcessInput_BilinearSampler)
+	SHADER_PARAMETER_RDG_TEXTURE(Texture2D, MobileCustomStencilTexture)
+	SHADER_PARAMETER_SAMPLER(SamplerState, MobileCustomStencilTextureSampler)
+	SHADER_PARAMETER_RDG_TEXTURE(Texture2D, EyeAdaptationTexture)
+	SHADER_PARAMETER_SRV(Buffer<float4>, EyeAdaptationBuffer)
+	SHADER_PARAMETER(int32, MobileStencilValueRef)
+	SHADER_PARAMETER(uint32, bFlipYAxis)
+	SHADER_PARAMETER(uint32, bMetalMSAAHDRDecode)
+	RENDER_TARGET_BINDING_SLOTS()
+
+	SHADER_PARAMETER(FMatrix, FrameTransformMatrixFar)
+	SHADER_PARAMETER(FMatrix, FrameTransformMatrixNear)
+	SHADER_PARAMETER(FVector2D, FrameUVOffset)
+	SHADER_PARAMETER(FVector2D, FrameUVScale)
+	SHADER_PARAMETER(uint32, bUndistortFrame)
+	SHADER_PARAMETER_TEXTURE(Texture2D, UndistortionMap)
+	SHADER_PARAMETER_SAMPLER(SamplerState, UndistortionMapSampler)
+	// Only a dependency on the preprocess dispatch, the material samples the texture itself.
+	SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, PreprocessedFrame)
+END_SHADER_PARAMETER_STRUCT()
+
+
+/** Returns true if the passthrough material shaders are compiled for post process materials with the blendable location. */
+static bool IsPassthroughMaterialLocation(const int32 BlendableLocation)
+{
+	const int32 RequiredLocation = CVarMaterialShaderLocation.GetValueOnAnyThread();
+
+	return RequiredLocation < 0 || RequiredLocation == BlendableLocation;
+}
+
+
+// Material parameter sets the location filter compiled and skipped the passthrough shaders for, reported when a commandlet exits.
+// The engine only passes the material parameters, so materials with the same parameters on a platform share an entry.
+static TSet<uint32> PassthroughMaterialParametersCompiled;
+static TSet<uint32> PassthroughMaterialParametersSkipped;
+static FCriticalSection PassthroughMaterialShaderCountLock;
+
+
+void FSteamVRPassthroughRenderer::LogMaterialShaderCounts()
+{
+	FScopeLock Lock(&PassthroughMaterialShaderCountLock);
+
+	const int32 NumCompiled = PassthroughMaterialParametersCompiled.Num();
+	const int32 NumSkipped = PassthroughMaterialParametersSkipped.Num();
+
+	if (NumSkipped > 0)
+	{
+		UE_LOG(LogSteamVRPassthrough, Display, TEXT("Passthrough material shaders: compiled for %i and skipped for %i unique post process material parameter sets per platform, filtered by blendable location %i. Materials sharing parameters are counted once."),
+			NumCompiled, NumSkipped, CVarMaterialShaderLocation.GetValueOnAnyThread());
+	}
+	else if (NumCompiled > 0)
+	{
+		UE_LOG(LogSteamVRPassthrough, Display, TEXT("Passthrough material shaders: compiled for all %i unique post process material parameter sets per platform, vr.SteamVRPassthrough.MaterialShaderLocation limits them to passthrough materials."), NumCompiled);
+	}
+}
+
+
+class FPassthroughPostProcessShader : public FMaterialShader
+{
+public:
+	using FParameters = FPassthroughPostProcessMatParameters;
+	SHADER_USE_PARAMETER_STRUCT_WITH_LEGACY_BASE(FPassthroughPostProcessShader, FMaterialShader);
+
+	static bool ShouldCompilePermutation(const FMaterialShaderPermutationParameters& Parameters)
+	{
+		if (!IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5) || Parameters.MaterialParameters.MaterialDomain != MD_PostProcess)
+		{
+			return false;
+		}
+
+		const bool bShouldCompile = IsPassthroughMaterialLocation(Parameters.MaterialParameters.BlendableLocation);
+
+		// Counted for the cook, where the shader maps of every material in the project are built. The parameters are zero initialized, so they hash consistently.
+		if (IsRunningCommandlet())
+		{
+			const uint32 Key = HashCombine(FCrc::MemCrc32(&Parameters.MaterialParameters, sizeof(Parameters.MaterialParameters)), GetTypeHash((int32)Parameters.Platform));
+
+			FScopeLock Lock(&PassthroughMaterialShaderCountLock);
+			(bShouldCompile ? PassthroughMaterialParametersCompiled : PassthroughMaterialParametersSkipped).Add(Key);
+		}
+
+		return bShouldCompile;
+	}
+
+	static void ModifyCompilationEnvironment(const FMaterialShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FMaterialShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("POST_PROCESS_MATERIAL"), 1);
+		OutEnvironment.SetDefine(TEXT("POST_PROCESS_MATERIAL_BEFORE_TONEMAP"), 0);
+
+		// Compiled into the shaders along with the shader types the filter keeps in the shader map layout, which its key is built from.
+		OutEnvironment.SetDefine(TEXT("PASSTHROUGH_MATERIAL_SHADER_LOCATION"), CVarMaterialShaderLocation.GetValueOnAnyThread());
+		//OutEnvironment.SetDefine(TEXT("POST_PROCESS_AR_PASSTHROUGH"), 1);
+	}
+
+protected:
+	template <typename TRHIShader>
+	static void SetParameters(FRHICommandList& RHICmdList, const TShaderRef<FPassthroughPostProcessShader>& Shader, TRHIShader* ShaderRHI, const FViewInfo& View, const FMaterialRenderProxy* Proxy, const FParameters& Parameters)
+	{
+		FMaterialShader* MaterialShader = Shader.GetShader();
+		MaterialShader->SetParameters(RHICmdList, ShaderRHI, Proxy, *Proxy->GetMaterialNoFallback(View.GetFeatureLevel()), View);
+		SetShaderParameters(RHICmdList, Shader, ShaderRHI, Parameters);
+	}
+};
+
+
+class FPassthroughPostProcessMatVS : public FPassthroughPostProcessShader
+{
+public:
+	DECLARE_SHADER_TYPE(FPassthroughPostProcessMatVS, Material);
+
+	static void SetParameters(FRHICommandList& RHICmdList, const TShaderRef<FPassthroughPostProcessMatVS>& Shader, const FViewInfo& View, const FMaterialRenderProxy* Proxy, const FParameters& Parameters)
+	{
+		FPassthroughPostProcessShader::SetParameters(RHICmdList, Shader, Shader.GetVertexShader(), View, Proxy, Parameters);
+	}
+
+	FPassthroughPostProcessMatVS() = default;
+	FPassthroughPostProcessMatVS(const ShaderMetaType::CompiledShaderInitializerType & Initializer)
+		: FPassthroughPostProcessShader(Initializer)
+	{}
+};
+
+
+class FPassthroughPostProcessMatPS : public FPassthroughPostProcessShader
+{
+public:
+	DECLARE_SHADER_TYPE(FPassthroughPostProcessMatPS, Material);
+
+	static void SetParameters(FRHICommandList& RHICmdList, const TShaderRef<FPassthroughPostProcessMatPS>& Shader, const FViewInfo& View, const FMaterialRenderProxy* Proxy, const FParameters& Parameters)
+	{
+		FPassthroughPostProcessShader::SetParameters(RHICmdList, Shader, Shader.GetPixelShader(), View, Proxy, Parameters);
+	}
+
+	FPassthroughPostProcessMatPS() = default;
+	FPassthroughPostProcessMatPS(const ShaderMetaType::CompiledShaderInitializerType & Initializer)
+		: FPassthroughPostProcessShader(Initializer)
+	{}
+};
+
+
+IMPLEMENT_SHADER_TYPE(, FPassthroughPostProcessMatVS, TEXT("/Plugin/SteamVRPassthrough/Private/PassthroughPostProcess.usf"), TEXT("MainVS_Passthrough"), SF_Vertex);
+IMPLEMENT_SHADER_TYPE(, FPassthroughPostProcessMatPS, TEXT("/Plugin/SteamVRPassthrough/Private/PassthroughPostProcess.usf"), TEXT("MainPS_Passthrough"), SF_Pixel);
+
+
+
+// Copied from postprocessmaterial.cpp
+
+FRHIDepthStencilState* GetMaterialStencilState(const FMaterial* Material)
+{
+	static FRHIDepthStencilState* StencilStates[] =
+	{
+		TStaticDepthStencilState<false, CF_Always, true, CF_Less>::GetRHI(),
+		TStaticDepthStencilState<false, CF_Always, true, CF_LessEqual>::GetRHI(),
+		TStaticDepthStencilState<false, CF_Always, true, CF_Greater>::GetRHI(),
+		TStaticDepthStencilState<false, CF_Always, true, CF_GreaterEqual>::GetRHI(),
+		TStaticDepthStencilState<false, CF_Always, true, CF_Equal>::GetRHI(),
+		TStaticDepthStencilState<false, CF_Always, true, CF_NotEqual>::GetRHI(),
+		TStaticDepthStencilState<false, CF_Always, true, CF_Never>::GetRHI(),
+		TStaticDepthStencilState<false, CF_Always, true, CF_Always>::GetRHI(),
+	};
+	static_assert(EMaterialStencilCompare::MSC_Count == UE_ARRAY_COUNT(StencilStates), "Ensure that all EMaterialStencilCompare values are accounted for.");
+
+	return StencilStates[Material->GetStencilCompare()];
+}
+
+
+FRHIBlendState* GetMaterialBlendState(const FMaterial* Material)
+{
+	static FRHIBlendState* BlendStates[] =
+	{
+		TStaticBlendState<>::GetRHI(),
+		TStaticBlendState<>::GetRHI(),
+		TStaticBlendState<CW_RGB, BO_Add, BF_SourceAlpha, BF_InverseSourceAlpha, BO_Add, BF_Zero, BF_One>::GetRHI(),
+		TStaticBlendState<CW_RGB, BO_Add, BF_One, BF_One>::GetRHI(),
+		TStaticBlendState<CW_RGB, BO_Add, BF_DestColor, BF_Zero>::GetRHI(),
+		TStaticBlendState<CW_RGBA, BO_Add, BF_One, BF_InverseSourceAlpha, BO_Add, BF_One, BF_InverseSourceAlpha>::GetRHI(),
+		TStaticBlendState<CW_RGBA, BO_Add, BF_Zero, BF_InverseSourceAlpha, BO_Add, BF_Zero, BF_InverseSourceAlpha>::GetRHI(),
+	};
+	static_assert(EBlendMode::BLEND_MAX == UE_ARRAY_COUNT(BlendStates), "Ensure that all EBlendMode values are accounted for.");
+
+	return BlendStates[Material->GetBlendMode()];
+}
+
+
+
+FScreenPassTexture FSteamVRPassthroughRenderer::DrawPostProcessMatPassthrough_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& InView, const FPostProcessMaterialInputs& Inputs)
+{
+	FScopeLock Lock(&RenderLock);
+
+	// This gets passed as a FViewInfo from postprocessing
+	FViewInfo& View = (FViewInfo&)InView;
+
+	Inputs.Validate();
+
+	const FScreenPassTexture SceneColor = Inputs.GetInput(EPostProcessMaterialInput::SceneColor);
+
+	const FMaterialRenderProxy* MaterialProxy = PostProcessMaterial->GetRenderProxy();
+	check(MaterialProxy);
+
+	const FMaterial* const Material = MaterialProxy->GetMaterialNoFallback(InView.GetFeatureLevel());
+	
+
+	if (!IsValid(CameraTexture) || CameraTexture->Resource == nullptr || Material == nullptr)
+	{
+		return SceneColor;
+	}
+
+	const FMaterialShaderMap* MaterialShaderMap = Material->GetRenderingThreadShaderMap();
+
+	TShaderRef< FPassthroughPostProcessMatVS > VertexShader = MaterialShaderMap->GetShader<FPassthroughPostProcessMatVS>();
+	TShaderRef< FPassthroughPostProcessMatPS > PixelShader = MaterialShaderMap->GetShader<FPassthroughPostProcessMatPS>();
+
+	// Missing for materials filtered out with vr.SteamVRPassthrough.MaterialShaderLocation.
+	if (!VertexShader.IsValid() || !PixelShader.IsValid())
+	{
+		return SceneColor;
+	}
+
+	FScreenPassRenderTarget Output = Inputs.OverrideOutput;
+
+
+	FRHIDepthStencilState* DefaultDepthStencilState = FScreenPassPipelineState::FDefaultDepthStencilState::GetRHI();
+	FRHIDepthStencilState* DepthStencilState = DefaultDepthStencilState;
+
+	FRDGTextureRef DepthStencilTexture = nullptr;
+
+
+
+	if (Material->IsStencilTestEnabled())
+	{
+		check(Inputs.CustomDepthTexture);
+		DepthStencilTexture = Inputs.CustomDepthTexture;
+		DepthStencilState = GetMaterialStencilState(Material);
+	}
+
+	FRHIBlendState* DefaultBlendState = FScreenPassPipelineState::FDefaultBlendState::GetRHI();
+	FRHIBlendState* BlendState = DefaultBlendState;
+
+	if (Material->GetBlendableOutputAlpha())
+	{
+		BlendState = GetMaterialBlendState(Material);
+	}
+
+
+	const bool bCompositeWithInput = DepthStencilState != DefaultDepthStencilState || BlendState != DefaultBlendState;
+
+
+	if (!Output.IsValid() && !MaterialShaderMap->UsesSceneTexture(PPI_PostProcessInput0) && Inputs.bAllowSceneColorInputAsOutput)
+	{
+		Output = FScreenPassRenderTarget(SceneColor, ERenderTargetLoadAction::ELoad);
+	}
+	else if(!Output.IsValid())
+	{
+
+		ERenderTargetLoadAction Action = View.bHMDHiddenAreaMaskActive ? ERenderTargetLoadAction::EClear : ERenderTargetLoadAction::ENoAction;
+
+		Output = FScreenPassRenderTarget::CreateFromInput(GraphBuilder, SceneColor, Action, TEXT("Passthrough"));
+	}
+	else
+	{
+		AddDrawTexturePass(GraphBuilder, View, SceneColor, Output);
+		Output.LoadAction = ERenderTargetLoadAction::ELoad;
+	}
+
+
+	const FScreenPassTextureViewport OutputViewport(Output);
+
+	const uint32 MaterialStencilRef = Material->GetStencilRefValue();
+
+	PipelineColorFormat = Output.Texture->Desc.Format;
+	PipelineColorFlags = Output.Texture->Desc.Flags;
+	PipelineFormatsInjectionPoint = RenderSettings.InjectionPoint;
+
+	if (DepthStencilTexture)
+	{
+		PipelineDepthStencilFormat = DepthStencilTexture->Desc.Format;
+		PipelineDepthStencilFlags = DepthStencilTexture->Desc.Flags;
+	}
+
+	MaterialPipelineKeys.AddUnique(TrackPipelineUse_RenderThread(VertexShader.GetVertexShader(), PixelShader.GetPixelShader(), BlendState, DepthStencilState, DepthStencilTexture != nullptr));
+
+	FPassthroughPostProcessMatParameters* PassParameters = GraphBuilder.AllocParameters<FPassthroughPostProcessMatParameters>();
+
+	PassParameters->EyeAdaptationTexture = GetEyeAdaptationTexture(GraphBuilder, View);
+	PassParameters->SceneTextures = Inputs.SceneTextures;
+	PassParameters->View = View.ViewUniformBuffer;
+	PassParameters->PostProcessOutput = GetScreenPassTextureViewportParameters(OutputViewport);
+	PassParameters->RenderTargets[0] = Output.GetRenderTargetBinding();
+	PassParameters->PostProcessInput_BilinearSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+	PassParameters->bFlipYAxis = false;
+
+	if (DepthStencilTexture)
+	{
+		PassParameters->RenderTargets.DepthStencil = FDepthStencilBinding(
+			DepthStencilTexture,
+			ERenderTargetLoadAction::ELoad,
+			ERenderTargetLoadAction::ELoad,
+			FExclusiveDepthStencil::DepthRead_StencilRead);
+	}
+
+	const FScreenPassTexture BlackDummy(RegisterExternalOrPassthroughTexture(&GraphBuilder, GSystemTextures.BlackDummy));
+
+	GraphBuilder.RemoveUnusedTextureWarning(BlackDummy.Texture);
+
+	FRHISamplerState* PointClampSampler = TStaticSamplerState<SF_Point, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+
+	for (uint32 InputIndex = 0; InputIndex < kPostProcessMaterialInputCountMax; ++InputIndex)
+	{
+		FScreenPassTexture Input = Inputs.GetInput((EPostProcessMaterialInput)InputIndex);
+
+		if (!Input.Texture || !MaterialShaderMap->UsesSceneTexture(PPI_PostProcessInput0 + InputIndex))
+		{
+			Input = BlackDummy;
+		}
+
+		PassParameters->PostProcessInput[InputIndex] = GetScreenPassTextureInput(Input, PointClampSampler);
+	}
+
+	
+	const FSteamVRPassthroughViewTransforms& ViewTransforms = GetViewTransforms_RenderThread(View);
+
+	PassParameters->FrameTransformMatrixFar = ViewTransforms.FrameTransformFar;
+	PassParameters->FrameTransformMatrixNear = ViewTransforms.FrameTransformNear;
+
+	PassParameters->FrameUVOffset = GetFrameUVOffset(ViewTransforms.CameraId == 0 ? eSSP_LEFT_EYE : eSSP_RIGHT_EYE, FrameLayout);
+	PassParameters->FrameUVScale = GetFrameUVScale(FrameLayout);
+	PassParameters->bUndistortFrame = bUndistortFrames;
+	PassParameters->UndistortionMap = bUndistortFrames ? UndistortionMapRHI.GetReference() : GBlackTexture->TextureRHI.GetReference();
+	PassParameters->UndistortionMapSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+
+	ClearUnusedGraphResources(VertexShader, PixelShader, PassParameters);
+
+	// Set after clearing, since no shader binds it.
+	PassParameters->PreprocessedFrame = GetPreprocessedFrameSRV_RenderThread(GraphBuilder);
+
+	AddDrawScreenPass(
+		GraphBuilder,
+		RDG_EVENT_NAME("SteamVR Passthrough, material=%s", *Material->GetFriendlyName()),
+		View,
+		OutputViewport,
+		FScreenPassTextureViewport(SceneColor),
 		FScreenPassPipelineState(VertexShader, PixelShader, BlendState, DepthStencilState),
 		PassParameters,
 		EScreenPassDrawFlags::AllowHMDHiddenAreaMask,
 		[VertexShader, PixelShader, PassParameters, MaterialProxy, &InView, MaterialStencilRef](FRHICommandList& RHICmdList)
 	{
-		FViewInfo& View = (FViewInfo&)InView;
-		FPassthroughPostProcessMatVS::SetParameters(RHICmdList, VertexShader, View, MaterialProxy, *PassParameters);
-		FPassthroughPostProcessMatPS::SetParameters(RHICmdList, PixelShader, View, MaterialProxy, *PassParameters);
-		RHICmdList.SetStencilRef(MaterialStencilRef);
+		FViewInfo& View = (FViewInfo&)InView;
+		FPassthroughPostProcessMatVS::SetParameters(RHICmdList, VertexShader, View, MaterialProxy, *PassParameters);
+		FPassthroughPostProcessMatPS::SetParameters(RHICmdList, PixelShader, View, MaterialProxy, *PassParameters);
+		RHICmdList.SetStencilRef(MaterialStencilRef);
+	});
+
+
+	return MoveTemp(Output);
+}
+
+
+static const FMaterialShaderMap* GetPostProcessMaterialShaderMap_RenderThread(const UMaterialInterface* MaterialInterface, const FMaterial*& OutMaterial)
+{
+	OutMaterial = nullptr;
+
+	if (!IsValid(MaterialInterface) || MaterialInterface->GetRenderProxy() == nullptr)
+	{
+		return nullptr;
+	}
+
+	OutMaterial = MaterialInterface->GetRenderProxy()->GetMaterialNoFallback(GMaxRHIFeatureLevel);
+
+	return OutMaterial ? OutMaterial->GetRenderingThreadShaderMap() : nullptr;
+}
+
+
+uint32 FSteamVRPassthroughRenderer::GetPipelineKey(FRHIVertexShader* VertexShader, FRHIPixelShader* PixelShader, FRHIBlendState* BlendState, FRHIDepthStencilState* DepthStencilState, bool bDepthStencilTarget) const
+{
+	uint32 Key = HashCombine(PointerHash(VertexShader), PointerHash(PixelShader));
+	Key = HashCombine(Key, PointerHash(BlendState));
+	Key = HashCombine(Key, PointerHash(DepthStencilState));
+	Key = HashCombine(Key, GetTypeHash((int32)PipelineColorFormat));
+
+	return HashCombine(Key, GetTypeHash(bDepthStencilTarget ? (int32)PipelineDepthStencilFormat : (int32)PF_Unknown));
+}
+
+
+uint32 FSteamVRPassthroughRenderer::GetPipelineSettingsHash_RenderThread() const
+{
+	const FMaterial* Material = nullptr;
+	const FMaterialShaderMap* MaterialShaderMap = GetPostProcessMaterialShaderMap_RenderThread(PostProcessMaterial, Material);
+
+	// Everything that selects a shader permutation or a target format, except the states and tiers that are all precached.
+	uint32 Hash = GetTypeHash((int32)RenderSettings.InjectionPoint);
+	Hash = HashCombine(Hash, GetTypeHash((int32)FrameLayout));
+	Hash = HashCombine(Hash, GetTypeHash(bUndistortFrames));
+
+	for (int32 Tier = 0; Tier < QualityTier_MAX; Tier++)
+	{
+		const ESteamVRPassthroughQualityTier QualityTier = (ESteamVRPassthroughQualityTier)Tier;
+
+		Hash = HashCombine(Hash, GetTypeHash(GetCameraFilter_RenderThread(QualityTier) == EPassthroughCameraFilter::Bicubic));
+		Hash = HashCombine(Hash, GetTypeHash(IsWarpGridEnabled_RenderThread(QualityTier)));
+		Hash = HashCombine(Hash, GetTypeHash(GetNumDepthPlanes_RenderThread(QualityTier) > 1));
+	}
+
+	Hash = HashCombine(Hash, GetTypeHash(GetCameraColorLUT_RenderThread() != nullptr));
+	Hash = HashCombine(Hash, GetTypeHash(RenderSettings.Preprocess.bEnabled));
+	Hash = HashCombine(Hash, GetTypeHash(FPassthroughPreprocessCS::GetPermutation(RenderSettings.Preprocess, FrameLayout).ToDimensionValueId()));
+	Hash = HashCombine(Hash, PointerHash(MaterialShaderMap));
+	Hash = HashCombine(Hash, GetTypeHash((int32)PipelineColorFormat));
+
+	return HashCombine(Hash, GetTypeHash((int32)PipelineDepthStencilFormat));
+}
+
+
+void FSteamVRPassthroughRenderer::PrecachePipelines_RenderThread(FRHICommandListImmediate& RHICmdList)
+{
+	if (!CVarPrecachePipelines.GetValueOnRenderThread() || CameraHandle == INVALID_TRACKED_CAMERA_HANDLE)
+	{
+		return;
+	}
+
+	UpdatePipelineTargetFormats_RenderThread(RHICmdList);
+
+	const uint32 SettingsHash = GetPipelineSettingsHash_RenderThread();
+
+	if (SettingsHash == PrecachedSettingsHash)
+	{
+		return;
+	}
+
+	SCOPE_CYCLE_COUNTER(STAT_PipelinePrecache);
+
+	PrecachedSettingsHash = SettingsHash;
+
+	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
+
+	if (RenderSettings.Preprocess.bEnabled)
+	{
+		TShaderMapRef<FPassthroughPreprocessCS> ComputeShader(GlobalShaderMap, FPassthroughPreprocessCS::GetPermutation(RenderSettings.Preprocess, FrameLayout));
+		PipelineStateCache::GetAndOrCreateComputePipelineState(RHICmdList, ComputeShader.GetComputeShader());
+	}
+
+	// The simple mode is precached even when another mode is active, so switching to it doesn't hitch.
+	const bool bAfterUpscale = RenderSettings.InjectionPoint == Injection_AfterUpscale;
+	const bool bColorLUT = GetCameraColorLUT_RenderThread() != nullptr;
+	const uint32 NumCameras = FrameLayout == ESteamVRStereoFrameLayout::Mono ? 1 : 2;
+
+	FRHIBlendState* BlendStates[] =
+	{
+		TStaticBlendState<>::GetRHI(),
+		TStaticBlendState<CW_RGB, BO_Add, BF_DestAlpha, BF_InverseDestAlpha>::GetRHI()
+	};
+
+	TShaderMapRef< FPassthroughFullsceenVS > FullscreenVertexShader(GlobalShaderMap);
+	TShaderMapRef< FPassthroughClearPS > ClearPixelShader(GlobalShaderMap);
+
+	// The custom stencil is at the internal resolution, so it is never tested after the upscale.
+	const int32 NumStencilStates = bAfterUpscale ? 1 : 2;
+
+	for (int32 StencilIndex = 0; StencilIndex < NumStencilStates; StencilIndex++)
+	{
+		const bool bStencil = StencilIndex > 0;
+
+		FSteamVRPassthroughSettings Settings = RenderSettings;
+		Settings.StencilTestValue = bStencil ? 0 : -1;
+
+		FRHIDepthStencilState* DepthStencilState = bAfterUpscale ? TStaticDepthStencilState<false, CF_Always>::GetRHI() :
+			(bStencil ? TStaticDepthStencilState<false, CF_Always, true, CF_Equal>::GetRHI() : TStaticDepthStencilState<>::GetRHI());
+
+		// Tiers sharing a pipeline are skipped by its key.
+		for (int32 Tier = 0; Tier < QualityTier_MAX; Tier++)
+		{
+			const ESteamVRPassthroughQualityTier QualityTier = (ESteamVRPassthroughQualityTier)Tier;
+			const bool bUseWarpGrid = !bAfterUpscale && IsWarpGridEnabled_RenderThread(QualityTier);
+			const bool bDepthPlanes = !bAfterUpscale && !bUseWarpGrid && GetNumDepthPlanes_RenderThread(QualityTier) > 1;
+			const EPassthroughCameraFilter CameraFilter = GetCameraFilter_RenderThread(QualityTier);
+
+			for (uint32 CameraId = 0; CameraId < NumCameras; CameraId++)
+			{
+				TShaderMapRef< FPassthroughFullsceenPS > PixelShader(GlobalShaderMap, FPassthroughFullsceenPS::GetPermutation(Settings, FrameLayout, CameraId, bUndistortFrames, bUseWarpGrid, CameraFilter, bColorLUT, bDepthPlanes));
+
+				FRHIVertexDeclaration* VertexDeclaration = GFilterVertexDeclaration.VertexDeclarationRHI;
+				FRHIVertexShader* VertexShader = FullscreenVertexShader.GetVertexShader();
+
+				if (bUseWarpGrid)
+				{
+					TShaderMapRef< FPassthroughGridVS > GridVertexShader(GlobalShaderMap, FPassthroughGridVS::GetPermutation(FrameLayout, CameraId, bUndistortFrames));
+
+					VertexDeclaration = GEmptyVertexDeclaration.VertexDeclarationRHI;
+					VertexShader = GridVertexShader.GetVertexShader();
+				}
+
+				for (FRHIBlendState* BlendState : BlendStates)
+				{
+					PrecachePipeline_RenderThread(RHICmdList, VertexDeclaration, VertexShader, PixelShader.GetPixelShader(), BlendState, DepthStencilState, bStencil);
+				}
+			}
+		}
+
+		for (FRHIBlendState* BlendState : BlendStates)
+		{
+			PrecachePipeline_RenderThread(RHICmdList, GFilterVertexDeclaration.VertexDeclarationRHI, FullscreenVertexShader.GetVertexShader(), ClearPixelShader.GetPixelShader(), BlendState, DepthStencilState, bStencil);
+		}
+	}
+
+	// The material mode only uses the blend and stencil states of the material.
+	const FMaterial* Material = nullptr;
+	const FMaterialShaderMap* MaterialShaderMap = GetPostProcessMaterialShaderMap_RenderThread(PostProcessMaterial, Material);
+
+	// Shaders of a recompiled material can reuse the addresses of the old ones, so only its keys are dropped.
+	if (MaterialShaderMap != PrecachedMaterialShaderMap)
+	{
+		for (const uint32 Key : MaterialPipelineKeys)
+		{
+			PrecachedPipelines.Remove(Key);
+		}
+
+		MaterialPipelineKeys.Reset();
+		PrecachedMaterialShaderMap = MaterialShaderMap;
+	}
+
+	if (MaterialShaderMap)
+	{
+		TShaderRef< FPassthroughPostProcessMatVS > VertexShader = MaterialShaderMap->GetShader<FPassthroughPostProcessMatVS>();
+		TShaderRef< FPassthroughPostProcessMatPS > PixelShader = MaterialShaderMap->GetShader<FPassthroughPostProcessMatPS>();
+
+		if (VertexShader.IsValid() && PixelShader.IsValid())
+		{
+			const bool bStencil = Material->IsStencilTestEnabled();
+			FRHIBlendState* BlendState = Material->GetBlendableOutputAlpha() ? GetMaterialBlendState(Material) : FScreenPassPipelineState::FDefaultBlendState::GetRHI();
+			FRHIDepthStencilState* DepthStencilState = bStencil ? GetMaterialStencilState(Material) : FScreenPassPipelineState::FDefaultDepthStencilState::GetRHI();
+
+			PrecachePipeline_RenderThread(RHICmdList, GFilterVertexDeclaration.VertexDeclarationRHI, VertexShader.GetVertexShader(), PixelShader.GetPixelShader(), BlendState, DepthStencilState, bStencil);
+			MaterialPipelineKeys.AddUnique(GetPipelineKey(VertexShader.GetVertexShader(), PixelShader.GetPixelShader(), BlendState, DepthStencilState, bStencil));
+		}
+	}
+}
+
+
+void FSteamVRPassthroughRenderer::UpdatePipelineTargetFormats_RenderThread(FRHICommandListImmediate& RHICmdList)
+{
+	if (PipelineFormatsInjectionPoint == RenderSettings.InjectionPoint && PipelineColorFormat != PF_Unknown)
+	{
+		return;
+	}
+
+	PipelineFormatsInjectionPoint = RenderSettings.InjectionPoint;
+
+	// Before the tonemapper the passthrough draws into a copy of the scene color.
+	// The tonemapper and the HMD swap chain both output 8 bit color.
+	if (RenderSettings.InjectionPoint == Injection_BeforeTonemap)
+	{
+		PipelineColorFormat = FSceneRenderTargets::Get(RHICmdList).GetSceneColorFormat();
+	}
+	else
+	{
+		PipelineColorFormat = PF_B8G8R8A8;
+	}
+
+	PipelineColorFlags = TexCreate_RenderTargetable | TexCreate_ShaderResource;
+
+	// The stencil is tested against the custom depth buffer.
+	if (PipelineDepthStencilFormat == PF_Unknown)
+	{
+		PipelineDepthStencilFormat = PF_DepthStencil;
+		PipelineDepthStencilFlags = TexCreate_DepthStencilTargetable | TexCreate_ShaderResource;
+	}
+}
+
+
+void FSteamVRPassthroughRenderer::PrecachePipeline_RenderThread(FRHICommandListImmediate& RHICmdList, FRHIVertexDeclaration* VertexDeclaration, FRHIVertexShader* VertexShader, FRHIPixelShader* PixelShader, FRHIBlendState* BlendState, FRHIDepthStencilState* DepthStencilState, bool bDepthStencilTarget)
+{
+	if (VertexShader == nullptr || PixelShader == nullptr || PipelineColorFormat == PF_Unknown || (bDepthStencilTarget && PipelineDepthStencilFormat == PF_Unknown))
+	{
+		return;
+	}
+
+	const uint32 Key = GetPipelineKey(VertexShader, PixelShader, BlendState, DepthStencilState, bDepthStencilTarget);
+
+	if (PrecachedPipelines.Contains(Key))
+	{
+		return;
+	}
+
+	FGraphicsPipelineStateInitializer GraphicsPSOInit;
+	GraphicsPSOInit.RenderTargetsEnabled = 1;
+	GraphicsPSOInit.RenderTargetFormats[0] = PipelineColorFormat;
+	GraphicsPSOInit.RenderTargetFlags[0] = PipelineColorFlags;
+	GraphicsPSOInit.NumSamples = 1;
+
+	if (bDepthStencilTarget)
+	{
+		GraphicsPSOInit.DepthStencilTargetFormat = PipelineDepthStencilFormat;
+		GraphicsPSOInit.DepthStencilTargetFlag = PipelineDepthStencilFlags;
+		GraphicsPSOInit.DepthTargetLoadAction = ERenderTargetLoadAction::ELoad;
+		GraphicsPSOInit.StencilTargetLoadAction = ERenderTargetLoadAction::ELoad;
+		GraphicsPSOInit.DepthStencilAccess = FExclusiveDepthStencil::DepthRead_StencilRead;
+	}
+
+	GraphicsPSOInit.BlendState = BlendState;
+	GraphicsPSOInit.RasterizerState = TStaticRasterizerState<>::GetRHI();
+	GraphicsPSOInit.DepthStencilState = DepthStencilState;
+	GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = VertexDeclaration;
+	GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader;
+	GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader;
+	GraphicsPSOInit.PrimitiveType = PT_TriangleList;
+
+	PipelineStateCache::GetAndOrCreateGraphicsPipelineState(RHICmdList, GraphicsPSOInit, EApplyRendertargetOption::DoNothing);
+
+	PrecachedPipelines.Add(Key);
+}
+
+
+uint32 FSteamVRPassthroughRenderer::TrackPipelineUse_RenderThread(FRHIVertexShader* VertexShader, FRHIPixelShader* PixelShader, FRHIBlendState* BlendState, FRHIDepthStencilState* DepthStencilState, bool bDepthStencilTarget)
+{
+	const uint32 Key = GetPipelineKey(VertexShader, PixelShader, BlendState, DepthStencilState, bDepthStencilTarget);
+
+	bool bWasPrecached = false;
+	PrecachedPipelines.Add(Key, &bWasPrecached);
+
+	// The engine pipeline cache may still have it from an earlier draw, this only counts the pipelines the precache missed.
+	if (!bWasPrecached)
+	{
+		INC_DWORD_STAT(STAT_PipelinesNotPrecached);
+		UE_LOG(LogSteamVRPassthrough, Verbose, TEXT("Passthrough pipeline was not precached, it may be created at draw time."));
+	}
+
+	return Key;
+}
+
+
+
+
+
+
+void FSteamVRPassthroughRenderer::BeginRenderViewFamily(FSceneViewFamily& InViewFamily)
+{
+	UpdateStreamSuspension_GameThread();
+
+	// Always captured, since views not rendered from the HMD can only be projected with their own view matrices.
+	if (!GEngine || !GEngine->XRSystem.IsValid() || InViewFamily.Views.Num() == 0 || !vr::VRSystem())
+	{
+		FScopeLock Lock(&SettingsLock);
+		GameThreadSettings.bHasTrackingToWorld = false;
+		return;
+	}
+
+	const float WorldToMeters = InViewFamily.Views[0]->WorldToMetersScale;
+
+	// OpenVR is right handed Y-up in meters, the engine is left handed Z-up in world units.
+	const FMatrix OpenVRToEngine = FMatrix(
+		FPlane(0, WorldToMeters, 0, 0),
+		FPlane(0, 0, WorldToMeters, 0),
+		FPlane(-WorldToMeters, 0, 0, 0),
+		FPlane(0, 0, 0, 1));
+
+	FMatrix OpenVRToTracking = OpenVRToEngine;
+
+	// The camera poses are in the standing universe, while eye level tracking uses the seated one.
+	if (GEngine->XRSystem->GetTrackingOrigin() == EHMDTrackingOrigin::Eye)
+	{
+		FMatrix SeatedToStanding = ToFMatrix(vr::VRSystem()->GetSeatedZeroPoseToStandingAbsoluteTrackingPose());
+		OpenVRToTracking = SeatedToStanding.Inverse() * OpenVRToTracking;
+	}
+
+	FSteamVRPassthroughSettings Settings;
+	{
+		FScopeLock Lock(&SettingsLock);
+		GameThreadSettings.OpenVRToTracking = OpenVRToTracking;
+		GameThreadSettings.TrackingToWorld = OpenVRToTracking * GEngine->XRSystem->GetTrackingToWorldTransform().ToMatrixWithScale();
+		GameThreadSettings.bHasTrackingToWorld = true;
+		Settings = GameThreadSettings;
+	}
+
+	UpdateCompositorLayer_GameThread(Settings);
+}
+
+
+IStereoLayers* FSteamVRPassthroughRenderer::GetStereoLayers() const
+{
+	if (StereoLayersOverride)
+	{
+		return StereoLayersOverride;
+	}
+
+	if (GEngine && GEngine->StereoRenderingDevice.IsValid())
+	{
+		return GEngine->StereoRenderingDevice->GetStereoLayers();
+	}
+
+	return nullptr;
+}
+
+
+void FSteamVRPassthroughRenderer::SetStereoLayersOverride(IStereoLayers* InStereoLayers)
+{
+	check(IsInGameThread());
+
+	DestroyCompositorLayer_GameThread();
+	StereoLayersOverride = InStereoLayers;
+}
+
+
+void FSteamVRPassthroughRenderer::UpdateCompositorLayer_GameThread(const FSteamVRPassthroughSettings& Settings)
+{
+	check(IsInGameThread());
+
+	IStereoLayers* StereoLayers = GetStereoLayers();
+
+	if (CompositorLayerOwner != StereoLayers)
+	{
+		DestroyCompositorLayer_GameThread();
+	}
+
+	// The preprocessed texture is only written once frames arrive, but the layer is continuously updated.
+	UTexture* LayerTexture = (Settings.Preprocess.bEnabled && IsValid(PreprocessedCameraTexture)) ? PreprocessedCameraTexture : CameraTexture;
+
+	if (!StereoLayers || !bIsInitialized || !Settings.bStreamEnabled || Settings.PostProcessMode != Mode_CompositorLayer 
+		|| !IsValid(LayerTexture) || LayerTexture->Resource == nullptr)
+	{
+		DestroyCompositorLayer_GameThread();
+		return;
+	}
+
+	FMatrix LayerPose;
+	FVector2D LayerSize;
+	{
+		FScopeLock Lock(&SettingsLock);
+
+		if (!bHasCompositorLayerPose)
+		{
+			return;
+		}
+
+		LayerPose = CompositorLayerPose;
+		LayerSize = CompositorLayerSize;
+	}
+
+	// The conversion to engine tracking space includes the world scale, which the layer size already accounts for.
+	FTransform LayerTransform = FTransform(LayerPose * Settings.OpenVRToTracking);
+	LayerTransform.SetScale3D(FVector::OneVector);
+
+	const float WorldToMeters = Settings.OpenVRToTracking.GetScaleVector().X;
+
+	IStereoLayers::FLayerDesc LayerDesc;
+	LayerDesc.PositionType = IStereoLayers::TrackerLocked;
+	LayerDesc.Priority = -1;
+	LayerDesc.Transform = LayerTransform;
+	LayerDesc.QuadSize = LayerSize * WorldToMeters;
+	LayerDesc.Texture = LayerTexture->Resource->TextureRHI;
+	LayerDesc.Flags = IStereoLayers::LAYER_FLAG_TEX_CONTINUOUS_UPDATE;
+
+	// A quad can only show one camera, so stereo frames display the left one to both eyes.
+	const FVector2D UVOffset = GetFrameUVOffset(eSSP_LEFT_EYE, FrameLayout);
+	LayerDesc.UVRect = FBox2D(UVOffset, UVOffset + GetFrameUVScale(FrameLayout));
+
+	if (CompositorLayerId == IStereoLayers::FLayerDesc::INVALID_LAYER_ID)
+	{
+		CompositorLayerId = StereoLayers->CreateLayer(LayerDesc);
+		CompositorLayerOwner = StereoLayers;
+	}
+	else
+	{
+		StereoLayers->SetLayerDesc(CompositorLayerId, LayerDesc);
+	}
+}
+
+
+void FSteamVRPassthroughRenderer::DestroyCompositorLayer_GameThread()
+{
+	if (CompositorLayerId != IStereoLayers::FLayerDesc::INVALID_LAYER_ID && CompositorLayerOwner)
+	{
+		CompositorLayerOwner->DestroyLayer(CompositorLayerId);
+	}
+
+	CompositorLayerId = IStereoLayers::FLayerDesc::INVALID_LAYER_ID;
+	CompositorLayerOwner = nullptr;
+}
+
+
+void FSteamVRPassthroughRenderer::UpdateCompositorLayerPose_RenderThread()
+{
+	const float Distance = RenderSettings.ProjectionDistanceFar;
+	const FMatrix CameraProjectionInv = GetCameraProjectionInv(0, Distance * 0.5, Distance);
+
+	// Frame corners on the far plane, in camera space.
+	FVector4 Min = CameraProjectionInv.TransformFVector4(FVector4(-1, -1, 1, 1));
+	FVector4 Max = CameraProjectionInv.TransformFVector4(FVector4(1, 1, 1, 1));
+
+	if (FMath::IsNearlyZero(Min.W) || FMath::IsNearlyZero(Max.W))
+	{
+		return;
+	}
+
+	const FVector MinPos = FVector(Min) / Min.W;
+	const FVector MaxPos = FVector(Max) / Max.W;
+
+	// OpenVR cameras look down -Z, while the engine quads face down +X.
+	const FMatrix QuadToCamera = FMatrix(
+		FPlane(0, 0, -1, 0),
+		FPlane(1, 0, 0, 0),
+		FPlane(0, 1, 0, 0),
+		FPlane((MinPos + MaxPos) * 0.5f, 1));
+
+	FScopeLock Lock(&SettingsLock);
+	CompositorLayerPose = QuadToCamera * FrameCameraToTrackingPose;
+	CompositorLayerSize = FVector2D(FMath::Abs(MaxPos.X - MinPos.X), FMath::Abs(MaxPos.Y - MinPos.Y));
+	bHasCompositorLayerPose = true;
+}
+
+
+void FSteamVRPassthroughRenderer::PreRenderViewFamily_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneViewFamily& InViewFamily)
+{
+	FScopeLock Lock(&RenderLock);
+
+	// Each family renders with its own graph, so the graph texture of the previous one is no longer valid.
+	PreprocessedFrameRDG = nullptr;
+	PreprocessedFrameGraph = nullptr;
+
+	{
+		FScopeLock SettingsScopeLock(&SettingsLock);
+		RenderSettings = GameThreadSettings;
+	}
+
+	// Updated before the precache, so tier changes are warmed up before the draws this frame.
+	if (RenderSettings.bStreamEnabled && !RenderSettings.bStreamSuspended)
+	{
+		UpdateQualityGovernor_RenderThread(InViewFamily.FrameNumber);
+	}
+
+	// Warms up the pipelines before the stream is enabled, and before anything is drawn after a settings change.
+	PrecachePipelines_RenderThread(RHICmdList);
+
+	if (BenchmarkSamples.Num() > 0)
+	{
+		ReportWarpGridBenchmark_RenderThread();
+	}
+
+	// Material transform parameters are updated here for the views of this frame, and again after the pickup if a new frame arrives.
+	if (CameraHandle == INVALID_TRACKED_CAMERA_HANDLE || !bHasValidFrame || !RenderSettings.bStreamEnabled || RenderSettings.bStreamSuspended)
+	{
+		return;
+	}
+
+	UpdateViewTransforms_RenderThread(InViewFamily);
+	UpdateTransformParameters();
+}
+
+
+void FSteamVRPassthroughRenderer::PrePostProcessPass_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& View, const FPostProcessingInputs& Inputs)
+{
+	WaitForCameraFrame_RenderThread(View);
+
+	FScopeLock Lock(&RenderLock);
+
+	if (!RenderSettings.bStreamEnabled || RenderSettings.bStreamSuspended || View.Family == nullptr)
+	{
+		return;
+	}
+
+	// Called for every view, but the transforms are updated for the whole family at once.
+	if (View.Family == LastTransformUpdateFamily && View.Family->FrameNumber == LastFrameUpdateNumber)
+	{
+		return;
+	}
+
+	LastTransformUpdateFamily = View.Family;
+
+	// All families this frame, such as scene captures, need to display the same camera frame.
+	const bool bPickUpFrame = View.Family->FrameNumber != LastFrameUpdateNumber;
+	bool bNewFrame = false;
+
+	if (bPickUpFrame)
+	{
+		LastFrameUpdateNumber = View.Family->FrameNumber;
+
+		// Picking up the frame as late as possible lets frames that arrive during the base pass be displayed a frame earlier.
+		bNewFrame = UpdateFrame_RenderThread();
+		ViewTransformCache.Reset();
+
+		// The material and color LUT set this frame are only swapped in with the frame update.
+		PrecachePipelines_RenderThread(GraphBuilder.RHICmdList);
+
+		FramePredictor.AddPickup(FPlatformTime::Cycles64(), bNewFrame, CameraFrameHeader.nFrameSequence, CameraFrameHeader.ulFrameExposureTime);
+
+		if (bNewFrame && FramePredictor.NumFrames > 1)
+		{
+			SET_FLOAT_STAT(STAT_CameraFramePeriod, FPlatformTime::ToMilliseconds64(FramePredictor.PeriodCycles));
+			SET_FLOAT_STAT(STAT_FrameMissedBy, FPlatformTime::ToMilliseconds64(FramePredictor.LastMissedByCycles));
+		}
+	}
+
+	if (CameraHandle == INVALID_TRACKED_CAMERA_HANDLE || !bHasValidFrame)
+	{
+		return;
+	}
+
+	if (!RenderSettings.Preprocess.bEnabled)
+	{
+		bHasPreprocessedFrame = false;
+	}
+	else if (bNewFrame || !bHasPreprocessedFrame)
+	{
+		// Only runs when the camera delivers a new frame, which is usually much less often than the display refresh.
+		PreprocessedFrameRDG = AddPreprocessPass_RenderThread(GraphBuilder);
+		PreprocessedFrameGraph = PreprocessedFrameRDG ? &GraphBuilder : nullptr;
+	}
+
+	// The views have their final matrices at this point, including any late update.
+	UpdateViewTransforms_RenderThread(*View.Family);
+
+	if (!bPickUpFrame)
+	{
+		return;
+	}
+
+	// The graph only executes after this, so the base pass already samples the frame uploaded above.
+	// The material parameters set before the pickup are from the previous frame header, and are replaced to match it.
+	if (bNewFrame)
+	{
+		UpdateTransformParameters();
+	}
+
+	if (RenderSettings.PostProcessMode == Mode_CompositorLayer)
+	{
+		UpdateCompositorLayerPose_RenderThread();
+	}
+
+	if (PendingBenchmarkDraws > 0)
+	{
+		AddWarpGridBenchmarkPasses_RenderThread(GraphBuilder, View);
+	}
+
+	if (CameraFrameHeader.ulFrameExposureTime > 0)
+	{
+		const uint64 CurrentCycles = FPlatformTime::Cycles64();
+
+		// The exposure time is in host system ticks, which match the platform cycle counter.
+		if (CurrentCycles > CameraFrameHeader.ulFrameExposureTime)
+		{
+			SET_FLOAT_STAT(STAT_DisplayedFrameAge, FPlatformTime::ToMilliseconds64(CurrentCycles - CameraFrameHeader.ulFrameExposureTime));
+		}
+	}
+
+	UpdateLatencyEstimate_RenderThread();
+}
+
+
+void FSteamVRPassthroughRenderer::SubscribeToPostProcessingPass(EPostProcessingPass PassId, FAfterPassCallbackDelegateArray& InOutPassCallbacks, bool bIsPassEnabled)
+{
+	if (!bHasValidFrame || !RenderSettings.bStreamEnabled)
+	{
+		return;
+	}
+
+	// Drawing after the upscale is done in PostRenderView_RenderThread instead, and is not supported by materials.
+	const EPostProcessingPass InjectionPass = (RenderSettings.InjectionPoint == Injection_BeforeTonemap) ? EPostProcessingPass::MotionBlur : EPostProcessingPass::Tonemap;
+
+	switch (RenderSettings.PostProcessMode)
+	{
+	case Mode_Simple:
+
+		if (PassId == InjectionPass && RenderSettings.InjectionPoint != Injection_AfterUpscale)
+		{
+			InOutPassCallbacks.Add(FAfterPassCallbackDelegate::CreateRaw(this, &FSteamVRPassthroughRenderer::DrawFullscreenPassthrough_RenderThread));
+		}
+
+		break;
+
+	case Mode_PostProcessMaterial:
+
+
+		if (PassId == InjectionPass && IsValid(PostProcessMaterial))
+		{
+			InOutPassCallbacks.Add(FAfterPassCallbackDelegate::CreateRaw(this, &FSteamVRPassthroughRenderer::DrawPostProcessMatPassthrough_RenderThread));
+		}
+
+		break;
+	}	
+}
+
+
+
+
+
+FSteamVRPassthroughRenderer::FSteamVRPassthroughRenderer(const FAutoRegister& AutoRegister, ESteamVRTrackedCameraFrameType InFrameType, bool bInUseSharedCameraTexture)
+	: FSceneViewExtensionBase(AutoRegister),
+	FrameType((vr::EVRTrackedCameraFrameType) InFrameType)
+{
+	bHasValidFrame = false;
+	NextStreamUserHandle = 1;
+	MergedPostProcessMaterial = nullptr;
+	bMergedPreprocessEnabled = false;
+	bHasUserConflict = false;
+	ViewTransformCacheFrameNumber = 0;
+	LastTransformUpdateFamily = nullptr;
+	bUseViewMVP = false;
+	ViewMVPLeft = FMatrix::Identity;
+	ViewMVPRight = FMatrix::Identity;
+	LastFrameUpdateNumber = 0;
+	CameraHandle = INVALID_TRACKED_CAMERA_HANDLE;
+	CameraFrameHeader = {};
+	FramePredictor.Reset();
+	QualityGovernor.Reset();
+	LastGovernorFrameNumber = 0;
+	DisplayFrequency = 0.0f;
+	GameThreadQualityTier = QualityTier_Full;
+	VsyncToPhotonsSeconds = 0.0f;
+	FramePickupCycles = 0;
+	FrameUploadCycles = 0;
+	LatencySamplesSincePercentiles = 0;
+	LatencyStatsSequence = 0;
+	PendingBenchmarkDraws = 0;
+	BenchmarkDraws = 0;
+
+	TransformParameters = MakeUnique<TArray<FSteamVRPassthoughUVTransformParameter>>();
+	LeftCameraMatrixCache = MakeUnique<TMap<FVector2D, FMatrix>>();
+	RightCameraMatrixCache = MakeUnique<TMap<FVector2D, FMatrix>>();
+
+	bSharedCameraTextureRequested = bInUseSharedCameraTexture;
+
+#if PLATFORM_WINDOWS
+	bUseSharedCameraTexture = FHardwareInfo::GetHardwareInfo(NAME_RHI) == "D3D11" ? bInUseSharedCameraTexture : false;
+#else
+	bUseSharedCameraTexture = false;
+#endif //PLATFORM_WINDOWS
+
+	PostProcessMaterial = nullptr;
+	PostProcessMaterialTemp = nullptr;
+	CameraColorLUT = nullptr;
+	CameraColorLUTTemp = nullptr;
+	PreprocessedCameraTexture = nullptr;
+	bHasPreprocessedFrame = false;
+	PreprocessedFrameRDG = nullptr;
+	PreprocessedFrameGraph = nullptr;
+	StereoLayersOverride = nullptr;
+	CompositorLayerOwner = nullptr;
+	CompositorLayerId = IStereoLayers::FLayerDesc::INVALID_LAYER_ID;
+	CompositorLayerPose = FMatrix::Identity;
+	CompositorLayerSize = FVector2D::ZeroVector;
+	bHasCompositorLayerPose = false;
+	bIsInitialized = false;
+	bUsingBackgroundRuntime = false;
+	bHoldsRuntimeSession = false;
+	bUndistortFrames = false;
+	UndistortionMapSize = FIntPoint::ZeroValue;
+	CameraFocalLength[0] = CameraFocalLength[1] = FVector2D::ZeroVector;
+	CameraCenter[0] = CameraCenter[1] = FVector2D::ZeroVector;
+	bCalibrationFromCache = false;
+	bStreamSuspended = false;
+	bStreamReleasedWhileSuspended = false;
+	StreamSuspendTime = 0.0;
+	LastStreamConsumerTime = 0.0;
+	LastSuspensionCheckFrame = 0;
+	InitializeStartCycles = 0;
+	PrecachedSettingsHash = 0;
+	PrecachedMaterialShaderMap = nullptr;
+	PipelineFormatsInjectionPoint = Injection_AfterTonemap;
+	PipelineColorFormat = PF_Unknown;
+	PipelineColorFlags = TexCreate_None;
+	PipelineDepthStencilFormat = PF_Unknown;
+	PipelineDepthStencilFlags = TexCreate_None;
+}
+
+
+FSteamVRPassthroughRenderer::~FSteamVRPassthroughRenderer()
+{
+	if (bIsInitialized)
+	{
+		Shutdown();
+	}
+
+	FSteamVRRuntimeSession::OnSessionLost().Remove(SessionLostHandle);
+	FSteamVRRuntimeSession::OnSessionRestored().Remove(SessionRestoredHandle);
+
+	// The session is kept running for the next user, instead of restarting the runtime each time.
+	if (bHoldsRuntimeSession)
+	{
+		FSteamVRRuntimeSession::Release();
+	}
+}
+
+
+int32 FSteamVRPassthroughRenderer::GetPriority() const { return -11; }
+
+
+bool FSteamVRPassthroughRenderer::IsActiveThisFrame(FViewport* InViewport) const 
+{ 
+	// Needs to stay active without a valid frame, since the frames are picked up by the extension itself.
+	// Also stays active while the stream is disabled or released when suspended, to keep checking if it should be resumed.
+	return bIsInitialized && (CameraHandle != INVALID_TRACKED_CAMERA_HANDLE || bStreamReleasedWhileSuspended);
+}
+
+
+
+FORCEINLINE uint64 GetViewTransformKey(const FSceneView& View)
+{
+	const uint32 ViewKey = View.GetViewKey();
+
+	// Views without a view state, such as some scene captures, are only seen once per frame.
+	return ViewKey != 0 ? (uint64)ViewKey : ((uint64)1 << 32) | (uint64)PointerHash(&View);
+}
+
+
+void FSteamVRPassthroughRenderer::UpdateViewTransforms_RenderThread(const FSceneViewFamily& ViewFamily)
+{
+	SCOPE_CYCLE_COUNTER(STAT_PoseUpdate);
+
+	if (ViewTransformCacheFrameNumber != ViewFamily.FrameNumber)
+	{
+		ViewTransformCache.Reset();
+		ViewTransformCacheFrameNumber = ViewFamily.FrameNumber;
+	}
+
+	bUseViewMVP = false;
+
+	for (const FSceneView* View : ViewFamily.Views)
+	{
+		if (View != nullptr)
+		{
+			ViewTransformCache.Remove(GetViewTransformKey(*View));
+			GetViewTransforms_RenderThread(*View);
+		}
+	}
+}
+
+
+const FSteamVRPassthroughViewTransforms& FSteamVRPassthroughRenderer::GetViewTransforms_RenderThread(const FSceneView& View)
+{
+	const uint64 Key = GetViewTransformKey(View);
+
+	if (View.Family && ViewTransformCacheFrameNumber != View.Family->FrameNumber)
+	{
+		ViewTransformCache.Reset();
+		ViewTransformCacheFrameNumber = View.Family->FrameNumber;
+	}
+
+	if (const FSteamVRPassthroughViewTransforms* Cached = ViewTransformCache.Find(Key))
+	{
+		return *Cached;
+	}
+
+	FSteamVRPassthroughViewTransforms NewTransforms;
+
+	if (CameraHandle == INVALID_TRACKED_CAMERA_HANDLE || !bHasValidFrame || !GetViewMVP(View, NewTransforms.MVP, NewTransforms.CameraId))
+	{
+		return ViewTransformCache.Add(Key, NewTransforms);
+	}
+
+	// Views with the same projection, like duplicate viewports or a spectator mirroring an eye, share the result.
+	for (const TPair<uint64, FSteamVRPassthroughViewTransforms>& Entry : ViewTransformCache)
+	{
+		if (Entry.Value.CameraId == NewTransforms.CameraId && Entry.Value.MVP.Equals(NewTransforms.MVP, 0.0f))
+		{
+			return ViewTransformCache.Add(Key, CopyTemp(Entry.Value));
+		}
+	}
+
+	const float DistanceFar = RenderSettings.ProjectionDistanceFar;
+	const float DistanceNear = RenderSettings.ProjectionDistanceNear;
+
+	NewTransforms.FrameTransformFar = GetTrackedCameraUVTransform(NewTransforms.CameraId, NewTransforms.MVP, DistanceFar);
+
+	if (!GetCameraFootprint(NewTransforms.FrameTransformFar, GetFrameUVScale(FrameLayout), NewTransforms.CameraFootprint))
+	{
+		NewTransforms.CameraFootprint = FBox2D(FVector2D(0, 0), FVector2D(1, 1));
+	}
+
+	// Only the material mode reads the near transforms.
+	if (RenderSettings.PostProcessMode != Mode_PostProcessMaterial || FMath::IsNearlyEqual(DistanceFar, DistanceNear))
+	{
+		NewTransforms.FrameTransformNear = NewTransforms.FrameTransformFar;
+	}
+	else
+	{
+		NewTransforms.FrameTransformNear = GetTrackedCameraUVTransform(NewTransforms.CameraId, NewTransforms.MVP, DistanceNear);
+	}
+
+	const int32 NumPlanes = GetNumDepthPlanes_RenderThread(QualityGovernor.Tier);
+
+	// The scene depth is only available to the simple mode before the upscale.
+	if (NumPlanes > 1 && RenderSettings.PostProcessMode == Mode_Simple && RenderSettings.InjectionPoint != Injection_AfterUpscale 
+		&& !IsWarpGridEnabled_RenderThread(QualityGovernor.Tier) && DistanceNear > 0.0f && DistanceNear < DistanceFar)
+	{
+		NewTransforms.NumPlanes = NumPlanes;
+
+		// Even spacing in inverse depth keeps the parallax error between the planes constant.
+		for (int32 Index = 0; Index < NumPlanes; Index++)
+		{
+			const float Alpha = (float)Index / (float)(NumPlanes - 1);
+			const float Distance = 1.0f / FMath::Lerp(1.0f / DistanceNear, 1.0f / DistanceFar, Alpha);
+
+			NewTransforms.PlaneDistances[Index] = Distance;
+			NewTransforms.FrameTransformPlanes[Index] = (Index == NumPlanes - 1) ? NewTransforms.FrameTransformFar : GetTrackedCameraUVTransform(NewTransforms.CameraId, NewTransforms.MVP, Distance);
+		}
+
+		// The near plane shifts the image the furthest from the far one, so the footprint needs to cover both.
+		FBox2D NearFootprint;
+
+		if (!GetCameraFootprint(NewTransforms.FrameTransformPlanes[0], GetFrameUVScale(FrameLayout), NearFootprint))
+		{
+			NewTransforms.CameraFootprint = FBox2D(FVector2D(0, 0), FVector2D(1, 1));
+		}
+		else if (NearFootprint.bIsValid)
+		{
+			NewTransforms.CameraFootprint = NewTransforms.CameraFootprint.bIsValid ? NewTransforms.CameraFootprint + NearFootprint : NearFootprint;
+		}
+	}
+
+	return ViewTransformCache.Add(Key, NewTransforms);
+}
+
+
+bool FSteamVRPassthroughRenderer::GetViewMVP(const FSceneView& View, FMatrix& OutMVP, uint32& OutCameraId)
+{
+	const bool bIsStereo = FrameLayout != ESteamVRStereoFrameLayout::Mono;
+	const bool bIsHMDView = IStereoRendering::IsStereoEyeView(View);
+	const EStereoscopicPass Eye = (bIsHMDView && IStereoRendering::IsASecondaryView(View)) ? eSSP_RIGHT_EYE : eSSP_LEFT_EYE;
+
+	// Mono views, like spectator screens and scene captures, only need the left camera.
+	OutCameraId = (bIsStereo && Eye == eSSP_RIGHT_EYE) ? 1 : 0;
+
+	if (RenderSettings.bHasTrackingToWorld && (!bIsHMDView || CVarUseEngineViewMatrices.GetValueOnRenderThread()))
+	{
+		OutMVP = GetEngineViewMVP(View);
+
+		if (bIsHMDView && Eye == eSSP_LEFT_EYE)
+		{
+			ViewMVPLeft = OutMVP;
+			bUseViewMVP = true;
+		}
+		else if (bIsHMDView)
+		{
+			ViewMVPRight = OutMVP;
+			bUseViewMVP = true;
+		}
+
+		return true;
+	}
+
+	// Without the tracking to world mapping, other views can only approximate using the left eye.
+	OutMVP = GetHMDRawMVPMatrix(Eye);
+	return true;
+}
+
+
+
+TSharedRef<FSteamVRPassthroughRenderer, ESPMode::ThreadSafe> FSteamVRPassthroughRenderer::GetSharedRenderer(ESteamVRTrackedCameraFrameType InFrameType, bool bInUseSharedCameraTexture)
+{
+	check(IsInGameThread());
+
+	const uint32 Key = (uint32)InFrameType;
+
+	// One renderer per camera stream, so the texture path is the one the first user asked for.
+	if (TSharedPtr<FSteamVRPassthroughRenderer, ESPMode::ThreadSafe> Existing = SharedRenderers.FindRef(Key).Pin())
+	{
+		if (Existing->bSharedCameraTextureRequested != bInUseSharedCameraTexture)
+		{
+			UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Passthrough components using the same camera stream disagree on bEnableSharedCameraTexture, using the setting of the first one (%s)."),
+				Existing->bSharedCameraTextureRequested ? TEXT("true") : TEXT("false"));
+		}
+
+		return Existing.ToSharedRef();
+	}
+
+	// Drop the entries of renderers that have been released.
+	for (auto It = SharedRenderers.CreateIterator(); It; ++It)
+	{
+		if (!It.Value().IsValid())
+		{
+			It.RemoveCurrent();
+		}
+	}
+
+	TSharedRef<FSteamVRPassthroughRenderer, ESPMode::ThreadSafe> NewRenderer = FSceneViewExtensions::NewExtension<FSteamVRPassthroughRenderer>(InFrameType, bInUseSharedCameraTexture);
+	SharedRenderers.Add(Key, NewRenderer);
+
+	return NewRenderer;
+}
+
+
+uint32 FSteamVRPassthroughRenderer::AddStreamUser()
+{
+	check(IsInGameThread());
+
+	const uint32 UserHandle = NextStreamUserHandle++;
+	StreamUsers.Emplace(UserHandle, FSteamVRPassthroughUserSettings());
+
+	if (StreamUsers.Num() == 1)
+	{
+		SetStreamEnabled(true);
+	}
+
+	return UserHandle;
+}
+
+
+void FSteamVRPassthroughRenderer::RemoveStreamUser(uint32 UserHandle)
+{
+	check(IsInGameThread());
+
+	if (StreamUsers.RemoveAll([UserHandle](const TPair<uint32, FSteamVRPassthroughUserSettings>& User) { return User.Key == UserHandle; }) == 0)
+	{
+		return;
+	}
+
+	if (StreamUsers.Num() == 0)
+	{
+		SetStreamEnabled(false);
+	}
+
+	MergeUserSettings_GameThread();
+}
+
+
+void FSteamVRPassthroughRenderer::SetUserSettings(uint32 UserHandle, const FSteamVRPassthroughUserSettings& InSettings)
+{
+	check(IsInGameThread());
+
+	for (TPair<uint32, FSteamVRPassthroughUserSettings>& User : StreamUsers)
+	{
+		if (User.Key == UserHandle)
+		{
+			User.Value = InSettings;
+			MergeUserSettings_GameThread();
+
+			return;
+		}
+	}
+}
+
+
+void FSteamVRPassthroughRenderer::MergeUserSettings_GameThread()
+{
+	if (StreamUsers.Num() == 0)
+	{
+		SetPostProcessOverlayMode(Mode_Disabled);
+		SetPostProcessMaterial(nullptr);
+		SetCameraColorLUT(nullptr);
+		MergedPostProcessMaterial = nullptr;
+		bHasUserConflict = false;
+
+		return;
+	}
+
+	// Users with the post process passthrough disabled never override the ones drawing it.
+	const FSteamVRPassthroughUserSettings* Primary = &StreamUsers.Last().Value;
+	const FSteamVRPassthroughPreprocessSettings* Preprocess = nullptr;
+
+	for (int32 Index = StreamUsers.Num() - 1; Index >= 0; Index--)
+	{
+		if (StreamUsers[Index].Value.PostProcessMode != Mode_Disabled)
+		{
+			Primary = &StreamUsers[Index].Value;
+			break;
+		}
+	}
+
+	// Other users' materials may sample the preprocessed texture, so it stays enabled while any user needs it.
+	if (Primary->Preprocess.bEnabled)
+	{
+		Preprocess = &Primary->Preprocess;
+	}
+	else
+	{
+		for (const TPair<uint32, FSteamVRPassthroughUserSettings>& User : StreamUsers)
+		{
+			if (User.Value.Preprocess.bEnabled)
+			{
+				Preprocess = &User.Value.Preprocess;
+				break;
+			}
+		}
+	}
+
+	bool bConflict = false;
+
+	for (const TPair<uint32, FSteamVRPassthroughUserSettings>& User : StreamUsers)
+	{
+		if (User.Value.PostProcessMode != Mode_Disabled && (User.Value.PostProcessMode != Primary->PostProcessMode || User.Value.PostProcessMaterial != Primary->PostProcessMaterial))
+		{
+			bConflict = true;
+		}
+	}
+
+	if (bConflict && !bHasUserConflict)
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Passthrough components sharing a camera stream request different post process modes or materials. Only the most recently enabled one is drawn."));
+	}
+
+	bHasUserConflict = bConflict;
+
+	SetPostProcessOverlayMode(Primary->PostProcessMode);
+	SetPostProcessProjectionDistance(Primary->ProjectionDistanceFar, Primary->ProjectionDistanceNear);
+	SetDepthStencilTestValue(Primary->StencilTestValue);
+	SetSceneAlphaMask(Primary->bSceneAlphaMask);
+	SetClearColor(Primary->ClearColor);
+	SetInjectionPoint(Primary->InjectionPoint);
+	SetCameraColorAdjustment(Primary->CameraExposure, Primary->CameraWhiteBalance);
+	SetCameraColorLUT(Primary->CameraColorLUT);
+	SetPreprocessSettings(Preprocess ? *Preprocess : FSteamVRPassthroughPreprocessSettings());
+
+	// The material is given the camera texture again when preprocessing switches the texture it needs to sample.
+	const bool bPreprocessEnabled = Preprocess != nullptr;
+
+	if (Primary->PostProcessMaterial != MergedPostProcessMaterial || bPreprocessEnabled != bMergedPreprocessEnabled)
+	{
+		SetPostProcessMaterial(Primary->PostProcessMaterial);
+		MergedPostProcessMaterial = Primary->PostProcessMaterial;
+	}
+
+	bMergedPreprocessEnabled = bPreprocessEnabled;
+}
+
+
+bool FSteamVRPassthroughRenderer::Initialize()
+{
+	check(IsInGameThread());
+
+	UE_LOG(LogSteamVRPassthrough, Log, TEXT("Initializing SteamVR camera passthrough."));
+
+	if (bIsInitialized)
+	{
+		return true;
+	}
+
+	if (PendingInitPromises.Num() > 0)
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Attempted to initialize passthrough rendering while asynchronous initialization is in progress."));
+		return false;
+	}
+
+	return BeginInitialize_GameThread() && InitializeRuntime_AnyThread() && InitializeResources_GameThread();
+}
+
+
+TFuture<bool> FSteamVRPassthroughRenderer::InitializeAsync()
+{
+	check(IsInGameThread());
+
+	TSharedRef<TPromise<bool>, ESPMode::ThreadSafe> Promise = MakeShared<TPromise<bool>, ESPMode::ThreadSafe>();
+	TFuture<bool> Future = Promise->GetFuture();
+
+	if (bIsInitialized)
+	{
+		Promise->SetValue(true);
+		return Future;
+	}
+
+	PendingInitPromises.Add(Promise);
+
+	// Callers arriving while initialization is running wait for the same result.
+	if (PendingInitPromises.Num() > 1)
+	{
+		return Future;
+	}
+
+	UE_LOG(LogSteamVRPassthrough, Log, TEXT("Initializing SteamVR camera passthrough asynchronously."));
+
+	if (!BeginInitialize_GameThread())
+	{
+		CompleteAsyncInitialize_GameThread(false);
+		return Future;
+	}
+
+	TSharedRef<FSteamVRPassthroughRenderer, ESPMode::ThreadSafe> This = StaticCastSharedRef<FSteamVRPassthroughRenderer>(AsShared());
+
+	Async(EAsyncExecution::ThreadPool, [This]()
+	{
+		const bool bRuntimeInitialized = This->InitializeRuntime_AnyThread();
+
+		AsyncTask(ENamedThreads::GameThread, [This, bRuntimeInitialized]()
+		{
+			This->CompleteAsyncInitialize_GameThread(bRuntimeInitialized && This->InitializeResources_GameThread());
+		});
+	});
+
+	return Future;
+}
+
+
+void FSteamVRPassthroughRenderer::CompleteAsyncInitialize_GameThread(bool bSuccess)
+{
+	TArray<TSharedRef<TPromise<bool>, ESPMode::ThreadSafe>> Promises = MoveTemp(PendingInitPromises);
+	PendingInitPromises.Reset();
+
+	for (const TSharedRef<TPromise<bool>, ESPMode::ThreadSafe>& Promise : Promises)
+	{
+		Promise->SetValue(bSuccess);
+	}
+}
+
+
+bool FSteamVRPassthroughRenderer::BeginInitialize_GameThread()
+{
+	InitializeStartCycles = FPlatformTime::Cycles64();
+
+	if (!FSteamVRPassthroughModule::IsOpenVRLoaded())
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Attempted to enable passthrough rendering, but the OpenVR library is not loaded."));
+		return false;
+	}
+
+	if (!GEngine)
+	{
+		return false;
+	}
+
+	if (!GEngine->XRSystem.IsValid() || GEngine->XRSystem->GetSystemName() != TEXT("SteamVR"))
+	{
+		if (!FSteamVRRuntimeSession::IsRunning())
+		{
+			UE_LOG(LogSteamVRPassthrough, Log, TEXT("Separate XR runtime %s detected, starting background SteamVR instance."), GEngine->XRSystem.IsValid() ? *GEngine->XRSystem->GetSystemName().ToString() : TEXT("None"));
+		}
+
+		bUsingBackgroundRuntime = true;
+	}
+
+	return true;
+}
+
+
+bool FSteamVRPassthroughRenderer::InitializeRuntime_AnyThread()
+{
+	if (bUsingBackgroundRuntime && !bHoldsRuntimeSession)
+	{
+		if (!InitBackgroundRuntime() || !FSteamVRRuntimeSession::Acquire())
+		{
+			return false;
+		}
+
+		bHoldsRuntimeSession = true;
+	}
+
+	if (!vr::VRSystem() || !vr::VRTrackedCamera() || !vr::VRCompositor())
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Invalid SteamVR interface handle!"));
+
+		return false;
+	}
+
+	UpdateHMDDeviceID();
+
+
+	if (HMDDeviceId < 0)
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("HMD device ID not found!"));
+		return false;
+	}
+
+	DisplayFrequency = vr::VRSystem()->GetFloatTrackedDeviceProperty(HMDDeviceId, vr::Prop_DisplayFrequency_Float);
+	VsyncToPhotonsSeconds = vr::VRSystem()->GetFloatTrackedDeviceProperty(HMDDeviceId, vr::Prop_SecondsFromVsyncToPhotons_Float);
+
+	if (!UpdateStaticCameraParameters())
+	{
+		return false;
+	}
+
+	// Only builds the map data, undistortion is enabled by the render command creating the texture from it.
+	if (FrameType == vr::VRTrackedCameraFrameType_Distorted)
+	{
+		if (!BuildUndistortionMap())
+		{
+			UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Failed to build the camera undistortion map, distorted frames will be displayed as-is."));
+		}
+	}
+
+	return AcquireVideoStreamingService();
+}
+
+
+void FSteamVRPassthroughRenderer::CreateUndistortionMap_GameThread()
+{
+	check(IsInGameThread());
+
+	// The map is only enabled on the render thread once it exists, since it can replace one that is in use.
+	ENQUEUE_RENDER_COMMAND(CreateUndistortionMap)(
+		[this, MapData = MoveTemp(UndistortionMapData), MapSize = UndistortionMapSize](FRHICommandListImmediate& RHICmdList)
+	{
+		FRHIResourceCreateInfo CreateInfo;
+		UndistortionMapRHI = RHICreateTexture2D(MapSize.X, MapSize.Y, PF_G32R32F, 1, 1, TexCreate_ShaderResource, CreateInfo);
+
+		RHIUpdateTexture2D(UndistortionMapRHI, 0, FUpdateTextureRegion2D(0, 0, 0, 0, MapSize.X, MapSize.Y), MapSize.X * sizeof(FVector2D), (const uint8*)MapData.GetData());
+
+		FScopeLock Lock(&RenderLock);
+		bUndistortFrames = true;
+	});
+
+	UndistortionMapData.Reset();
+}
+
+
+bool FSteamVRPassthroughRenderer::InitializeResources_GameThread()
+{
+	check(IsInGameThread());
+
+	if (UndistortionMapData.Num() > 0)
+	{
+		CreateUndistortionMap_GameThread();
+	}
+
+	if (bUseSharedCameraTexture)
+	{
+		CameraTexture = USteamVRExternalTexture2D::Create(CameraTextureWidth, CameraTextureHeight);
+		CameraTexture->AddToRoot();
+	}
+	else
+	{
+		UpdateTextureRegion = TUniquePtr<FUpdateTextureRegion2D>(new FUpdateTextureRegion2D(0, 0, 0, 0, CameraTextureWidth, CameraTextureHeight));
+
+		FrameBuffer = TUniquePtr<uint8[]>(new uint8[CameraFrameBufferSize]());
+
+		UTexture2D* NewTexture = UTexture2D::CreateTransient(CameraTextureWidth, CameraTextureHeight, EPixelFormat::PF_R8G8B8A8);
+
+#if WITH_EDITORONLY_DATA
+		NewTexture->MipGenSettings = TextureMipGenSettings::TMGS_NoMipmaps;
+#endif
+		NewTexture->CompressionSettings = TextureCompressionSettings::TC_Default;
+		NewTexture->SRGB = 1;
+		NewTexture->Filter = TextureFilter::TF_Default;
+		NewTexture->AddressX = TA_Clamp;
+		NewTexture->AddressY = TA_Clamp;
+		NewTexture->AddToRoot();
+		NewTexture->UpdateResource();
+
+		CameraTexture = NewTexture;
+	}
+
+	if (GameThreadSettings.Preprocess.bEnabled)
+	{
+		CreatePreprocessedTexture_GameThread();
+	}
+
+	// Created before the stream is enabled, so neither the first passthrough frame nor a later quality tier change creates them at draw time.
+	ENQUEUE_RENDER_COMMAND(PrecachePassthroughPipelines)(
+		[this](FRHICommandListImmediate& RHICmdList)
+	{
+		FScopeLock Lock(&RenderLock);
+
+		{
+			FScopeLock SettingsScopeLock(&SettingsLock);
+			RenderSettings = GameThreadSettings;
+		}
+
+		PrecachePipelines_RenderThread(RHICmdList);
 	});
 
+	if (bHoldsRuntimeSession && !SessionLostHandle.IsValid())
+	{
+		SessionLostHandle = FSteamVRRuntimeSession::OnSessionLost().AddThreadSafeSP(this, &FSteamVRPassthroughRenderer::OnRuntimeSessionLost_GameThread);
+		SessionRestoredHandle = FSteamVRRuntimeSession::OnSessionRestored().AddThreadSafeSP(this, &FSteamVRPassthroughRenderer::OnRuntimeSessionRestored_GameThread);
+	}
+
+	bHasReceivedFrame = false;
+	bIsInitialized = true;
+
+	return true;
+}
+
+
+void FSteamVRPassthroughRenderer::Shutdown()
+{
+	if (!bIsInitialized)
+	{
+		return;
+	}
+
+	UE_LOG(LogSteamVRPassthrough, Log, TEXT("Shutting down SteamVR camera passthrough."));
+
+	if (IsInGameThread())
+	{
+		DestroyCompositorLayer_GameThread();
+		GameThreadQualityTier = QualityTier_Full;
+	}
+
+	FScopeLock Lock(&RenderLock);
+
+	{
+		FScopeLock SettingsScopeLock(&SettingsLock);
+		bHasCompositorLayerPose = false;
+		GameThreadSettings.bStreamSuspended = false;
+	}
+
+	bHasValidFrame = false;
+	bIsInitialized = false;
+	bStreamSuspended = false;
+	bStreamReleasedWhileSuspended = false;
+	QualityGovernor.Reset();
+	LatencyHistory.Reset();
+	FramePickupCycles = 0;
+	FrameUploadCycles = 0;
+	PublishLatencyStats(FSteamVRPassthroughLatencyStats());
+	PendingBenchmarkDraws = 0;
+	BenchmarkSamples.Reset();
+
+	if (CameraHandle != INVALID_TRACKED_CAMERA_HANDLE)
+	{
+		ReleaseVideoStreamingService();
+	}
+
+	if (IsValid(CameraTexture))
+	{
+		CameraTexture->RemoveFromRoot();
+	}
+
+	CameraTexture = nullptr;
+
+	if (IsValid(PreprocessedCameraTexture))
+	{
+		PreprocessedCameraTexture->RemoveFromRoot();
+	}
+
+	PreprocessedCameraTexture = nullptr;
+	bHasPreprocessedFrame = false;
+	PreprocessedFrameExtracted.SafeRelease();
+	PreprocessedFrameRDG = nullptr;
+	PreprocessedFrameGraph = nullptr;
+	CameraTextureGammaSRV.SafeRelease();
+	CameraTextureGammaSRVSource.SafeRelease();
+	CameraTextureLinearSRV.SafeRelease();
+	CameraTextureLinearSRVSource.SafeRelease();
+	UndistortionMapRHI.SafeRelease();
+	bUndistortFrames = false;
+	PostProcessMaterial = nullptr;
+	PostProcessMaterialTemp = nullptr;
+	MergedPostProcessMaterial = nullptr;
+
+	{
+		FScopeLock MaterialScopeLock(&MaterialUpdateLock);
+
+		if (IsValid(CameraColorLUTTemp) && CameraColorLUTTemp != CameraColorLUT)
+		{
+			CameraColorLUTTemp->RemoveFromRoot();
+		}
+
+		if (IsValid(CameraColorLUT))
+		{
+			CameraColorLUT->RemoveFromRoot();
+		}
+
+		CameraColorLUT = nullptr;
+		CameraColorLUTTemp = nullptr;
+	}
+
+	TransformParameters.Get()->Empty();
+}
+
+
+
+void FSteamVRPassthroughRenderer::SetPostProcessMaterial(UMaterialInstanceDynamic* Instance)
+{
+	check(IsInGameThread());
+
+	FScopeLock Lock(&MaterialUpdateLock);
+
+	PostProcessMaterialTemp = Instance;
+
+	if (IsValid(Instance))
+	{
+		PostProcessMaterialTemp->AddToRoot();
+
+		const UMaterial* BaseMaterial = Instance->GetMaterial();
+
+		if (BaseMaterial && !IsPassthroughMaterialLocation(BaseMaterial->BlendableLocation))
+		{
+			UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Passthrough material %s does not have blendable location %i set by vr.SteamVRPassthrough.MaterialShaderLocation, and can't be drawn."),
+				*BaseMaterial->GetName(), CVarMaterialShaderLocation.GetValueOnGameThread());
+		}
+
+		if (IsValid(CameraTexture))
+		{
+			Instance->SetTextureParameterValue("CameraTexture", GetCameraTexture());
+		}
+	}
+}
+
+
+void FSteamVRPassthroughRenderer::SetCameraColorLUT(UVolumeTexture* Texture)
+{
+	check(IsInGameThread());
+
+	FScopeLock Lock(&MaterialUpdateLock);
+
+	// Only unroot a pending texture the render thread never picked up.
+	if (CameraColorLUTTemp != Texture && CameraColorLUTTemp != CameraColorLUT && IsValid(CameraColorLUTTemp))
+	{
+		CameraColorLUTTemp->RemoveFromRoot();
+	}
+
+	CameraColorLUTTemp = Texture;
+
+	if (IsValid(Texture))
+	{
+		CameraColorLUTTemp->AddToRoot();
+	}
+}
+
+
+FRHITexture* FSteamVRPassthroughRenderer::GetCameraColorLUT_RenderThread() const
+{
+	if (!IsValid(CameraColorLUT) || CameraColorLUT->Resource == nullptr)
+	{
+		return nullptr;
+	}
+
+	return CameraColorLUT->Resource->TextureRHI.GetReference();
+}
+
+
+bool FSteamVRPassthroughRenderer::UpdateFrame_RenderThread()
+{
+	{
+		FScopeLock Lock(&MaterialUpdateLock);
+
+		if (PostProcessMaterial != PostProcessMaterialTemp)
+		{
+			if (PostProcessMaterial && IsValid(PostProcessMaterial))
+			{
+				PostProcessMaterial->RemoveFromRoot();
+			}
+
+			PostProcessMaterial = PostProcessMaterialTemp;
+		}
+
+		if (CameraColorLUT != CameraColorLUTTemp)
+		{
+			if (IsValid(CameraColorLUT))
+			{
+				CameraColorLUT->RemoveFromRoot();
+			}
+
+			CameraColorLUT = CameraColorLUTTemp;
+		}
+	}
+
+
+	if (CameraHandle == INVALID_TRACKED_CAMERA_HANDLE)
+	{
+		return false;
+	}
+
+	if (UpdateVideoStreamFrameHeader())
+	{
+		FramePickupCycles = FPlatformTime::Cycles64();
+
+		if (bUseSharedCameraTexture)
+		{
+			GetSharedCameraTexture_RenderThread();
+		}
+		else
+		{
+			UpdateVideoStreamFrameBuffer_RenderThread();
+		}
+
+		FrameUploadCycles = FPlatformTime::Cycles64();
+
+		if (bHasValidFrame && !bHasReceivedFrame)
+		{
+			bHasReceivedFrame = true;
+
+			UE_LOG(LogSteamVRPassthrough, Log, TEXT("First camera frame received %.1f ms after initialization started, calibration %s."), 
+				FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - InitializeStartCycles), bCalibrationFromCache ? TEXT("from cache") : TEXT("read from the runtime"));
+		}
+
+		return bHasValidFrame;
+	}
+
+	return false;
+}
+
+
+FRDGTextureRef FSteamVRPassthroughRenderer::AddPreprocessPass_RenderThread(FRDGBuilder& GraphBuilder)
+{
+	if (!IsValid(CameraTexture) || CameraTexture->Resource == nullptr || !IsValid(PreprocessedCameraTexture) || PreprocessedCameraTexture->Resource == nullptr)
+	{
+		return nullptr;
+	}
+
+	FRHITexture* InputRHI = CameraTexture->Resource->TextureRHI.GetReference();
+	FRHITexture* OutputRHI = PreprocessedCameraTexture->Resource->TextureRHI.GetReference();
+
+	if (InputRHI == nullptr || OutputRHI == nullptr)
+	{
+		return nullptr;
+	}
+
+	const FSteamVRPassthroughPreprocessSettings& Settings = RenderSettings.Preprocess;
+	const FIntPoint TextureSize = FIntPoint(CameraTextureWidth, CameraTextureHeight);
+
+	RDG_EVENT_SCOPE(GraphBuilder, "SteamVRPassthroughPreprocess");
+	RDG_GPU_STAT_SCOPE(GraphBuilder, SteamVRPassthrough_Preprocess);
+
+	FRDGTextureRef InputTexture = RegisterExternalTexture(GraphBuilder, InputRHI, TEXT("SteamVRPassthroughCameraFrame"));
+	FRDGTextureRef OutputTexture = RegisterExternalTexture(GraphBuilder, OutputRHI, TEXT("SteamVRPassthroughPreprocessedFrame"));
+
+	FPassthroughPreprocessCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FPassthroughPreprocessCS::FParameters>();
+	PassParameters->InputTexture = InputTexture;
+	PassParameters->OutputTexture = GraphBuilder.CreateUAV(OutputTexture);
+	PassParameters->TextureSize = TextureSize;
+	PassParameters->DenoiseStrength = FMath::Clamp(Settings.DenoiseStrength, 0.0f, 1.0f);
+	PassParameters->SharpenStrength = FMath::Max(Settings.SharpenStrength, 0.0f);
+	PassParameters->LensShadingCorrection = FMath::Max(Settings.LensShadingCorrection, 0.0f);
+	PassParameters->Saturation = FMath::Max(Settings.Saturation, 0.0f);
+
+	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
+	TShaderMapRef<FPassthroughPreprocessCS> ComputeShader(GlobalShaderMap, FPassthroughPreprocessCS::GetPermutation(Settings, FrameLayout));
+
+	// All the filters are fused into a single dispatch. The passthrough passes of this graph wait on it through the returned texture.
+	const ERDGPassFlags PassFlags = (GSupportsEfficientAsyncCompute && CVarPreprocessAsyncCompute.GetValueOnRenderThread()) ? ERDGPassFlags::AsyncCompute : ERDGPassFlags::Compute;
+
+	FComputeShaderUtils::AddPass(
+		GraphBuilder,
+		RDG_EVENT_NAME("Preprocess %dx%d", TextureSize.X, TextureSize.Y),
+		PassFlags,
+		ComputeShader,
+		PassParameters,
+		FComputeShaderUtils::GetGroupCount(TextureSize, FPassthroughPreprocessCS::ThreadGroupSize));
+
+	// Materials, the compositor layer and the draw after the upscale sample the texture outside the graph.
+	// Extracting it has the graph end on the graphics queue with the texture readable.
+	GraphBuilder.QueueTextureExtraction(OutputTexture, &PreprocessedFrameExtracted);
+
+	bHasPreprocessedFrame = true;
+
+	return OutputTexture;
+}
+
+
+FRDGTextureSRVRef FSteamVRPassthroughRenderer::GetPreprocessedFrameSRV_RenderThread(FRDGBuilder& GraphBuilder) const
+{
+	// Frames preprocessed in an earlier graph were already made readable when it finished.
+	if (PreprocessedFrameRDG == nullptr || PreprocessedFrameGraph != &GraphBuilder || GetDisplayedCameraTexture_RenderThread() != PreprocessedCameraTexture)
+	{
+		return nullptr;
+	}
+
+	return GraphBuilder.CreateSRV(FRDGTextureSRVDesc::Create(PreprocessedFrameRDG));
+}
+
+
+UTexture* FSteamVRPassthroughRenderer::GetDisplayedCameraTexture_RenderThread() const
+{
+	if (RenderSettings.Preprocess.bEnabled && bHasPreprocessedFrame && IsValid(PreprocessedCameraTexture))
+	{
+		return PreprocessedCameraTexture;
+	}
+
+	return CameraTexture;
+}
+
 
-	return MoveTemp(Output);
-}
+void FSteamVRPassthroughRenderer::SetPreprocessSettings(const FSteamVRPassthroughPreprocessSettings& InSettings)
+{
+	check(IsInGameThread());
 
+	{
+		FScopeLock Lock(&SettingsLock);
+		GameThreadSettings.Preprocess = InSettings;
+	}
+
+	if (InSettings.bEnabled && bIsInitialized)
+	{
+		CreatePreprocessedTexture_GameThread();
+	}
+}
 
 
+void FSteamVRPassthroughRenderer::CreatePreprocessedTexture_GameThread()
+{
+	if (IsValid(PreprocessedCameraTexture) || CameraTextureWidth == 0 || CameraTextureHeight == 0)
+	{
+		return;
+	}
 
+	PreprocessedCameraTexture = USteamVRPreprocessedTexture2D::Create(CameraTextureWidth, CameraTextureHeight);
+	PreprocessedCameraTexture->AddToRoot();
+}
 
 
-void FSteamVRPassthroughRenderer::PreRenderViewFamily_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneViewFamily& InViewFamily)
+UTexture* FSteamVRPassthroughRenderer::GetCameraTexture()
 {
-	FScopeLock Lock(&RenderLock);
+	FScopeLock Lock(&SettingsLock);
 
-	if (CameraHandle == INVALID_TRACKED_CAMERA_HANDLE || !bHasValidFrame)
+	if (GameThreadSettings.Preprocess.bEnabled && IsValid(PreprocessedCameraTexture))
 	{
-		return;
+		return PreprocessedCameraTexture;
 	}
 
-	UpdateFrameTransforms();
-	UpdateTransformParameters();
+	return CameraTexture;
 }
 
 
-void FSteamVRPassthroughRenderer::SubscribeToPostProcessingPass(EPostProcessingPass PassId, FAfterPassCallbackDelegateArray& InOutPassCallbacks, bool bIsPassEnabled)
+FShaderResourceViewRHIRef FSteamVRPassthroughRenderer::GetCameraTextureGammaSRV_RenderThread()
 {
-	if (!bHasValidFrame)
+	check(IsInRenderingThread());
+
+	UTexture* DisplayedTexture = GetDisplayedCameraTexture_RenderThread();
+
+	if (!IsValid(DisplayedTexture) || DisplayedTexture->Resource == nullptr)
 	{
-		return;
+		return nullptr;
 	}
 
-	switch (PostProcessMode)
+	if (DisplayedTexture == PreprocessedCameraTexture)
 	{
-	case Mode_Simple:
+		return ((FSteamVRPreprocessedTextureResource*)DisplayedTexture->Resource)->GetGammaSRV();
+	}
 
-		if (PassId == EPostProcessingPass::Tonemap)
-		{
-			InOutPassCallbacks.Add(FAfterPassCallbackDelegate::CreateRaw(this, &FSteamVRPassthroughRenderer::DrawFullscreenPassthrough_RenderThread));
-		}
+	if (bUseSharedCameraTexture)
+	{
+		return ((FSteamVRExternalTextureResource*)DisplayedTexture->Resource)->GetGammaSRV();
+	}
 
-		break;
+	FRHITexture* TextureRHI = DisplayedTexture->Resource->TextureRHI.GetReference();
 
-	case Mode_PostProcessMaterial:
+	if (TextureRHI == nullptr)
+	{
+		return nullptr;
+	}
 
+	// The texture is created with the sRGB flag, so the SRV can reinterpret it without the conversion.
+	if (!CameraTextureGammaSRV.IsValid() || CameraTextureGammaSRVSource.GetReference() != TextureRHI)
+	{
+		FRHITextureSRVCreateInfo CreateInfo;
+		CreateInfo.SRGBOverride = SRGBO_ForceDisable;
 
-		if (PassId == EPostProcessingPass::Tonemap && IsValid(PostProcessMaterial))
-		{
-			InOutPassCallbacks.Add(FAfterPassCallbackDelegate::CreateRaw(this, &FSteamVRPassthroughRenderer::DrawPostProcessMatPassthrough_RenderThread));
-		}
+		CameraTextureGammaSRV = RHICreateShaderResourceView(TextureRHI, CreateInfo);
+		CameraTextureGammaSRVSource = TextureRHI;
+	}
 
-		break;
-	}	
+	return CameraTextureGammaSRV;
 }
 
 
+FShaderResourceViewRHIRef FSteamVRPassthroughRenderer::GetCameraTextureLinearSRV_RenderThread()
+{
+	check(IsInRenderingThread());
 
+	UTexture* DisplayedTexture = GetDisplayedCameraTexture_RenderThread();
 
+	if (!IsValid(DisplayedTexture) || DisplayedTexture->Resource == nullptr)
+	{
+		return nullptr;
+	}
 
-FSteamVRPassthroughRenderer::FSteamVRPassthroughRenderer(const FAutoRegister& AutoRegister, ESteamVRTrackedCameraFrameType InFrameType, bool bInUseSharedCameraTexture)
-	: FSceneViewExtensionBase(AutoRegister),
-	FrameType((vr::EVRTrackedCameraFrameType) InFrameType)
-{
-	LeftFrameTransformFar = FMatrix::Identity;
-	RightFrameTransformFar = FMatrix::Identity;
-	LeftFrameTransformNear = FMatrix::Identity;
-	RightFrameTransformNear = FMatrix::Identity;
-	bHasValidFrame = false;
-	PostProcessMode = Mode_Disabled;
-	PostProcessProjectionDistanceFar = 5.0;
-	PostProcessProjectionDistanceNear = 1.0;
+	FRHITexture* TextureRHI = DisplayedTexture->Resource->TextureRHI.GetReference();
 
-	TransformParameters = MakeUnique<TArray<FSteamVRPassthoughUVTransformParameter>>();
-	LeftCameraMatrixCache = MakeUnique<TMap<FVector2D, FMatrix>>();
-	RightCameraMatrixCache = MakeUnique<TMap<FVector2D, FMatrix>>();
+	if (TextureRHI == nullptr)
+	{
+		return nullptr;
+	}
 
-#if PLATFORM_WINDOWS
-	bUseSharedCameraTexture = FHardwareInfo::GetHardwareInfo(NAME_RHI) == "D3D11" ? bInUseSharedCameraTexture : false;
-#else
-	bUseSharedCameraTexture = false;
-#endif //PLATFORM_WINDOWS
+	// The shared texture gets recreated when the compositor switches buffers, so the view is recreated with it.
+	if (!CameraTextureLinearSRV.IsValid() || CameraTextureLinearSRVSource.GetReference() != TextureRHI)
+	{
+		CameraTextureLinearSRV = RHICreateShaderResourceView(TextureRHI, FRHITextureSRVCreateInfo());
+		CameraTextureLinearSRVSource = TextureRHI;
+	}
 
-	PostProcessMaterial = nullptr;
-	PostProcessMaterialTemp = nullptr;
-	bIsInitialized = false;
-	bUsingBackgroundRuntime = false;
+	return CameraTextureLinearSRV;
 }
 
 
-FSteamVRPassthroughRenderer::~FSteamVRPassthroughRenderer()
+void FSteamVRPassthroughRenderer::UpdateHMDDeviceID()
 {
-	if (bIsInitialized)
+	HMDDeviceId = FSteamVRRuntimeSession::GetHMDDeviceIndex();
+}
+
+
+bool FSteamVRPassthroughRenderer::InitBackgroundRuntime()
+{
+	if (!CVarAllowBackgroundRuntime.GetValueOnAnyThread())
 	{
-		Shutdown();
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Background SteamVR runtime usage is disabled!"));
+
+		return false;
 	}
 
-	if (bUsingBackgroundRuntime)
+	if (!FSteamVRRuntimeSession::Connect())
 	{
-		ShutdownBackgroundRuntime();
+		return false;
 	}
+
+	UpdateHMDDeviceID();
+	return true;
 }
 
 
-int32 FSteamVRPassthroughRenderer::GetPriority() const { return -11; }
+void FSteamVRPassthroughRenderer::ShutdownBackgroundRuntime()
+{
+	FSteamVRRuntimeSession::Shutdown();
+}
 
 
-bool FSteamVRPassthroughRenderer::IsActiveThisFrame(FViewport* InViewport) const 
-{ 
-	return (CameraHandle != INVALID_TRACKED_CAMERA_HANDLE) && bHasValidFrame;
-}
+void FSteamVRPassthroughRenderer::OnRuntimeSessionLost_GameThread()
+{
+	FScopeLock Lock(&RenderLock);
 
+	// The stream needs to be released while the interfaces are still valid.
+	if (CameraHandle != INVALID_TRACKED_CAMERA_HANDLE)
+	{
+		ReleaseVideoStreamingService();
+	}
+}
 
 
-void FSteamVRPassthroughRenderer::UpdateFrameTransforms()
+void FSteamVRPassthroughRenderer::OnRuntimeSessionRestored_GameThread()
 {
-	SCOPE_CYCLE_COUNTER(STAT_PoseUpdate);
-
-	if (CameraHandle == INVALID_TRACKED_CAMERA_HANDLE || !bHasValidFrame)
+	if (!bIsInitialized)
 	{
 		return;
 	}
 
-	LeftFrameTransformFar = GetTrackedCameraUVTransform(eSSP_LEFT_EYE, PostProcessProjectionDistanceFar);
-	RightFrameTransformFar = GetTrackedCameraUVTransform(eSSP_RIGHT_EYE, PostProcessProjectionDistanceFar);
+	FScopeLock Lock(&RenderLock);
 
-	if (FMath::IsNearlyEqual(PostProcessProjectionDistanceFar, PostProcessProjectionDistanceNear))
+	// Acquired when the stream resumes instead.
+	if (bStreamReleasedWhileSuspended)
 	{
-		LeftFrameTransformNear = LeftFrameTransformFar;
-		RightFrameTransformNear = RightFrameTransformFar;
+		return;
 	}
-	else
+
+	UE_LOG(LogSteamVRPassthrough, Log, TEXT("Reacquiring the camera stream after SteamVR restarted."));
+
+	// The textures and calibration stay valid, so only the stream is acquired again.
+	UpdateHMDDeviceID();
+	CameraFrameHeader = {};
+	FramePredictor.Reset();
+	AcquireVideoStreamingService();
+}
+
+
+ESteamVRRuntimeStatus FSteamVRPassthroughRenderer::GetRuntimeStatus()
+{
+	if (GEngine && GEngine->XRSystem.IsValid() && GEngine->XRSystem->GetSystemName() == TEXT("SteamVR"))
 	{
-		LeftFrameTransformNear = GetTrackedCameraUVTransform(eSSP_LEFT_EYE, PostProcessProjectionDistanceNear);
-		RightFrameTransformNear = GetTrackedCameraUVTransform(eSSP_RIGHT_EYE, PostProcessProjectionDistanceNear);
+		return RuntimeStatus_AsXRSystem;
 	}
+	
+	return FSteamVRRuntimeSession::IsRunning() ? RuntimeStatus_InBackground : RuntimeStatus_NotRunning;
 }
 
 
+// Results of the latest camera queries, or -1 until one has completed.
+// The game thread getters return these instead of starting the runtime themselves.
+static TAtomic<int32> CachedHasCamera(-1);
+static TAtomic<int32> CachedFrameLayout(-1);
+static TAtomic<bool> bCameraQueryPending(false);
 
 
-bool FSteamVRPassthroughRenderer::Initialize()
+bool FSteamVRPassthroughRenderer::HasCamera()
 {
-	check(IsInGameThread());
-
-	UE_LOG(LogSteamVRPassthrough, Log, TEXT("Initializing SteamVR camera passthrough."));
-
-	if (bIsInitialized)
+	if (!FSteamVRPassthroughModule::IsOpenVRLoaded())
 	{
-		return true;
+		return false;
 	}
 
-	if (!FSteamVRPassthroughModule::IsOpenVRLoaded())
+	// Querying a running runtime is quick, while starting one in the background blocks for a long time.
+	if (!IsInGameThread() || GetRuntimeStatus() != RuntimeStatus_NotRunning)
 	{
-		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Attempted to enable passthrough rendering, but the OpenVR library is not loaded."));
-		return false;
+		return QueryHasCamera_AnyThread();
 	}
 
-	if (!GEngine)
+	QueryCameraAsync();
+
+	return CachedHasCamera > 0;
+}
+
+
+ESteamVRStereoFrameLayout FSteamVRPassthroughRenderer::GetFrameLayout()
+{
+	if (!IsInGameThread() || GetRuntimeStatus() != RuntimeStatus_NotRunning)
 	{
-		return false;
+		return QueryFrameLayout_AnyThread();
 	}
 
-	if (GEngine->XRSystem.IsValid() && GEngine->XRSystem->GetSystemName() == TEXT("SteamVR"))
+	QueryCameraAsync();
+
+	const int32 Layout = CachedFrameLayout;
+
+	return Layout < 0 ? ESteamVRStereoFrameLayout::Mono : (ESteamVRStereoFrameLayout)Layout;
+}
+
+
+void FSteamVRPassthroughRenderer::QueryCameraAsync()
+{
+	if (CachedHasCamera >= 0 || bCameraQueryPending.Exchange(true))
 	{
-		bIsSteamVRRuntimeInitialized = true;
+		return;
 	}
-	else if (!bIsSteamVRRuntimeInitialized)
+
+	Async(EAsyncExecution::ThreadPool, []()
+	{
+		if (QueryHasCamera_AnyThread())
+		{
+			QueryFrameLayout_AnyThread();
+		}
+
+		bCameraQueryPending = false;
+	});
+}
+
+
+bool FSteamVRPassthroughRenderer::QueryHasCamera_AnyThread()
+{
+	if (!FSteamVRPassthroughModule::IsOpenVRLoaded())
 	{
-		UE_LOG(LogSteamVRPassthrough, Log, TEXT("Separate XR runtime %s detected, starting background SteamVR instance."), *GEngine->XRSystem->GetSystemName().ToString());
+		return false;
+	}
+
+	ESteamVRRuntimeStatus Status = FSteamVRPassthroughRenderer::GetRuntimeStatus();
 
-		if (InitBackgroundRuntime())
+	if (Status == RuntimeStatus_NotRunning)
+	{
+		if (!GEngine || !GEngine->XRSystem.IsValid() || !CVarAllowBackgroundRuntime.GetValueOnAnyThread())
 		{
-			bUsingBackgroundRuntime = true;
+			return false;
 		}
-		else
+
+		if (!FSteamVRPassthroughRenderer::InitBackgroundRuntime())
 		{
 			return false;
 		}
 	}
-	else
+
+	if (HMDDeviceId < 0)
 	{
-		bUsingBackgroundRuntime = true;
+		UpdateHMDDeviceID();
 	}
 
+	bool bHasCamera = false;
 
-	if (!vr::VRSystem() || !vr::VRTrackedCamera() || !vr::VRCompositor())
-	{
-		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Invalid SteamVR interface handle!"));
+	vr::EVRTrackedCameraError Error = vr::VRTrackedCamera()->HasCamera(HMDDeviceId, &bHasCamera);
 
+	if (Error != vr::VRTrackedCameraError_None)
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Error [%i] checking camera on device Id %i"), (int)Error, HMDDeviceId);
 		return false;
 	}
 
-	UpdateHMDDeviceID();
+	CachedHasCamera = bHasCamera ? 1 : 0;
 
+	return bHasCamera;
+}
 
-	if (HMDDeviceId < 0)
+
+ESteamVRStereoFrameLayout FSteamVRPassthroughRenderer::QueryFrameLayout_AnyThread()
+{
+	ESteamVRRuntimeStatus Status = FSteamVRPassthroughRenderer::GetRuntimeStatus();
+
+	if (Status == RuntimeStatus_NotRunning && !FSteamVRPassthroughRenderer::InitBackgroundRuntime())
 	{
-		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("HMD device ID not found!"));
-		return false;
+		return ESteamVRStereoFrameLayout::Mono;
 	}
 
-	if (!UpdateStaticCameraParameters())
+	vr::TrackedPropertyError Error;
+
+	int32 Layout = (vr::EVRTrackedCameraFrameLayout) vr::VRSystem()->GetInt32TrackedDeviceProperty(HMDDeviceId, vr::Prop_CameraFrameLayout_Int32, &Error);
+
+	if (Error != vr::TrackedProp_Success)
 	{
-		return false;
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("GetTrackedCameraEyePoses error [%i]"), (int)Error);
+		return ESteamVRStereoFrameLayout::Mono;
 	}
 
-	if (bUseSharedCameraTexture)
+	ESteamVRStereoFrameLayout FrameLayout = ESteamVRStereoFrameLayout::Mono;
+
+	if ((Layout & vr::EVRTrackedCameraFrameLayout_Stereo) != 0)
 	{
-		CameraTexture = USteamVRExternalTexture2D::Create(CameraTextureWidth, CameraTextureHeight);
-		CameraTexture->AddToRoot();
+		if ((Layout & vr::EVRTrackedCameraFrameLayout_VerticalLayout) != 0)
+		{
+			FrameLayout = ESteamVRStereoFrameLayout::StereoVerticalLayout;
+		}
+		else
+		{
+			FrameLayout = ESteamVRStereoFrameLayout::StereoHorizontalLayout;
+		}
 	}
-	else
-	{
-		UpdateTextureRegion = TUniquePtr<FUpdateTextureRegion2D>(new FUpdateTextureRegion2D(0, 0, 0, 0, CameraTextureWidth, CameraTextureHeight));
 
-		FrameBuffer = TUniquePtr<uint8[]>(new uint8[CameraFrameBufferSize]());
+	CachedFrameLayout = (int32)FrameLayout;
 
-		UTexture2D* NewTexture = UTexture2D::CreateTransient(CameraTextureWidth, CameraTextureHeight, EPixelFormat::PF_R8G8B8A8);
+	return FrameLayout;
+}
 
-#if WITH_EDITORONLY_DATA
-		NewTexture->MipGenSettings = TextureMipGenSettings::TMGS_NoMipmaps;
-#endif
-		NewTexture->CompressionSettings = TextureCompressionSettings::TC_Default;
-		NewTexture->SRGB = 1;
-		NewTexture->Filter = TextureFilter::TF_Default;
-		NewTexture->AddressX = TA_Clamp;
-		NewTexture->AddressY = TA_Clamp;
-		NewTexture->AddToRoot();
-		NewTexture->UpdateResource();
 
-		CameraTexture = NewTexture;
-	}
-	
-	if (AcquireVideoStreamingService())
+bool FSteamVRPassthroughRenderer::AcquireVideoStreamingService()
+{
+	if (vr::VRTrackedCamera())
 	{
-		bIsInitialized = true;
+		vr::EVRTrackedCameraError Error = vr::VRTrackedCamera()->AcquireVideoStreamingService(HMDDeviceId, &CameraHandle);
+
+		if (Error != vr::VRTrackedCameraError_None)
+		{
+			UE_LOG(LogSteamVRPassthrough, Warning, TEXT("AcquireVideoStreamingService error [%i] on device Id %i"), (int)Error, HMDDeviceId);
+			return false;
+		}
+
+		return true;
 	}
 
-	return bIsInitialized;
+	return false;
+}
+
+
+void FSteamVRPassthroughRenderer::ReleaseVideoStreamingService()
+{
+	if (vr::VRTrackedCamera() && CameraHandle != INVALID_TRACKED_CAMERA_HANDLE)
+	{
+		vr::EVRTrackedCameraError Error = vr::VRTrackedCamera()->ReleaseVideoStreamingService(CameraHandle);
+
+		if (Error != vr::VRTrackedCameraError_None)
+		{
+			UE_LOG(LogSteamVRPassthrough, Warning, TEXT("ReleaseVideoStreamingService error [%i]"), (int)Error);
+		}
+	}
+	CameraHandle = INVALID_TRACKED_CAMERA_HANDLE;
+	bHasValidFrame = false;
+	FramePredictor.Reset();
+	UVTransformTables[0] = FSteamVRPassthroughUVTransformTable();
+	UVTransformTables[1] = FSteamVRPassthroughUVTransformTable();
 }
 
 
-void FSteamVRPassthroughRenderer::Shutdown()
+void FSteamVRPassthroughRenderer::UpdateStreamSuspension_GameThread()
 {
-	if (!bIsInitialized)
+	check(IsInGameThread());
+
+	// Called for every view family, but only checked once per frame.
+	if (LastSuspensionCheckFrame == GFrameCounter)
 	{
 		return;
 	}
 
-	UE_LOG(LogSteamVRPassthrough, Log, TEXT("Shutting down SteamVR camera passthrough."));
+	const double CurrentTime = FApp::GetCurrentTime();
+	const float SuspendDelay = CVarSuspendDelay.GetValueOnGameThread();
+	const float ReleaseDelay = CVarReleaseStreamDelay.GetValueOnGameThread();
 
-	FScopeLock Lock(&RenderLock);
+	// Restart the delay if the extension was inactive, so enabling the stream doesn't suspend it right away.
+	if (GFrameCounter - LastSuspensionCheckFrame > 1)
+	{
+		LastStreamConsumerTime = CurrentTime;
+	}
 
-	bHasValidFrame = false;
-	bIsInitialized = false;
+	LastSuspensionCheckFrame = GFrameCounter;
 
-	if (CameraHandle != INVALID_TRACKED_CAMERA_HANDLE)
 	{
-		ReleaseVideoStreamingService();
+		FScopeLock Lock(&SettingsLock);
+
+		if (SuspendDelay < 0.0f || (GameThreadSettings.bStreamEnabled && GameThreadSettings.PostProcessMode != Mode_Disabled))
+		{
+			LastStreamConsumerTime = CurrentTime;
+		}
+		else if (GameThreadSettings.bStreamEnabled)
+		{
+			// Materials keep sampling the last frame while suspended, so they are seen as soon as they are rendered again.
+			for (const UTexture* Texture : { CameraTexture, PreprocessedCameraTexture })
+			{
+				if (IsValid(Texture))
+				{
+					LastStreamConsumerTime = FMath::Max(LastStreamConsumerTime, Texture->GetLastRenderTimeForStreaming());
+				}
+			}
+		}
 	}
 
-	if (IsValid(CameraTexture))
+	if (!bStreamSuspended)
 	{
-		CameraTexture->RemoveFromRoot();
+		if (SuspendDelay >= 0.0f && CurrentTime - LastStreamConsumerTime > SuspendDelay)
+		{
+			SuspendStream_GameThread();
+		}
+	}
+	else if (LastStreamConsumerTime > StreamSuspendTime)
+	{
+		ResumeStream_GameThread();
 	}
+	else if (!bStreamReleasedWhileSuspended && ReleaseDelay >= 0.0f && CurrentTime - StreamSuspendTime > ReleaseDelay && CameraHandle != INVALID_TRACKED_CAMERA_HANDLE)
+	{
+		FScopeLock Lock(&RenderLock);
 
-	CameraTexture = nullptr;
-	PostProcessMaterial = nullptr;
-	PostProcessMaterialTemp = nullptr;
-	TransformParameters.Get()->Empty();
-}
+		UE_LOG(LogSteamVRPassthrough, Log, TEXT("Releasing the suspended camera stream."));
 
+		ReleaseVideoStreamingService();
+		bStreamReleasedWhileSuspended = true;
+	}
+}
 
 
-void FSteamVRPassthroughRenderer::SetPostProcessMaterial(UMaterialInstanceDynamic* Instance)
+void FSteamVRPassthroughRenderer::SuspendStream_GameThread()
 {
-	check(IsInGameThread());
-
-	FScopeLock Lock(&MaterialUpdateLock);
-
-	PostProcessMaterialTemp = Instance;
+	UE_LOG(LogSteamVRPassthrough, Verbose, TEXT("Suspending the camera stream, nothing has used the camera frames for %.1f seconds."), FApp::GetCurrentTime() - LastStreamConsumerTime);
 
-	if (IsValid(Instance))
-	{
-		PostProcessMaterialTemp->AddToRoot();
+	bStreamSuspended = true;
+	StreamSuspendTime = FApp::GetCurrentTime();
 
-		if (IsValid(CameraTexture))
-		{
-			Instance->SetTextureParameterValue("CameraTexture", CameraTexture);
-		}
-	}
+	FScopeLock Lock(&SettingsLock);
+	GameThreadSettings.bStreamSuspended = true;
 }
 
 
-void FSteamVRPassthroughRenderer::UpdateFrame_RenderThread()
+void FSteamVRPassthroughRenderer::ResumeStream_GameThread()
 {
+	UE_LOG(LogSteamVRPassthrough, Verbose, TEXT("Resuming the camera stream."));
+
 	{
-		FScopeLock Lock(&MaterialUpdateLock);
+		FScopeLock Lock(&RenderLock);
 
-		if (PostProcessMaterial != PostProcessMaterialTemp)
+		// The frame timing history is stale after the pickups were skipped.
+		FramePredictor.Reset();
+
+		if (bStreamReleasedWhileSuspended)
 		{
-			if (PostProcessMaterial && IsValid(PostProcessMaterial))
+			bStreamReleasedWhileSuspended = false;
+			CameraFrameHeader = {};
+
+			if (!AcquireVideoStreamingService())
 			{
-				PostProcessMaterial->RemoveFromRoot();
+				UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Failed to reacquire the camera stream when resuming."));
 			}
-
-			PostProcessMaterial = PostProcessMaterialTemp;
 		}
 	}
 
+	bStreamSuspended = false;
 
-	if (CameraHandle == INVALID_TRACKED_CAMERA_HANDLE)
+	FScopeLock Lock(&SettingsLock);
+	GameThreadSettings.bStreamSuspended = false;
+}
+
+
+void FSteamVRCameraFramePredictor::AddPickup(uint64 PickupCycles, bool bNewFrame, uint32 FrameSequence, uint64 ExposureCycles)
+{
+	const uint64 PreviousPickupCycles = LastPickupCycles;
+	LastPickupCycles = PickupCycles;
+
+	if (!bNewFrame || ExposureCycles == 0 || ExposureCycles > PickupCycles)
 	{
 		return;
 	}
 
-	if (UpdateVideoStreamFrameHeader())
+	const double Latency = (double)(PickupCycles - ExposureCycles);
+
+	if (NumFrames > 0 && FrameSequence > LastFrameSequence && ExposureCycles > LastExposureCycles)
 	{
-		
-		if (bUseSharedCameraTexture)
-		{
-			GetSharedCameraTexture_RenderThread();
-		}
-		else
+		const uint32 SequenceDelta = FrameSequence - LastFrameSequence;
+		const double Period = (double)(ExposureCycles - LastExposureCycles) / SequenceDelta;
+
+		// Large gaps are from the stream stalling, and say little about the period.
+		if (SequenceDelta <= 4)
 		{
-			UpdateVideoStreamFrameBuffer_RenderThread();
+			PeriodCycles = (PeriodCycles > 0.0) ? FMath::Lerp(PeriodCycles, Period, 0.1) : Period;
 		}
-	}		
-}
 
+		// The lowest delay seen is closest to the real arrival, but is let drift up slowly in case the timing changes.
+		ArrivalLatencyCycles = FMath::Min(Latency, ArrivalLatencyCycles + PeriodCycles * 0.01);
+	}
+	else
+	{
+		ArrivalLatencyCycles = Latency;
+	}
 
-UTexture* FSteamVRPassthroughRenderer::GetCameraTexture()
-{
-	return CameraTexture;
+	const double EstimatedArrival = (double)ExposureCycles + ArrivalLatencyCycles;
+	LastMissedByCycles = (PreviousPickupCycles > 0 && EstimatedArrival > PreviousPickupCycles) ? EstimatedArrival - PreviousPickupCycles : 0.0;
+
+	LastFrameSequence = FrameSequence;
+	LastExposureCycles = ExposureCycles;
+	NumFrames++;
 }
 
 
-void FSteamVRPassthroughRenderer::UpdateHMDDeviceID()
+uint64 FSteamVRCameraFramePredictor::PredictNextArrival() const
 {
-	for (int i = 0; i < vr::k_unMaxTrackedDeviceCount; i++)
+	if (NumFrames < 8 || PeriodCycles <= 0.0)
 	{
-		if (vr::VRSystem()->GetTrackedDeviceClass(i) == vr::TrackedDeviceClass_HMD)
-		{
-			HMDDeviceId = i;
-			return;
-		}
+		return 0;
 	}
+
+	return LastExposureCycles + (uint64)(PeriodCycles + ArrivalLatencyCycles);
 }
 
 
-bool FSteamVRPassthroughRenderer::InitBackgroundRuntime()
+void FSteamVRPassthroughQualityGovernor::Update(double FrameBudgetRatio, double CurrentTime, float DowngradeRatio, float UpgradeRatio)
 {
-	if (!CVarAllowBackgroundRuntime.GetValueOnAnyThread())
+	BudgetRatio = (BudgetRatio > 0.0) ? FMath::Lerp(BudgetRatio, FrameBudgetRatio, 0.1) : FrameBudgetRatio;
+
+	if (UpgradeDelay <= 0.0)
 	{
-		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Background SteamVR runtime usage is disabled!"));
+		UpgradeDelay = QUALITY_UPGRADE_DELAY;
+	}
 
-		return false;
+	if (BudgetRatio > DowngradeRatio && Tier < QualityTier_MAX - 1)
+	{
+		UnderBudgetStartTime = 0.0;
+
+		if (OverBudgetStartTime <= 0.0)
+		{
+			OverBudgetStartTime = CurrentTime;
+		}
+		else if (CurrentTime - OverBudgetStartTime >= QUALITY_DOWNGRADE_DELAY)
+		{
+			if (LastUpgradeTime > 0.0 && CurrentTime - LastUpgradeTime < UpgradeDelay)
+			{
+				UpgradeDelay = FMath::Min(UpgradeDelay * 2.0, QUALITY_MAX_UPGRADE_DELAY);
+			}
+
+			Tier = (ESteamVRPassthroughQualityTier)(Tier + 1);
+			OverBudgetStartTime = 0.0;
+		}
 	}
+	else if (BudgetRatio < UpgradeRatio && Tier > QualityTier_Full)
+	{
+		OverBudgetStartTime = 0.0;
 
-	if (bIsSteamVRRuntimeInitialized)
+		if (UnderBudgetStartTime <= 0.0)
+		{
+			UnderBudgetStartTime = CurrentTime;
+		}
+		else if (CurrentTime - UnderBudgetStartTime >= UpgradeDelay)
+		{
+			Tier = (ESteamVRPassthroughQualityTier)(Tier - 1);
+			UnderBudgetStartTime = 0.0;
+			LastUpgradeTime = CurrentTime;
+		}
+	}
+	else
 	{
-		return true;
+		OverBudgetStartTime = 0.0;
+		UnderBudgetStartTime = 0.0;
 	}
+}
 
-	vr::EVRInitError Error;
-	vr::VR_Init(&Error, vr::EVRApplicationType::VRApplication_Background);
 
-	if (Error != vr::EVRInitError::VRInitError_None)
+void FSteamVRPassthroughRenderer::UpdateQualityGovernor_RenderThread(uint32 FrameNumber)
+{
+	if (FrameNumber == LastGovernorFrameNumber)
 	{
-		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Failed to init SteamVR runtime as background app, error [%i]"), (int)Error, HMDDeviceId);
-		return false;
+		return;
 	}
 
-	if (!vr::VRSystem() || !vr::VRTrackedCamera() || !vr::VRCompositor())
+	LastGovernorFrameNumber = FrameNumber;
+
+	const ESteamVRPassthroughQualityTier PreviousTier = QualityGovernor.Tier;
+
+	if (!CVarQualityGovernor.GetValueOnRenderThread())
 	{
-		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Invalid SteamVR interface handle!"));
+		QualityGovernor.Reset();
+	}
+	else
+	{
+		// Both are measured from the previous frame. The passthrough cost shows up in either depending on the upload path and mode.
+		const double GPUFrameMs = FPlatformTime::ToMilliseconds(RHIGetGPUFrameCycles());
+		const double RenderThreadMs = FPlatformTime::ToMilliseconds(GRenderThreadTime);
+		const double BudgetMs = 1000.0 / (DisplayFrequency > 0.0f ? DisplayFrequency : DEFAULT_DISPLAY_FREQUENCY);
 
-		return false;
+		QualityGovernor.Update(FMath::Max(GPUFrameMs, RenderThreadMs) / BudgetMs, FPlatformTime::Seconds(),
+			CVarQualityDowngradeRatio.GetValueOnRenderThread(), CVarQualityUpgradeRatio.GetValueOnRenderThread());
+
+		SET_FLOAT_STAT(STAT_FrameBudgetRatio, QualityGovernor.BudgetRatio);
 	}
 
-	UpdateHMDDeviceID();
+	SET_DWORD_STAT(STAT_QualityTier, (uint32)QualityGovernor.Tier);
 
-	if (HMDDeviceId < 0)
+	if (QualityGovernor.Tier == PreviousTier)
 	{
-		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("HMD device ID not found!"));
-		return false;
+		return;
 	}
 
-	bIsSteamVRRuntimeInitialized = true;
-	return true;
+	INC_DWORD_STAT(STAT_QualityTierChanges);
+
+	const ESteamVRPassthroughQualityTier NewTier = QualityGovernor.Tier;
+	const float BudgetRatio = QualityGovernor.BudgetRatio;
+
+	UE_LOG(LogSteamVRPassthrough, Log, TEXT("Passthrough quality tier changed from %i to %i, frame time at %.0f%% of the budget."), (int32)PreviousTier, (int32)NewTier, BudgetRatio * 100.0f);
+
+	TWeakPtr<FSteamVRPassthroughRenderer, ESPMode::ThreadSafe> WeakThis = StaticCastSharedRef<FSteamVRPassthroughRenderer>(AsShared());
+
+	AsyncTask(ENamedThreads::GameThread, [WeakThis, NewTier, BudgetRatio]()
+	{
+		TSharedPtr<FSteamVRPassthroughRenderer, ESPMode::ThreadSafe> This = WeakThis.Pin();
+
+		if (This.IsValid())
+		{
+			This->GameThreadQualityTier = NewTier;
+			This->QualityTierChangedDelegate.Broadcast(NewTier, BudgetRatio);
+		}
+	});
 }
 
 
-void FSteamVRPassthroughRenderer::ShutdownBackgroundRuntime()
+void FSteamVRPassthroughLatencyHistory::AddSample(float LatencyMs)
 {
-	if (GetRuntimeStatus() != RuntimeStatus_InBackground)
+	if (Samples.Num() < LATENCY_HISTORY_SIZE)
 	{
-		return;
+		Samples.Add(LatencyMs);
 	}
-
-	// Calling VR_Shutdown while the OpenXR runtime is active will hang the game,
-	// so add a delegate to do it on shutdown.
-	if (GEngine && GEngine->XRSystem.IsValid())
+	else
 	{
-		if (!bDeferredRuntimeShutdown)
-		{
-			bDeferredRuntimeShutdown = true;
-			FCoreDelegates::OnExit.AddLambda([]()
-			{
-				FSteamVRPassthroughRenderer::ShutdownBackgroundRuntime();
-			});
-		}
-		return;
+		Samples[NextSample] = LatencyMs;
 	}
 
-	vr::VR_Shutdown();
-	bIsSteamVRRuntimeInitialized = false;
-	bDeferredRuntimeShutdown = false;
+	NextSample = (NextSample + 1) % LATENCY_HISTORY_SIZE;
+	bSortedSamplesValid = false;
 }
 
 
-ESteamVRRuntimeStatus FSteamVRPassthroughRenderer::GetRuntimeStatus()
+float FSteamVRPassthroughLatencyHistory::GetPercentile(float Percentile) const
 {
-	if (GEngine && GEngine->XRSystem.IsValid() && GEngine->XRSystem->GetSystemName() == TEXT("SteamVR"))
+	if (Samples.Num() == 0)
 	{
-		return RuntimeStatus_AsXRSystem;
+		return 0.0f;
 	}
-	
-	return bIsSteamVRRuntimeInitialized ? RuntimeStatus_InBackground : RuntimeStatus_NotRunning;
+
+	if (!bSortedSamplesValid)
+	{
+		SortedSamples = Samples;
+		SortedSamples.Sort();
+		bSortedSamplesValid = true;
+	}
+
+	const int32 Index = FMath::CeilToInt(Percentile / 100.0f * SortedSamples.Num()) - 1;
+
+	return SortedSamples[FMath::Clamp(Index, 0, SortedSamples.Num() - 1)];
 }
 
 
-bool FSteamVRPassthroughRenderer::HasCamera()
+void FSteamVRPassthroughRenderer::UpdateLatencyEstimate_RenderThread()
 {
-	if (!FSteamVRPassthroughModule::IsOpenVRLoaded())
+	const uint64 ExposureCycles = CameraFrameHeader.ulFrameExposureTime;
+
+	// The exposure time is in host system ticks, which match the platform cycle counter. Frames without one can't be placed on the timeline.
+	if (ExposureCycles == 0 || FramePickupCycles < ExposureCycles || FrameUploadCycles < FramePickupCycles || !vr::VRCompositor())
 	{
-		return false;
+		return;
 	}
 
-	ESteamVRRuntimeStatus Status = FSteamVRPassthroughRenderer::GetRuntimeStatus();
+	// Predicted the same way as the background runtime poses: the rest of the current compositor frame, the frame being rendered, and the display latency.
+	const double FrameDuration = 1.0 / (DisplayFrequency > 0.0f ? DisplayFrequency : DEFAULT_DISPLAY_FREQUENCY);
+	const double PhotonSecondsFromNow = FMath::Max(vr::VRCompositor()->GetFrameTimeRemaining(), 0.0f) + FrameDuration + VsyncToPhotonsSeconds;
+	const uint64 PhotonCycles = FPlatformTime::Cycles64() + (uint64)(PhotonSecondsFromNow / FPlatformTime::GetSecondsPerCycle64());
 
-	if (Status == RuntimeStatus_NotRunning)
-	{
-		if (!GEngine || !GEngine->XRSystem.IsValid() || !CVarAllowBackgroundRuntime.GetValueOnAnyThread())
-		{
-			return false;
-		}
+	// The render thread is the only writer, so the published stats can be read here directly.
+	FSteamVRPassthroughLatencyStats Stats = PublishedLatencyStats;
 
-		if (!FSteamVRPassthroughRenderer::InitBackgroundRuntime())
-		{
-			return false;
-		}
-	}
+	Stats.LatencyMs = (float)FPlatformTime::ToMilliseconds64(PhotonCycles - ExposureCycles);
+	Stats.ExposureToPickupMs = (float)FPlatformTime::ToMilliseconds64(FramePickupCycles - ExposureCycles);
+	Stats.PickupToUploadMs = (float)FPlatformTime::ToMilliseconds64(FrameUploadCycles - FramePickupCycles);
+	Stats.UploadToPhotonMs = (PhotonCycles > FrameUploadCycles) ? (float)FPlatformTime::ToMilliseconds64(PhotonCycles - FrameUploadCycles) : 0.0f;
 
-	if (HMDDeviceId < 0)
+	LatencyHistory.AddSample(Stats.LatencyMs);
+
+	// The percentiles move slowly, so the history is only sorted every few frames.
+	if (Stats.NumSamples == 0 || ++LatencySamplesSincePercentiles >= LATENCY_PERCENTILE_INTERVAL)
 	{
-		UpdateHMDDeviceID();
+		LatencySamplesSincePercentiles = 0;
+
+		Stats.LatencyP50Ms = LatencyHistory.GetPercentile(50.0f);
+		Stats.LatencyP95Ms = LatencyHistory.GetPercentile(95.0f);
+		Stats.LatencyP99Ms = LatencyHistory.GetPercentile(99.0f);
+		Stats.NumSamples = LatencyHistory.Samples.Num();
+
+		SET_FLOAT_STAT(STAT_CameraLatencyP50, Stats.LatencyP50Ms);
+		SET_FLOAT_STAT(STAT_CameraLatencyP95, Stats.LatencyP95Ms);
+		SET_FLOAT_STAT(STAT_CameraLatencyP99, Stats.LatencyP99Ms);
 	}
 
-	bool bHasCamera = false;
+	SET_FLOAT_STAT(STAT_CameraLatency, Stats.LatencyMs);
 
-	vr::EVRTrackedCameraError Error = vr::VRTrackedCamera()->HasCamera(HMDDeviceId, &bHasCamera);
+	// Per frame values, the CSV tools calculate their own percentiles from these.
+	CSV_CUSTOM_STAT(SteamVRPassthrough, CameraLatencyMs, Stats.LatencyMs, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(SteamVRPassthrough, ExposureToPickupMs, Stats.ExposureToPickupMs, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(SteamVRPassthrough, PickupToUploadMs, Stats.PickupToUploadMs, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(SteamVRPassthrough, UploadToPhotonMs, Stats.UploadToPhotonMs, ECsvCustomStatOp::Set);
 
-	if (Error != vr::VRTrackedCameraError_None)
-	{
-		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Error [%i] checking camera on device Id %i"), (int)Error, HMDDeviceId);
-		return false;
-	}
+	PublishLatencyStats(Stats);
+}
 
-	return bHasCamera;
+
+void FSteamVRPassthroughRenderer::PublishLatencyStats(const FSteamVRPassthroughLatencyStats& Stats)
+{
+	LatencyStatsSequence++;
+	FPlatformMisc::MemoryBarrier();
+
+	PublishedLatencyStats = Stats;
+
+	FPlatformMisc::MemoryBarrier();
+	LatencyStatsSequence++;
 }
 
 
-ESteamVRStereoFrameLayout FSteamVRPassthroughRenderer::GetFrameLayout()
+FSteamVRPassthroughLatencyStats FSteamVRPassthroughRenderer::GetLatencyStats() const
 {
-	ESteamVRRuntimeStatus Status = FSteamVRPassthroughRenderer::GetRuntimeStatus();
+	FSteamVRPassthroughLatencyStats Stats;
+	uint32 StartSequence;
+	uint32 EndSequence;
 
-	if (Status == RuntimeStatus_NotRunning && !FSteamVRPassthroughRenderer::InitBackgroundRuntime())
+	// Retries if the render thread was writing the stats while they were copied.
+	do
 	{
-		return ESteamVRStereoFrameLayout::Mono;
+		StartSequence = LatencyStatsSequence;
+		FPlatformMisc::MemoryBarrier();
+
+		Stats = PublishedLatencyStats;
+
+		FPlatformMisc::MemoryBarrier();
+		EndSequence = LatencyStatsSequence;
 	}
+	while ((StartSequence & 1) != 0 || StartSequence != EndSequence);
 
-	vr::TrackedPropertyError Error;
+	return Stats;
+}
 
-	int32 Layout = (vr::EVRTrackedCameraFrameLayout) vr::VRSystem()->GetInt32TrackedDeviceProperty(HMDDeviceId, vr::Prop_CameraFrameLayout_Int32, &Error);
 
-	if (Error != vr::TrackedProp_Success)
-	{
-		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("GetTrackedCameraEyePoses error [%i]"), (int)Error);
-		return ESteamVRStereoFrameLayout::Mono;
-	}
+void FSteamVRPassthroughRenderer::WaitForCameraFrame_RenderThread(const FSceneView& View)
+{
+	const float MaxWaitMs = CVarMaxFrameWait.GetValueOnRenderThread();
 
-	if ((Layout & vr::EVRTrackedCameraFrameLayout_Stereo) != 0)
-	{
-		if ((Layout & vr::EVRTrackedCameraFrameLayout_VerticalLayout) != 0)
-		{
-			return ESteamVRStereoFrameLayout::StereoVerticalLayout;
-		}
-		else
-		{
-			return ESteamVRStereoFrameLayout::StereoHorizontalLayout;
-		}
-	}
-	else
+	if (MaxWaitMs <= 0.0f || View.Family == nullptr)
 	{
-		return ESteamVRStereoFrameLayout::Mono;
+		return;
 	}
-}
 
+	uint64 NextArrival = 0;
 
-bool FSteamVRPassthroughRenderer::AcquireVideoStreamingService()
-{
-	if (vr::VRTrackedCamera())
+	// Only held for the prediction, the game thread can take the lock while this waits. The pickup checks the state again.
 	{
-		vr::EVRTrackedCameraError Error = vr::VRTrackedCamera()->AcquireVideoStreamingService(HMDDeviceId, &CameraHandle);
+		FScopeLock Lock(&RenderLock);
 
-		if (Error != vr::VRTrackedCameraError_None)
+		if (!RenderSettings.bStreamEnabled || RenderSettings.bStreamSuspended || CameraHandle == INVALID_TRACKED_CAMERA_HANDLE || View.Family->FrameNumber == LastFrameUpdateNumber)
 		{
-			UE_LOG(LogSteamVRPassthrough, Warning, TEXT("AcquireVideoStreamingService error [%i] on device Id %i"), (int)Error, HMDDeviceId);
-			return false;
+			return;
 		}
 
-		return true;
+		NextArrival = FramePredictor.PredictNextArrival();
 	}
 
-	return false;
-}
-
+	const uint64 CurrentCycles = FPlatformTime::Cycles64();
 
-void FSteamVRPassthroughRenderer::ReleaseVideoStreamingService()
-{
-	if (vr::VRTrackedCamera() && CameraHandle != INVALID_TRACKED_CAMERA_HANDLE)
+	// The frame header is not polled while waiting, since the pickup needs to see the new sequence number.
+	if (NextArrival <= CurrentCycles || FPlatformTime::ToMilliseconds64(NextArrival - CurrentCycles) > MaxWaitMs)
 	{
-		vr::EVRTrackedCameraError Error = vr::VRTrackedCamera()->ReleaseVideoStreamingService(CameraHandle);
+		return;
+	}
 
-		if (Error != vr::VRTrackedCameraError_None)
-		{
-			UE_LOG(LogSteamVRPassthrough, Warning, TEXT("ReleaseVideoStreamingService error [%i]"), (int)Error);
-		}
+	SCOPE_CYCLE_COUNTER(STAT_FrameWait);
+
+	while (FPlatformTime::Cycles64() < NextArrival)
+	{
+		FPlatformProcess::SleepNoStats(0.0f);
 	}
-	CameraHandle = INVALID_TRACKED_CAMERA_HANDLE;
-	bHasValidFrame = false;
 }
 
 
@@ -1159,12 +4306,22 @@ bool FSteamVRPassthroughRenderer::UpdateVideoStreamFrameHeader()
 	}
 	else if (Error != vr::VRTrackedCameraError_None)
 	{
-		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("GetVideoStreamFrameBuffer error [%i]"), (int)Error);
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("GetVideoStreamFrameBuffer error [%i]"), (int)Error);
+		return false;
+	}
+
+	if (NewFrameHeader.nFrameSequence == CameraFrameHeader.nFrameSequence)
+	{
 		return false;
 	}
 
-	if (NewFrameHeader.nFrameSequence == CameraFrameHeader.nFrameSequence)
+	// At the reduced upload rate, new frames are dropped until about two camera frame periods have passed since the last upload,
+	// keeping the header and pose of the displayed frame. Render rates already at or below half the camera rate upload every frame they see.
+	// Shared textures are not copied, so there is nothing to save for them.
+	if (!bUseSharedCameraTexture && QualityGovernor.Tier >= QualityTier_ReducedUploadRate && FramePredictor.PeriodCycles > 0.0 && FramePickupCycles > 0
+		&& (double)(FPlatformTime::Cycles64() - FramePickupCycles) < FramePredictor.PeriodCycles * 1.5)
 	{
+		INC_DWORD_STAT(STAT_SkippedUploads);
 		return false;
 	}
 
@@ -1203,8 +4360,98 @@ bool FSteamVRPassthroughRenderer::UpdateVideoStreamFrameHeader()
 
 bool FSteamVRPassthroughRenderer::UpdateStaticCameraParameters()
 {
+	// The eye projections depend on the projection distance, so they are always read from the runtime.
+	float ProjectionDistanceFar;
+	{
+		FScopeLock Lock(&SettingsLock);
+		ProjectionDistanceFar = GameThreadSettings.ProjectionDistanceFar;
+	}
+
+	RawHMDProjectionLeft = ToFMatrix(vr::VRSystem()->GetProjectionMatrix(vr::Hmd_Eye::Eye_Left, ProjectionDistanceFar * 0.1, ProjectionDistanceFar * 2.0));
+	RawHMDProjectionRight = ToFMatrix(vr::VRSystem()->GetProjectionMatrix(vr::Hmd_Eye::Eye_Right, ProjectionDistanceFar * 0.1, ProjectionDistanceFar * 2.0));
+
+	const FString CacheKey = CVarCalibrationCache.GetValueOnAnyThread() ? GetCalibrationCacheKey(FrameType) : FString();
+	FSteamVRCameraCalibration Calibration;
+
+	if (!CacheKey.IsEmpty() && FSteamVRCalibrationCache::Load(CacheKey, Calibration))
+	{
+		UE_LOG(LogSteamVRPassthrough, Log, TEXT("Using cached camera calibration."));
+		ApplyCameraCalibration(Calibration);
+		bCalibrationFromCache = true;
+
+		const vr::EVRTrackedCameraFrameType CachedFrameType = FrameType;
+		TWeakPtr<FSteamVRPassthroughRenderer, ESPMode::ThreadSafe> WeakThis = StaticCastSharedRef<FSteamVRPassthroughRenderer>(AsShared());
+
+		// Check the cache against the runtime without holding up the startup, and switch to the live calibration if it changed.
+		Async(EAsyncExecution::ThreadPool, [WeakThis, CacheKey, Calibration, CachedFrameType]()
+		{
+			FScopeLock Lock(&FSteamVRRuntimeSession::GetSessionLock());
+
+			FSteamVRCameraCalibration LiveCalibration;
+
+			if (vr::VRSystem() && QueryCameraCalibration(CachedFrameType, LiveCalibration) && !LiveCalibration.Matches(Calibration))
+			{
+				UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Cached camera calibration is out of date, updating it."));
+				FSteamVRCalibrationCache::Save(CacheKey, LiveCalibration);
+
+				AsyncTask(ENamedThreads::GameThread, [WeakThis, LiveCalibration, CachedFrameType]()
+				{
+					TSharedPtr<FSteamVRPassthroughRenderer, ESPMode::ThreadSafe> This = WeakThis.Pin();
+
+					if (This.IsValid())
+					{
+						This->ApplyLiveCameraCalibration_GameThread(LiveCalibration, CachedFrameType);
+					}
+				});
+			}
+		});
+
+		return true;
+	}
+
+	if (!QueryCameraCalibration(FrameType, Calibration))
+	{
+		return false;
+	}
+
+	ApplyCameraCalibration(Calibration);
+	bCalibrationFromCache = false;
+
+	if (!CacheKey.IsEmpty())
+	{
+		FSteamVRCalibrationCache::Save(CacheKey, Calibration);
+	}
+
+	return true;
+}
+
+
+FString FSteamVRPassthroughRenderer::GetCalibrationCacheKey(vr::EVRTrackedCameraFrameType InFrameType)
+{
+	char Buffer[vr::k_unMaxPropertyStringSize];
+	vr::TrackedPropertyError Error;
+
+	vr::VRSystem()->GetStringTrackedDeviceProperty(HMDDeviceId, vr::Prop_SerialNumber_String, Buffer, sizeof(Buffer), &Error);
+
+	if (Error != vr::TrackedProp_Success)
+	{
+		return FString();
+	}
+
+	const FString SerialNumber = UTF8_TO_TCHAR(Buffer);
 
-	vr::EVRTrackedCameraError Error = vr::VRTrackedCamera()->GetCameraFrameSize(HMDDeviceId, FrameType, &CameraTextureWidth, &CameraTextureHeight, &CameraFrameBufferSize);
+	vr::VRSystem()->GetStringTrackedDeviceProperty(HMDDeviceId, vr::Prop_DriverVersion_String, Buffer, sizeof(Buffer), &Error);
+
+	// Not all drivers report a version, the serial number alone still identifies the calibration.
+	const FString DriverVersion = (Error == vr::TrackedProp_Success) ? UTF8_TO_TCHAR(Buffer) : TEXT("");
+
+	return FSteamVRCalibrationCache::MakeKey(SerialNumber, DriverVersion, (int32)InFrameType);
+}
+
+
+bool FSteamVRPassthroughRenderer::QueryCameraCalibration(vr::EVRTrackedCameraFrameType InFrameType, FSteamVRCameraCalibration& OutCalibration)
+{
+	vr::EVRTrackedCameraError Error = vr::VRTrackedCamera()->GetCameraFrameSize(HMDDeviceId, InFrameType, &OutCalibration.FrameWidth, &OutCalibration.FrameHeight, &OutCalibration.FrameBufferSize);
 
 	if (Error != vr::VRTrackedCameraError_None)
 	{
@@ -1212,45 +4459,128 @@ bool FSteamVRPassthroughRenderer::UpdateStaticCameraParameters()
 		return false;
 	}
 
-	if (CameraTextureWidth == 0 || CameraTextureHeight == 0 || CameraFrameBufferSize == 0)
+	if (OutCalibration.FrameWidth == 0 || OutCalibration.FrameHeight == 0 || OutCalibration.FrameBufferSize == 0)
 	{
-		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Invalid frame size received:Width = %u, Height = %u, Size = %u"), CameraTextureWidth, CameraTextureHeight, CameraFrameBufferSize);
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Invalid frame size received:Width = %u, Height = %u, Size = %u"), OutCalibration.FrameWidth, OutCalibration.FrameHeight, OutCalibration.FrameBufferSize);
 		return false;
 	}
 	
-	FrameLayout = GetFrameLayout();
+	const ESteamVRStereoFrameLayout Layout = QueryFrameLayout_AnyThread();
+	OutCalibration.FrameLayout = (int32)Layout;
 
-	RawHMDProjectionLeft = ToFMatrix(vr::VRSystem()->GetProjectionMatrix(vr::Hmd_Eye::Eye_Left, PostProcessProjectionDistanceFar * 0.1, PostProcessProjectionDistanceFar * 2.0));
-	RawHMDViewLeft = ToFMatrix(vr::VRSystem()->GetEyeToHeadTransform(vr::Hmd_Eye::Eye_Left)).Inverse();
-
-	RawHMDProjectionRight = ToFMatrix(vr::VRSystem()->GetProjectionMatrix(vr::Hmd_Eye::Eye_Right, PostProcessProjectionDistanceFar * 0.1, PostProcessProjectionDistanceFar * 2.0));
-	RawHMDViewRight = ToFMatrix(vr::VRSystem()->GetEyeToHeadTransform(vr::Hmd_Eye::Eye_Right)).Inverse();
+	OutCalibration.HMDViewLeft = ToFMatrix(vr::VRSystem()->GetEyeToHeadTransform(vr::Hmd_Eye::Eye_Left)).Inverse();
+	OutCalibration.HMDViewRight = ToFMatrix(vr::VRSystem()->GetEyeToHeadTransform(vr::Hmd_Eye::Eye_Right)).Inverse();
 
 	FMatrix LeftCameraPose, RightCameraPose;
-	if (!GetTrackedCameraEyePoses(LeftCameraPose, RightCameraPose))
+	if (!GetTrackedCameraEyePoses(Layout, LeftCameraPose, RightCameraPose))
 	{
 		return false;
 	}
-	CameraLeftToHMDPose = CopyTemp(LeftCameraPose);
-	CameraLeftToRightPose = CopyTemp(RightCameraPose * LeftCameraPose.Inverse());
+	OutCalibration.CameraLeftToHMDPose = CopyTemp(LeftCameraPose);
+	OutCalibration.CameraLeftToRightPose = CopyTemp(RightCameraPose * LeftCameraPose.Inverse());
+
+	// Missing intrinsics only disable the undistortion map, which checks for them.
+	// Stored by left/right camera like the poses, not by OpenVR index.
+	const uint32 NumCameras = (Layout != ESteamVRStereoFrameLayout::Mono) ? 2 : 1;
+
+	for (uint32 CameraId = 0; CameraId < NumCameras; CameraId++)
+	{
+		GetCameraIntrinsics(InFrameType, GetOpenVRCameraIndex(CameraId, Layout, InFrameType), OutCalibration.FocalLength[CameraId], OutCalibration.Center[CameraId]);
+	}
 
 	return true;
 }
 
 
-void FSteamVRPassthroughRenderer::GetCameraIntrinsics(const uint32 CameraId, FVector2D& FocalLength, FVector2D& Center)
+void FSteamVRPassthroughRenderer::ApplyLiveCameraCalibration_GameThread(const FSteamVRCameraCalibration& Calibration, vr::EVRTrackedCameraFrameType InFrameType)
+{
+	check(IsInGameThread());
+
+	// Passthrough was shut down or restarted with another frame type since the check started.
+	if (!bIsInitialized || FrameType != InFrameType)
+	{
+		return;
+	}
+
+	// The camera texture and frame buffer are sized from these, so they need a full restart.
+	if (Calibration.FrameWidth != CameraTextureWidth || Calibration.FrameHeight != CameraTextureHeight ||
+		Calibration.FrameBufferSize != CameraFrameBufferSize || (ESteamVRStereoFrameLayout)Calibration.FrameLayout != FrameLayout)
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Camera frame format changed from the cached calibration, it will be used the next time passthrough is enabled."));
+		return;
+	}
+
+	{
+		FScopeLock Lock(&RenderLock);
+		FScopeLock ParameterScopeLock(&ParameterLock);
+
+		ApplyCameraCalibration(Calibration);
+
+		// The cached projections were read with the previous calibration.
+		LeftCameraMatrixCache->Reset();
+		RightCameraMatrixCache->Reset();
+		UVTransformTables[0] = FSteamVRPassthroughUVTransformTable();
+		UVTransformTables[1] = FSteamVRPassthroughUVTransformTable();
+	}
+
+	if (FrameType != vr::VRTrackedCameraFrameType_Distorted)
+	{
+		return;
+	}
+
+	// Only the game thread writes the calibration, so the map is built outside the lock.
+	if (BuildUndistortionMap())
+	{
+		CreateUndistortionMap_GameThread();
+	}
+	else
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Failed to build the camera undistortion map, distorted frames will be displayed as-is."));
+
+		ENQUEUE_RENDER_COMMAND(DisableUndistortionMap)(
+			[this](FRHICommandListImmediate& RHICmdList)
+		{
+			FScopeLock Lock(&RenderLock);
+			bUndistortFrames = false;
+		});
+	}
+}
+
+
+void FSteamVRPassthroughRenderer::ApplyCameraCalibration(const FSteamVRCameraCalibration& Calibration)
+{
+	CameraTextureWidth = Calibration.FrameWidth;
+	CameraTextureHeight = Calibration.FrameHeight;
+	CameraFrameBufferSize = Calibration.FrameBufferSize;
+	FrameLayout = (ESteamVRStereoFrameLayout)Calibration.FrameLayout;
+
+	RawHMDViewLeft = Calibration.HMDViewLeft;
+	RawHMDViewRight = Calibration.HMDViewRight;
+
+	CameraLeftToHMDPose = Calibration.CameraLeftToHMDPose;
+	CameraLeftToRightPose = Calibration.CameraLeftToRightPose;
+
+	for (int32 CameraId = 0; CameraId < 2; CameraId++)
+	{
+		CameraFocalLength[CameraId] = Calibration.FocalLength[CameraId];
+		CameraCenter[CameraId] = Calibration.Center[CameraId];
+	}
+}
+
+
+bool FSteamVRPassthroughRenderer::GetCameraIntrinsics(vr::EVRTrackedCameraFrameType InFrameType, const uint32 CameraId, FVector2D& FocalLength, FVector2D& Center)
 {
 	if (vr::VRTrackedCamera())
 	{
 		vr::HmdVector2_t VRFocalLength;
 		vr::HmdVector2_t VRCenter;
 
-		vr::EVRTrackedCameraError Error = vr::VRTrackedCamera()->GetCameraIntrinsics(HMDDeviceId, CameraId, FrameType, &VRFocalLength, &VRFocalLength);
+		vr::EVRTrackedCameraError Error = vr::VRTrackedCamera()->GetCameraIntrinsics(HMDDeviceId, CameraId, InFrameType, &VRFocalLength, &VRCenter);
 
 		if (Error != vr::VRTrackedCameraError_None)
 		{
 			UE_LOG(LogSteamVRPassthrough, Warning, TEXT("CameraIntrinsics error [%i] on device Id %i"), (int)Error, HMDDeviceId);
-			return;
+			return false;
 		}
 
 		FocalLength.X = VRFocalLength.v[0];
@@ -1258,7 +4588,118 @@ void FSteamVRPassthroughRenderer::GetCameraIntrinsics(const uint32 CameraId, FVe
 
 		Center.X = VRCenter.v[0];
 		Center.Y = VRCenter.v[1];
+
+		return true;
+	}
+
+	return false;
+}
+
+
+bool FSteamVRPassthroughRenderer::BuildUndistortionMap()
+{
+	if (!vr::VRSystem())
+	{
+		return false;
+	}
+
+	const bool bIsStereo = FrameLayout != ESteamVRStereoFrameLayout::Mono;
+	const uint32 NumCameras = bIsStereo ? 2 : 1;
+
+	int32 DistortionFunctions[2] = { 0 };
+	float DistortionCoefficients[2 * vr::k_unMaxDistortionFunctionParameters] = { 0 };
+	vr::TrackedPropertyError Error;
+
+	uint32_t NumBytes = vr::VRSystem()->GetArrayTrackedDeviceProperty(HMDDeviceId, vr::Prop_CameraDistortionFunction_Int32_Array, vr::k_unInt32PropertyTag, &DistortionFunctions, sizeof(DistortionFunctions), &Error);
+
+	if (Error != vr::TrackedProp_Success || NumBytes < NumCameras * sizeof(int32))
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Failed to get camera distortion functions, error [%i]"), (int)Error);
+		return false;
+	}
+
+	NumBytes = vr::VRSystem()->GetArrayTrackedDeviceProperty(HMDDeviceId, vr::Prop_CameraDistortionCoefficients_Float_Array, vr::k_unFloatPropertyTag, &DistortionCoefficients, sizeof(DistortionCoefficients), &Error);
+
+	if (Error != vr::TrackedProp_Success || NumBytes < NumCameras * vr::k_unMaxDistortionFunctionParameters * sizeof(float))
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Failed to get camera distortion coefficients, error [%i]"), (int)Error);
+		return false;
+	}
+
+	const uint32 MapWidth = FMath::Max(CameraTextureWidth / UNDISTORTION_MAP_DOWNSCALE, 1u);
+	const uint32 MapHeight = FMath::Max(CameraTextureHeight / UNDISTORTION_MAP_DOWNSCALE, 1u);
+
+	const FVector2D FrameUVScale = GetFrameUVScale(FrameLayout);
+	const FVector2D CameraSize = FVector2D(CameraTextureWidth, CameraTextureHeight) * FrameUVScale;
+
+	TArray<FVector2D> MapData;
+	MapData.SetNumZeroed(MapWidth * MapHeight);
+
+	for (uint32 CameraId = 0; CameraId < NumCameras; CameraId++)
+	{
+		const uint32 PropertyIndex = GetOpenVRCameraIndex(CameraId, FrameLayout, vr::VRTrackedCameraFrameType_Distorted);
+		const int32 Function = DistortionFunctions[PropertyIndex];
+		const float* K = &DistortionCoefficients[PropertyIndex * vr::k_unMaxDistortionFunctionParameters];
+
+		if (Function != vr::VRDistortionFunctionType_None && Function != vr::VRDistortionFunctionType_FTheta)
+		{
+			UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Unsupported camera distortion function [%i]"), Function);
+			return false;
+		}
+
+		const FVector2D FocalLength = CameraFocalLength[CameraId];
+		const FVector2D Center = CameraCenter[CameraId];
+
+		if (FocalLength.X == 0 || FocalLength.Y == 0)
+		{
+			return false;
+		}
+
+		const FVector2D FrameUVOffset = GetFrameUVOffset(CameraId == 0 ? eSSP_LEFT_EYE : eSSP_RIGHT_EYE, FrameLayout);
+
+		// Keeps the bilinear camera lookups from reaching into the other camera's image.
+		const FVector2D MinUV = FVector2D(0.5f, 0.5f) / CameraSize;
+		const FVector2D MaxUV = FVector2D(1.0f, 1.0f) - MinUV;
+
+		for (uint32 Y = 0; Y < MapHeight; Y++)
+		{
+			for (uint32 X = 0; X < MapWidth; X++)
+			{
+				FVector2D MapUV = FVector2D((X + 0.5f) / MapWidth, (Y + 0.5f) / MapHeight);
+				FVector2D CameraUV = (MapUV - FrameUVOffset) / FrameUVScale;
+
+				// Texel belongs to the other camera.
+				if (CameraUV.X < 0 || CameraUV.X > 1 || CameraUV.Y < 0 || CameraUV.Y > 1)
+				{
+					continue;
+				}
+
+				FVector2D Ideal = (CameraUV * CameraSize - Center) / FocalLength;
+				FVector2D Distorted = Ideal;
+				float Radius = Ideal.Size();
+
+				// Fisheye model: theta_d = theta * (1 + k0 * theta^2 + k1 * theta^4 + k2 * theta^6 + k3 * theta^8)
+				if (Function == vr::VRDistortionFunctionType_FTheta && Radius > KINDA_SMALL_NUMBER)
+				{
+					float Theta = FMath::Atan(Radius);
+					float Theta2 = Theta * Theta;
+					float ThetaDistorted = Theta * (1.0f + Theta2 * (K[0] + Theta2 * (K[1] + Theta2 * (K[2] + Theta2 * K[3]))));
+
+					Distorted = Ideal * (ThetaDistorted / Radius);
+				}
+
+				// Stored relative to the camera's own image, so the shaders can offset it to either eye.
+				const FVector2D DistortedUV = (Distorted * FocalLength + Center) / CameraSize;
+				MapData[Y * MapWidth + X] = FVector2D(FMath::Clamp(DistortedUV.X, MinUV.X, MaxUV.X), FMath::Clamp(DistortedUV.Y, MinUV.Y, MaxUV.Y));
+			}
+		}
 	}
+
+	// The texture is created with the other resources on the game thread, since this may run on a worker.
+	UndistortionMapData = MoveTemp(MapData);
+	UndistortionMapSize = FIntPoint(MapWidth, MapHeight);
+
+	return true;
 }
 
 
@@ -1270,7 +4711,7 @@ FMatrix FSteamVRPassthroughRenderer::GetCameraProjection(const uint32 CameraId,
 	}
 	vr::HmdMatrix44_t VRProjection;
 
-	vr::EVRTrackedCameraError Error = vr::VRTrackedCamera()->GetCameraProjection(HMDDeviceId, CameraId, (vr::EVRTrackedCameraFrameType)FrameType, ZNear, ZFar, &VRProjection);
+	vr::EVRTrackedCameraError Error = vr::VRTrackedCamera()->GetCameraProjection(HMDDeviceId, GetOpenVRCameraIndex(CameraId, FrameLayout, (vr::EVRTrackedCameraFrameType)FrameType), (vr::EVRTrackedCameraFrameType)FrameType, ZNear, ZFar, &VRProjection);
 
 	if (Error != vr::VRTrackedCameraError_None)
 	{
@@ -1308,7 +4749,7 @@ FMatrix FSteamVRPassthroughRenderer::GetCameraProjectionInv(const uint32 CameraI
 }
 
 
-bool FSteamVRPassthroughRenderer::GetTrackedCameraEyePoses(FMatrix& LeftPose, FMatrix& RightPose)
+bool FSteamVRPassthroughRenderer::GetTrackedCameraEyePoses(const ESteamVRStereoFrameLayout Layout, FMatrix& LeftPose, FMatrix& RightPose)
 {
 	if (!vr::VRSystem())
 	{
@@ -1331,12 +4772,12 @@ bool FSteamVRPassthroughRenderer::GetTrackedCameraEyePoses(FMatrix& LeftPose, FM
 		bGotRightCamera = false;
 	}
 	
-	if (FrameLayout == ESteamVRStereoFrameLayout::StereoHorizontalLayout)
+	if (Layout == ESteamVRStereoFrameLayout::StereoHorizontalLayout)
 	{
 		LeftPose = ToFMatrix(Buffer[0]);
 		RightPose = ToFMatrix(Buffer[1]);
 	}
-	else if (FrameLayout == ESteamVRStereoFrameLayout::StereoVerticalLayout)
+	else if (Layout == ESteamVRStereoFrameLayout::StereoVerticalLayout)
 	{
 		// Vertical layouts have the right camera at index 0.
 		LeftPose = ToFMatrix(Buffer[1]);
@@ -1359,7 +4800,7 @@ bool FSteamVRPassthroughRenderer::GetTrackedCameraEyePoses(FMatrix& LeftPose, FM
 		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Invalid left camera pose received"));
 	}
 
-	if (FrameLayout != ESteamVRStereoFrameLayout::Mono && (RightPose == FMatrix::Identity || RightPose.Determinant() == 0))
+	if (Layout != ESteamVRStereoFrameLayout::Mono && (RightPose == FMatrix::Identity || RightPose.Determinant() == 0))
 	{
 		bGotRightCamera = false;
 		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Invalid right camera pose received"));
@@ -1376,7 +4817,7 @@ bool FSteamVRPassthroughRenderer::GetTrackedCameraEyePoses(FMatrix& LeftPose, FM
 			LeftPose == FMatrix::Identity;
 			RightPose == FMatrix::Identity;
 
-			if (FrameLayout == ESteamVRStereoFrameLayout::Mono)
+			if (Layout == ESteamVRStereoFrameLayout::Mono)
 			{
 				// The mono layout does not need the camra pose unless the frame header has missing data, 
 				// such as with the HTC Vive on 30 Hz.
@@ -1402,8 +4843,22 @@ bool FSteamVRPassthroughRenderer::GetTrackedCameraEyePoses(FMatrix& LeftPose, FM
 }
 
 
+FMatrix FSteamVRPassthroughRenderer::GetEngineViewMVP(const FSceneView& View) const
+{
+	// The passthrough is drawn after temporal AA, so the jitter is left out.
+	const FViewMatrices& Matrices = View.ViewMatrices;
+	return RenderSettings.TrackingToWorld * Matrices.GetViewMatrix() * Matrices.GetProjectionNoAAMatrix();
+}
+
+
 FMatrix FSteamVRPassthroughRenderer::GetHMDRawMVPMatrix(const EStereoscopicPass Eye)
 {
+	// Only the clip space XY and W are used by the transforms, so the engine projection can be used as-is.
+	if (bUseViewMVP)
+	{
+		return (Eye == eSSP_RIGHT_EYE) ? ViewMVPRight : ViewMVPLeft;
+	}
+
 	if (!vr::VRSystem() || !vr::VRCompositor())
 	{
 		return FMatrix::Identity;
@@ -1479,9 +4934,18 @@ FMatrix FSteamVRPassthroughRenderer::GetTrackedCameraUVTransform(const EStereosc
 	bool bIsStereo = FrameLayout != ESteamVRStereoFrameLayout::Mono;
 	uint32 CameraId = (Eye == eSSP_RIGHT_EYE && bIsStereo) ? 1 : 0;
 
-	FMatrix MVP = GetHMDRawMVPMatrix(Eye);
-	FMatrix CameraProjectionInv = GetCameraProjectionInv(CameraId, ProjectionDistance * 0.5, ProjectionDistance);
+	return GetTrackedCameraUVTransform(CameraId, GetHMDRawMVPMatrix(Eye), ProjectionDistance);
+}
+
 
+FMatrix FSteamVRPassthroughRenderer::GetTrackedCameraUVTransform(const uint32 CameraId, const FMatrix& MVP, const float ProjectionDistance)
+{
+	return GetTrackedCameraUVTransform(CameraId, MVP, GetCameraProjectionInv(CameraId, ProjectionDistance * 0.5, ProjectionDistance));
+}
+
+
+FMatrix FSteamVRPassthroughRenderer::GetTrackedCameraUVTransform(const uint32 CameraId, const FMatrix& MVP, const FMatrix& CameraProjectionInv)
+{
 	FMatrix TransformToCamera;
 
 	if (CameraId == 0)
@@ -1570,19 +5034,199 @@ void FSteamVRPassthroughRenderer::RemovePassthoughTransformParameters(const UMat
 }
 
 
+// Scales the homography so the frame center has a w of 1, making transforms at different distances comparable.
+static void NormalizeUVTransform(FMatrix& Transform)
+{
+	const float W = Transform.M[2][0] * 0.5f + Transform.M[2][1] * 0.5f + Transform.M[2][2];
+
+	if (FMath::IsNearlyZero(W))
+	{
+		return;
+	}
+
+	for (int32 Row = 0; Row < 3; Row++)
+	{
+		for (int32 Column = 0; Column < 3; Column++)
+		{
+			Transform.M[Row][Column] /= W;
+		}
+	}
+}
+
+
+// Largest difference in camera UVs between two transforms, sampled at the frame corners and center.
+static float GetUVTransformError(const FMatrix& A, const FMatrix& B)
+{
+	static const FVector2D SamplePoints[] = { FVector2D(0, 0), FVector2D(1, 0), FVector2D(0, 1), FVector2D(1, 1), FVector2D(0.5f, 0.5f) };
+
+	auto TransformUV = [](const FMatrix& M, const FVector2D& UV)
+	{
+		const float W = M.M[2][0] * UV.X + M.M[2][1] * UV.Y + M.M[2][2];
+
+		if (FMath::IsNearlyZero(W))
+		{
+			return FVector2D(BIG_NUMBER, BIG_NUMBER);
+		}
+
+		return FVector2D(M.M[0][0] * UV.X + M.M[0][1] * UV.Y + M.M[0][2], M.M[1][0] * UV.X + M.M[1][1] * UV.Y + M.M[1][2]) / W;
+	};
+
+	float MaxError = 0.0f;
+
+	for (const FVector2D& Point : SamplePoints)
+	{
+		MaxError = FMath::Max(MaxError, FVector2D::Distance(TransformUV(A, Point), TransformUV(B, Point)));
+	}
+
+	return MaxError;
+}
+
+
+void FSteamVRPassthroughRenderer::BuildUVTransformTable(const EStereoscopicPass Eye, const FMatrix& MVP, const int32 TableSize, const float MaxError)
+{
+	bool bIsStereo = FrameLayout != ESteamVRStereoFrameLayout::Mono;
+	uint32 CameraId = (Eye == eSSP_RIGHT_EYE && bIsStereo) ? 1 : 0;
+	FSteamVRPassthroughUVTransformTable& Table = UVTransformTables[Eye == eSSP_RIGHT_EYE ? 1 : 0];
+
+	if (Table.Distances.Num() != TableSize)
+	{
+		Table.Distances.SetNum(TableSize);
+		Table.ProjectionInv.SetNum(TableSize * 2 - 1);
+		Table.bIsValid = false;
+
+		for (int32 Index = 0; Index < TableSize; Index++)
+		{
+			const float Alpha = (float)Index / (TableSize - 1);
+			Table.Distances[Index] = UV_TRANSFORM_TABLE_MIN_DISTANCE * FMath::Pow(UV_TRANSFORM_TABLE_MAX_DISTANCE / UV_TRANSFORM_TABLE_MIN_DISTANCE, Alpha);
+		}
+
+		for (int32 Index = 0; Index < Table.ProjectionInv.Num(); Index++)
+		{
+			// The midpoints are taken in inverse distance, where the interpolation is done.
+			const float Distance = (Index % 2 == 0) ? Table.Distances[Index / 2] : 
+				2.0f / (1.0f / Table.Distances[Index / 2] + 1.0f / Table.Distances[Index / 2 + 1]);
+
+			Table.ProjectionInv[Index] = GetCameraProjection(CameraId, Distance * 0.5, Distance).InverseFast();
+		}
+	}
+
+	Table.Transforms.SetNum(TableSize);
+	Table.SegmentWithinLimit.SetNum(TableSize - 1);
+
+	for (int32 Index = 0; Index < TableSize; Index++)
+	{
+		Table.Transforms[Index] = GetTrackedCameraUVTransform(CameraId, MVP, Table.ProjectionInv[Index * 2]);
+		NormalizeUVTransform(Table.Transforms[Index]);
+	}
+
+	// The interpolation error only depends on where the camera is relative to the eye, which mostly stays put between frames.
+	const FMatrix CameraToClip = FrameCameraToTrackingPose * MVP;
+
+	if (Table.bIsValid && Table.VerifiedMaxError == MaxError && CameraToClip.Equals(Table.VerifiedCameraToClip, UV_TRANSFORM_TABLE_VERIFY_TOLERANCE))
+	{
+		return;
+	}
+
+	Table.VerifiedCameraToClip = CameraToClip;
+	Table.VerifiedMaxError = MaxError;
+
+	// Check each segment against an exact transform at its midpoint, where the interpolation error is largest.
+	for (int32 Index = 0; Index < TableSize - 1; Index++)
+	{
+		FMatrix Midpoint = GetTrackedCameraUVTransform(CameraId, MVP, Table.ProjectionInv[Index * 2 + 1]);
+		NormalizeUVTransform(Midpoint);
+
+		const FMatrix Interpolated = Table.Transforms[Index] * 0.5f + Table.Transforms[Index + 1] * 0.5f;
+		Table.SegmentWithinLimit[Index] = GetUVTransformError(Midpoint, Interpolated) <= MaxError;
+	}
+
+	Table.bIsValid = true;
+}
+
+
+bool FSteamVRPassthroughRenderer::GetTableUVTransform(const EStereoscopicPass Eye, const float ProjectionDistance, FMatrix& OutTransform) const
+{
+	const FSteamVRPassthroughUVTransformTable& Table = UVTransformTables[Eye == eSSP_RIGHT_EYE ? 1 : 0];
+
+	if (!Table.bIsValid || ProjectionDistance < UV_TRANSFORM_TABLE_MIN_DISTANCE || ProjectionDistance > UV_TRANSFORM_TABLE_MAX_DISTANCE)
+	{
+		return false;
+	}
+
+	const int32 TableSize = Table.Distances.Num();
+	const float LogAlpha = FMath::Loge(ProjectionDistance / UV_TRANSFORM_TABLE_MIN_DISTANCE) / FMath::Loge(UV_TRANSFORM_TABLE_MAX_DISTANCE / UV_TRANSFORM_TABLE_MIN_DISTANCE);
+	const int32 Index = FMath::Clamp(FMath::FloorToInt(LogAlpha * (TableSize - 1)), 0, TableSize - 2);
+
+	if (!Table.SegmentWithinLimit[Index])
+	{
+		return false;
+	}
+
+	const float InvNear = 1.0f / Table.Distances[Index];
+	const float InvFar = 1.0f / Table.Distances[Index + 1];
+	const float Alpha = FMath::Clamp((InvNear - 1.0f / ProjectionDistance) / (InvNear - InvFar), 0.0f, 1.0f);
+
+	OutTransform = Table.Transforms[Index] * (1.0f - Alpha) + Table.Transforms[Index + 1] * Alpha;
+	return true;
+}
+
+
 void FSteamVRPassthroughRenderer::UpdateTransformParameters()
 {
 	FScopeLock Lock(&ParameterLock);
 
-	for (FSteamVRPassthoughUVTransformParameter ParameterStruct : *TransformParameters)
+	const int32 TableSize = FMath::Min(CVarTransformTableSize.GetValueOnRenderThread(), 256);
+	const float TableMaxError = CVarTransformTableMaxError.GetValueOnRenderThread();
+	const bool bIsStereo = FrameLayout != ESteamVRStereoFrameLayout::Mono;
+
+	// Parameters at the same distance share a transform, so each distance is only solved once.
+	TMap<float, FMatrix> EyeTransforms[2];
+
+	for (const FSteamVRPassthoughUVTransformParameter& ParameterStruct : *TransformParameters)
+	{
+		if (IsValid(ParameterStruct.Instance))
+		{
+			EyeTransforms[ParameterStruct.StereoPass == 0 ? 0 : 1].Add(ParameterStruct.ProjectionDistance);
+		}
+	}
+
+	for (int32 EyeIndex = 0; EyeIndex < 2; EyeIndex++)
+	{
+		if (EyeTransforms[EyeIndex].Num() == 0)
+		{
+			continue;
+		}
+
+		const EStereoscopicPass Eye = EyeIndex == 0 ? eSSP_LEFT_EYE : eSSP_RIGHT_EYE;
+		const uint32 CameraId = (EyeIndex == 1 && bIsStereo) ? 1 : 0;
+		const FMatrix MVP = GetHMDRawMVPMatrix(Eye);
+
+		// Building the table takes an exact solve per entry, so it only pays off with more distances than entries.
+		const bool bUseTable = TableSize >= 2 && EyeTransforms[EyeIndex].Num() > TableSize;
+
+		if (bUseTable)
+		{
+			BuildUVTransformTable(Eye, MVP, TableSize, TableMaxError);
+		}
+
+		for (TPair<float, FMatrix>& Entry : EyeTransforms[EyeIndex])
+		{
+			if (!bUseTable || !GetTableUVTransform(Eye, Entry.Key, Entry.Value))
+			{
+				Entry.Value = GetTrackedCameraUVTransform(CameraId, MVP, Entry.Key);
+				INC_DWORD_STAT(STAT_ExactParameterTransforms);
+			}
+		}
+	}
+
+	for (const FSteamVRPassthoughUVTransformParameter& ParameterStruct : *TransformParameters)
 	{
 		if (!IsValid(ParameterStruct.Instance))
 		{
 			continue;
 		}
-		EStereoscopicPass Eye = ParameterStruct.StereoPass == 0 ? eSSP_LEFT_EYE : eSSP_RIGHT_EYE;
 
-		FMatrix Transform = GetTrackedCameraUVTransform(Eye, ParameterStruct.ProjectionDistance);
+		const FMatrix& Transform = EyeTransforms[ParameterStruct.StereoPass == 0 ? 0 : 1].FindChecked(ParameterStruct.ProjectionDistance);
 
 		FMaterialInstanceResource* Resource = ParameterStruct.Instance->Resource;
 
@@ -0,0 +1,272 @@
+#include "SteamVRRuntimeSession.h"
+#include "SteamVRPassthrough.h"
+#include "Async/Async.h"
+#include "Containers/Ticker.h"
+#include "Engine/Engine.h"
+#include "IXRTrackingSystem.h"
+#include "Misc/CoreDelegates.h"
+#include "openvr.h"
+
+// Seconds between attempts to reconnect after SteamVR has quit.
+#define RUNTIME_RECONNECT_INTERVAL 2.0
+
+
+static TAutoConsoleVariable<bool> CVarKeepRuntimeWarm(
+	TEXT("vr.SteamVRPassthrough.KeepRuntimeWarm"),
+	true,
+	TEXT("Keep the background SteamVR session running after the last passthrough user is released, so enabling passthrough again is fast.\n")
+	TEXT("When disabled, the session is shut down once it has no users.")
+);
+
+
+FCriticalSection FSteamVRRuntimeSession::SessionLock;
+int32 FSteamVRRuntimeSession::UserCount = 0;
+bool FSteamVRRuntimeSession::bIsRunning = false;
+bool FSteamVRRuntimeSession::bDeferredShutdown = false;
+bool FSteamVRRuntimeSession::bReconnectPending = false;
+double FSteamVRRuntimeSession::NextReconnectTime = 0.0;
+int32 FSteamVRRuntimeSession::HMDDeviceIndex = -1;
+FDelegateHandle FSteamVRRuntimeSession::TickerHandle;
+FSimpleMulticastDelegate FSteamVRRuntimeSession::SessionLostDelegate;
+FSimpleMulticastDelegate FSteamVRRuntimeSession::SessionRestoredDelegate;
+
+
+bool FSteamVRRuntimeSession::Acquire()
+{
+	FScopeLock Lock(&SessionLock);
+
+	if (!ConnectLocked())
+	{
+		return false;
+	}
+
+	UserCount++;
+	return true;
+}
+
+
+void FSteamVRRuntimeSession::Release()
+{
+	FScopeLock Lock(&SessionLock);
+
+	if (UserCount > 0 && --UserCount == 0)
+	{
+		bReconnectPending = false;
+
+		if (!CVarKeepRuntimeWarm.GetValueOnAnyThread())
+		{
+			Shutdown();
+		}
+	}
+}
+
+
+bool FSteamVRRuntimeSession::Connect()
+{
+	FScopeLock Lock(&SessionLock);
+	return ConnectLocked();
+}
+
+
+bool FSteamVRRuntimeSession::ConnectLocked()
+{
+	if (bIsRunning)
+	{
+		return true;
+	}
+
+	vr::EVRInitError Error;
+	vr::VR_Init(&Error, vr::EVRApplicationType::VRApplication_Background);
+
+	if (Error != vr::EVRInitError::VRInitError_None)
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Failed to init SteamVR runtime as background app, error [%i]"), (int)Error);
+		return false;
+	}
+
+	if (!vr::VRSystem() || !vr::VRTrackedCamera() || !vr::VRCompositor())
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("Invalid SteamVR interface handle!"));
+		vr::VR_Shutdown();
+
+		return false;
+	}
+
+	bIsRunning = true;
+	HMDDeviceIndex = -1;
+
+	if (GetHMDDeviceIndex() < 0)
+	{
+		UE_LOG(LogSteamVRPassthrough, Warning, TEXT("HMD device ID not found!"));
+		DisconnectLocked();
+
+		return false;
+	}
+
+	// Calling VR_Shutdown while the OpenXR runtime is active will hang the game,
+	// so the session is only shut down on exit once started.
+	if (!bDeferredShutdown)
+	{
+		bDeferredShutdown = true;
+		FCoreDelegates::OnExit.AddStatic(&FSteamVRRuntimeSession::Shutdown);
+	}
+
+	EnsureTicker();
+
+	return true;
+}
+
+
+void FSteamVRRuntimeSession::DisconnectLocked()
+{
+	if (bIsRunning)
+	{
+		vr::VR_Shutdown();
+	}
+
+	bIsRunning = false;
+	HMDDeviceIndex = -1;
+}
+
+
+void FSteamVRRuntimeSession::Shutdown()
+{
+	FScopeLock Lock(&SessionLock);
+
+	if (!bIsRunning)
+	{
+		return;
+	}
+
+	// Other XR runtimes can hang if the session is shut down while they are active, leave it to the exit handler.
+	if (GEngine && GEngine->XRSystem.IsValid() && !IsEngineExitRequested())
+	{
+		return;
+	}
+
+	DisconnectLocked();
+}
+
+
+bool FSteamVRRuntimeSession::IsRunning()
+{
+	return bIsRunning;
+}
+
+
+int32 FSteamVRRuntimeSession::GetHMDDeviceIndex()
+{
+	FScopeLock Lock(&SessionLock);
+
+	if (!vr::VRSystem())
+	{
+		return -1;
+	}
+
+	if (HMDDeviceIndex >= 0 && vr::VRSystem()->GetTrackedDeviceClass(HMDDeviceIndex) == vr::TrackedDeviceClass_HMD)
+	{
+		return HMDDeviceIndex;
+	}
+
+	HMDDeviceIndex = -1;
+
+	for (int32 Index = 0; Index < vr::k_unMaxTrackedDeviceCount; Index++)
+	{
+		if (vr::VRSystem()->GetTrackedDeviceClass(Index) == vr::TrackedDeviceClass_HMD)
+		{
+			HMDDeviceIndex = Index;
+			break;
+		}
+	}
+
+	return HMDDeviceIndex;
+}
+
+
+void FSteamVRRuntimeSession::EnsureTicker()
+{
+	if (TickerHandle.IsValid())
+	{
+		return;
+	}
+
+	// The session may be started from the asynchronous initialization, while the ticker is only safe to modify on the game thread.
+	if (!IsInGameThread())
+	{
+		AsyncTask(ENamedThreads::GameThread, []()
+		{
+			FScopeLock Lock(&SessionLock);
+			EnsureTicker();
+		});
+
+		return;
+	}
+
+	TickerHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateStatic(&FSteamVRRuntimeSession::Tick));
+}
+
+
+bool FSteamVRRuntimeSession::Tick(float DeltaTime)
+{
+	bool bSessionLost = false;
+	bool bSessionRestored = false;
+
+	{
+		FScopeLock Lock(&SessionLock);
+
+		// Events are only polled for the background session, the XR system handles its own.
+		if (bIsRunning && vr::VRSystem())
+		{
+			vr::VREvent_t Event;
+
+			while (vr::VRSystem()->PollNextEvent(&Event, sizeof(Event)))
+			{
+				if (Event.eventType == vr::VREvent_Quit)
+				{
+					bSessionLost = true;
+				}
+				else if (Event.eventType == vr::VREvent_TrackedDeviceActivated || Event.eventType == vr::VREvent_TrackedDeviceDeactivated)
+				{
+					HMDDeviceIndex = -1;
+				}
+			}
+		}
+		else if (bReconnectPending && FPlatformTime::Seconds() >= NextReconnectTime)
+		{
+			if (ConnectLocked())
+			{
+				bReconnectPending = false;
+				bSessionRestored = true;
+			}
+			else
+			{
+				NextReconnectTime = FPlatformTime::Seconds() + RUNTIME_RECONNECT_INTERVAL;
+			}
+		}
+	}
+
+	if (bSessionLost)
+	{
+		UE_LOG(LogSteamVRPassthrough, Log, TEXT("SteamVR is quitting, closing the background session."));
+
+		// Users release their runtime resources here, before the interfaces go away.
+		SessionLostDelegate.Broadcast();
+
+		FScopeLock Lock(&SessionLock);
+		DisconnectLocked();
+
+		if (UserCount > 0)
+		{
+			bReconnectPending = true;
+			NextReconnectTime = FPlatformTime::Seconds() + RUNTIME_RECONNECT_INTERVAL;
+		}
+	}
+
+	if (bSessionRestored)
+	{
+		UE_LOG(LogSteamVRPassthrough, Log, TEXT("Reconnected to SteamVR."));
+		SessionRestoredDelegate.Broadcast();
+	}
+
+	return true;
+}
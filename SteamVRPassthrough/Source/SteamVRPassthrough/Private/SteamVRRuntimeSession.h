@@ -0,0 +1,56 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+
+/**
+ * Owns the background OpenVR session used when SteamVR is not the active XR system.
+ * Renderers hold a reference while initialized, and the session is kept running between them,
+ * so re-enabling passthrough after PIE sessions or level loads does not restart it.
+ * If SteamVR quits, the session reconnects once it is available again while any users remain.
+ */
+class FSteamVRRuntimeSession
+{
+public:
+	/** Starts the session if needed and adds a user. */
+	static bool Acquire();
+	static void Release();
+
+	/** Starts the session without adding a user, for queries made before passthrough is enabled. */
+	static bool Connect();
+
+	/** Shuts the session down regardless of users, deferring it to exit if another XR runtime is active. */
+	static void Shutdown();
+
+	static bool IsRunning();
+
+	/** Held while the session is started or shut down. Holding it keeps the runtime interfaces valid on other threads. */
+	static FCriticalSection& GetSessionLock() { return SessionLock; }
+
+	/** Returns the tracked device index of the HMD, scanning the devices only when the cached index is no longer valid. */
+	static int32 GetHMDDeviceIndex();
+
+	/** Broadcast on the game thread before the session is lost with SteamVR quitting, while the runtime interfaces are still valid. */
+	static FSimpleMulticastDelegate& OnSessionLost() { return SessionLostDelegate; }
+
+	/** Broadcast on the game thread after the session has reconnected. */
+	static FSimpleMulticastDelegate& OnSessionRestored() { return SessionRestoredDelegate; }
+
+private:
+	static bool ConnectLocked();
+	static void DisconnectLocked();
+	static void EnsureTicker();
+	static bool Tick(float DeltaTime);
+
+	static FCriticalSection SessionLock;
+	static int32 UserCount;
+	static bool bIsRunning;
+	static bool bDeferredShutdown;
+	static bool bReconnectPending;
+	static double NextReconnectTime;
+	static int32 HMDDeviceIndex;
+	static FDelegateHandle TickerHandle;
+
+	static FSimpleMulticastDelegate SessionLostDelegate;
+	static FSimpleMulticastDelegate SessionRestoredDelegate;
+};
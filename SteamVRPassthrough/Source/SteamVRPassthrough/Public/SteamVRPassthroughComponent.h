@@ -4,6 +4,7 @@
 
 #include "CoreMinimal.h"
 #include "Components/ActorComponent.h"
+#include "Engine/LatentActionManager.h"
 #include "Engine/TextureRenderTarget2D.h"
 #include "IXRTrackingSystem.h"
 #include "SteamVRPassthrough.h"
@@ -14,6 +15,7 @@
 
 DECLARE_DYNAMIC_MULTICAST_DELEGATE(FVideoEnabledDelegate);
 DECLARE_DYNAMIC_MULTICAST_DELEGATE(FVideoDisabledDelegate);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FQualityTierChangedDelegate, TEnumAsByte<ESteamVRPassthroughQualityTier>, QualityTier, float, FrameBudgetRatio);
 
 
 UCLASS( ClassGroup=(Custom), meta=(BlueprintSpawnableComponent) )
@@ -23,9 +25,6 @@ class STEAMVRPASSTHROUGH_API USteamVRPassthroughComponent : public UActorCompone
 
 public:
 
-	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
-
-
 	/**
 	* Broadcast when the passthrough has been successfully initialized.
 	*/
@@ -38,6 +37,13 @@ public:
 	UPROPERTY(BlueprintAssignable, Category = Camera)
 	FVideoDisabledDelegate OnVideoDisabled;
 
+	/**
+	* Broadcast when the quality governor changes the passthrough quality tier,
+	* with the smoothed frame time as a fraction of the headset frame budget that caused it.
+	*/
+	UPROPERTY(BlueprintAssignable, Category = Camera)
+	FQualityTierChangedDelegate OnQualityTierChanged;
+
 
 	/**
 	* Initializes the SteamVR camera system and enables passthrough rendering.
@@ -47,18 +53,48 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "SteamVR|Passthrough")
 		bool EnableVideo();
 
+	/**
+	* Enables passthrough rendering without blocking the game thread, initializing the camera system on a worker thread.
+	* OnVideoEnabled is broadcast once the first camera frame is ready.
+	* 
+	* @return Future set to true once the first frame is ready, or false if initialization failed or DisableVideo is called first.
+	* While no frames arrive it keeps waiting, logging a warning every few seconds.
+	*/
+	TFuture<bool> EnableVideoAsync();
+
+	/**
+	* Latent version of EnableVideoAsync, completing once the first camera frame is ready.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "SteamVR|Passthrough", meta = (Latent, LatentInfo = "LatentInfo", DisplayName = "Enable Video Async"))
+		void EnableVideoLatent(bool& bSuccess, FLatentActionInfo LatentInfo);
+
 	/**
 	* Releases the camera video stream and disables all passthrough rendering.
+	* Cancels an asynchronous enable in progress, completing it with false.
 	*/
 	UFUNCTION(BlueprintCallable, Category = "SteamVR|Passthrough")
 		void DisableVideo();
 
 	/**
 	* Static function to detect if a camera is present. Will return false if no XR system is active.
+	* If the SteamVR runtime isn't running, it is started in the background without blocking, and this returns false until it has been checked.
 	*/
 	UFUNCTION(BlueprintCallable, Category = "SteamVR|Passthrough")
 		static bool HasCamera();
 
+	/**
+	* Returns the passthrough quality tier currently picked by the quality governor.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "SteamVR|Passthrough")
+		TEnumAsByte<ESteamVRPassthroughQualityTier> GetQualityTier() const;
+
+	/**
+	* Returns the estimated latency from the camera exposure to the passthrough reaching the display,
+	* with percentiles over the latest displayed frames.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "SteamVR|Passthrough")
+		FSteamVRPassthroughLatencyStats GetLatencyStats() const;
+
 	/**
 	* Registers a set of material parameters that will be continuously updated with the current UV transform matrix 
 	* just before rendering. Only scene materials are supported.
@@ -108,7 +144,11 @@ public:
 		bool bEnabled;
 
 	/**
-	* The frame type requested from SteamVR. Only VRFrameType_MaximumUndistorted is properly suppored.
+	* The frame type requested from SteamVR. 
+	* VRFrameType_Distorted frames are smaller and skip the undistortion done by SteamVR. 
+	* The postprocess modes undistort them using a lookup texture built from the device calibration,
+	* but scene materials using the transform parameters will receive the frames as-is.
+	* VRFrameType_Undistorted is not properly supported.
 	*/
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Camera)
 		TEnumAsByte<ESteamVRTrackedCameraFrameType> FrameType;
@@ -135,15 +175,55 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, BlueprintSetter = SetPostProcessMode, Category = PostProcess)
 		TEnumAsByte<ESteamVRPostProcessPassthroughMode> PostProcessOverlayMode;
 
+	/**
+	* Color the simple postprocess mode fills the parts of the view outside the camera field of view with.
+	* Only used when vr.SteamVRPassthrough.ScissorToCameraFootprint is enabled.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, BlueprintSetter = SetClearColor, Category = PostProcess)
+		FLinearColor ClearColor;
+
+	/**
+	* Where in the post processing chain the passthrough is drawn.
+	* Drawing after the upscale is only supported by the simple mode, and ignores stencil masking.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, BlueprintSetter = SetInjectionPoint, Category = PostProcess)
+		TEnumAsByte<ESteamVRPassthroughInjectionPoint> PostProcessInjectionPoint;
+
+	/**
+	* Exposure offset in stops applied to the camera frames in the simple postprocess mode.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, BlueprintSetter = SetCameraExposure, Category = PostProcess)
+		float CameraExposure;
+
+	/**
+	* Per channel gains applied to the camera frames in the simple postprocess mode, after the exposure.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, BlueprintSetter = SetCameraWhiteBalance, Category = PostProcess)
+		FLinearColor CameraWhiteBalance;
+
+	/**
+	* Optional color lookup table applied to the camera frames in the simple postprocess mode, after the exposure and white balance.
+	* The volume texture is indexed by and stores sRGB colors. Small sizes such as 16x16x16 are enough for smooth grades.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, BlueprintSetter = SetCameraColorLUT, Category = PostProcess)
+		UVolumeTexture* CameraColorLUT;
+
+	/**
+	* Filters run once on each new camera frame before it is displayed by any of the passthrough modes or registered materials.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, BlueprintSetter = SetPreprocessSettings, Category = Camera)
+		FSteamVRPassthroughPreprocessSettings Preprocess;
+
 	/**
 	* Directly use shared textures from the SteamVR compositor. 
 	* Only supported on DirectX 11 currently.
+	* Components streaming the same frame type share a renderer, which uses the setting of the first one enabled.
 	*/
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Camera)
 		bool bEnableSharedCameraTexture;
 
 	/**
-	* Read-only access to the camera frame layout.
+	* Read-only access to the camera frame layout. Mono until known if the SteamVR runtime isn't running, see HasCamera.
 	*/
 	UPROPERTY(BlueprintReadOnly, BlueprintGetter = GetFrameLayout, Category = Camera)
 		TEnumAsByte<ESteamVRStereoFrameLayout> FrameLayout;
@@ -163,16 +243,58 @@ public:
 	UFUNCTION(BlueprintSetter)
 		void SetPostProcessMode(ESteamVRPostProcessPassthroughMode InPostProcessMode);
 
+	UFUNCTION(BlueprintSetter)
+		void SetClearColor(FLinearColor InClearColor);
+
+	UFUNCTION(BlueprintSetter)
+		void SetInjectionPoint(ESteamVRPassthroughInjectionPoint InInjectionPoint);
+
+	UFUNCTION(BlueprintSetter)
+		void SetPreprocessSettings(FSteamVRPassthroughPreprocessSettings InSettings);
+
+	UFUNCTION(BlueprintSetter)
+		void SetCameraExposure(float InExposure);
+
+	UFUNCTION(BlueprintSetter)
+		void SetCameraWhiteBalance(FLinearColor InWhiteBalance);
+
+	UFUNCTION(BlueprintSetter)
+		void SetCameraColorLUT(UVolumeTexture* InColorLUT);
+
 	UFUNCTION(BlueprintGetter)
 		TEnumAsByte<ESteamVRStereoFrameLayout> GetFrameLayout();
 
 protected:
 
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	/** Pushes the component settings and parameters to the renderer after it has been initialized. */
+	void ApplyRendererSettings();
+
+	/** Sends the settings of this component to the shared renderer, which merges them with the other components using it. */
+	void PushRendererSettings();
+
+	void OnAsyncInitialized(bool bSuccess, uint32 RequestId);
+	bool WaitForFirstFrame(float DeltaTime);
+	void CompleteEnableVideoAsync(bool bSuccess);
+
+	void OnRendererQualityTierChanged(ESteamVRPassthroughQualityTier NewTier, float FrameBudgetRatio);
 
 private:
 	
 	TSharedPtr<FSteamVRPassthroughRenderer, ESPMode::ThreadSafe> PassthroughRenderer;
+
+	TArray<TSharedRef<TPromise<bool>, ESPMode::ThreadSafe>> PendingEnablePromises;
+	FDelegateHandle FirstFrameTickerHandle;
+	double FirstFrameWaitStartTime;
+
+	// Identifies the latest asynchronous enable. DisableVideo increments it to cancel one in progress.
+	uint32 EnableRequestId;
+
+	// Handle of this component as a user of the shared renderer, 0 while not enabled.
+	uint32 StreamUserHandle;
+	FDelegateHandle QualityTierChangedHandle;
 	
 	UPROPERTY()
 		TArray<FSteamVRPassthoughUVTransformParameter> TransformParameters;
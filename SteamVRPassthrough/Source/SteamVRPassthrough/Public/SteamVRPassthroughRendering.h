@@ -4,11 +4,19 @@
 
 #include "CoreMinimal.h"
 #include "SceneViewExtension.h"
+#include "RenderGraphResources.h"
+#include "IStereoLayers.h"
+#include "Async/Future.h"
+#include "Templates/Atomic.h"
 #include "SteamVRPassthrough.h"
 #include "openvr.h"
 
 #include "SteamVRPassthroughRendering.generated.h"
 
+class UVolumeTexture;
+struct FSteamVRCameraCalibration;
+class FMaterialShaderMap;
+
 
 UENUM()
 enum ESteamVRRuntimeStatus
@@ -38,7 +46,27 @@ enum ESteamVRPostProcessPassthroughMode
 	Mode_Simple,
 
 	/** Use provided postprocess material */
-	Mode_PostProcessMaterial
+	Mode_PostProcessMaterial,
+
+	/** 
+	 * Submit the camera frame as a quad stereo layer to the XR compositor, placed at the far projection distance.
+	 * Drawn behind the scene, so the scene needs to output alpha for it to be visible.
+	 */
+	Mode_CompositorLayer
+};
+
+
+UENUM()
+enum ESteamVRPassthroughInjectionPoint
+{
+	/** Drawn in linear HDR before tonemapping, at the internal resolution. The camera frames get exposed and graded with the scene. */
+	Injection_BeforeTonemap,
+
+	/** Drawn after tonemapping, at the internal resolution. */
+	Injection_AfterTonemap,
+
+	/** Drawn after upscaling at display resolution. Only supported by the simple mode, and does not support stencil masking. */
+	Injection_AfterUpscale
 };
 
 
@@ -51,6 +79,26 @@ enum ESteamVRStereoFrameLayout
 };
 
 
+/** Passthrough quality tiers the quality governor steps through, each one also applying the reductions of the tiers above it. */
+UENUM(BlueprintType)
+enum ESteamVRPassthroughQualityTier
+{
+	/** Everything as configured. */
+	QualityTier_Full = 0,
+
+	/** Bilinear camera filtering, and a single projection plane in the simple mode. */
+	QualityTier_ReducedFiltering,
+
+	/** The simple mode is drawn with the warp grid, calculating the camera UVs per vertex instead of per pixel. */
+	QualityTier_WarpGrid,
+
+	/** Camera frames are copied and uploaded at most at half the camera frame rate. */
+	QualityTier_ReducedUploadRate,
+
+	QualityTier_MAX UMETA(Hidden)
+};
+
+
 USTRUCT(BlueprintType)
 struct STEAMVRPASSTHROUGH_API FSteamVRPassthoughTextureParameter
 {
@@ -107,6 +155,305 @@ public:
 };
 
 
+/**
+ * Filters run once on each new camera frame, writing a processed texture that all passthrough modes 
+ * and registered materials sample instead of the raw frame.
+ */
+USTRUCT(BlueprintType)
+struct STEAMVRPASSTHROUGH_API FSteamVRPassthroughPreprocessSettings
+{
+	GENERATED_USTRUCT_BODY();
+
+public:
+
+	/** Run the preprocessing pass. The other settings have no effect without it. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool bEnabled;
+
+	/** Edge preserving 3x3 blur to reduce sensor noise, 0 to 1. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0.0", ClampMax = "1.0"))
+	float DenoiseStrength;
+
+	/** Unsharp mask strength, applied after denoising. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0.0", ClampMax = "2.0"))
+	float SharpenStrength;
+
+	/** Gain added at the edges of each camera image to counter lens vignetting, scaled by the squared distance from the image center. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0.0", ClampMax = "2.0"))
+	float LensShadingCorrection;
+
+	/** Color saturation multiplier. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0.0", ClampMax = "2.0"))
+	float Saturation;
+
+	FSteamVRPassthroughPreprocessSettings()
+		: bEnabled(false)
+		, DenoiseStrength(0.0)
+		, SharpenStrength(0.0)
+		, LensShadingCorrection(0.0)
+		, Saturation(1.0)
+	{}
+};
+
+
+/**
+ * Estimated age of the camera image when it reaches the eye, from the camera exposure to the predicted display photon time.
+ * All times are in milliseconds, and the percentiles are over the latest displayed frames.
+ */
+USTRUCT(BlueprintType)
+struct STEAMVRPASSTHROUGH_API FSteamVRPassthroughLatencyStats
+{
+	GENERATED_USTRUCT_BODY();
+
+public:
+
+	/** Exposure to photon latency of the latest displayed frame. */
+	UPROPERTY(BlueprintReadOnly, Category = Latency)
+	float LatencyMs;
+
+	/** Time from the camera exposure to the frame being picked up by the renderer. */
+	UPROPERTY(BlueprintReadOnly, Category = Latency)
+	float ExposureToPickupMs;
+
+	/** Time spent copying and uploading the frame. Close to zero for shared camera textures. */
+	UPROPERTY(BlueprintReadOnly, Category = Latency)
+	float PickupToUploadMs;
+
+	/** Time from the upload to the predicted photon time of the display frame. */
+	UPROPERTY(BlueprintReadOnly, Category = Latency)
+	float UploadToPhotonMs;
+
+	UPROPERTY(BlueprintReadOnly, Category = Latency)
+	float LatencyP50Ms;
+
+	UPROPERTY(BlueprintReadOnly, Category = Latency)
+	float LatencyP95Ms;
+
+	UPROPERTY(BlueprintReadOnly, Category = Latency)
+	float LatencyP99Ms;
+
+	/** Number of displayed frames the percentiles are from. */
+	UPROPERTY(BlueprintReadOnly, Category = Latency)
+	int32 NumSamples;
+
+	FSteamVRPassthroughLatencyStats()
+		: LatencyMs(0.0)
+		, ExposureToPickupMs(0.0)
+		, PickupToUploadMs(0.0)
+		, UploadToPhotonMs(0.0)
+		, LatencyP50Ms(0.0)
+		, LatencyP95Ms(0.0)
+		, LatencyP99Ms(0.0)
+		, NumSamples(0)
+	{}
+};
+
+
+/**
+ * Rendering settings that are written from the game thread, 
+ * and copied once per frame for the render thread so all views use the same values.
+ */
+struct FSteamVRPassthroughSettings
+{
+	bool bStreamEnabled = false;
+
+	// Set while nothing uses the camera frames, skipping the frame pickup and upload.
+	bool bStreamSuspended = false;
+
+	ESteamVRPostProcessPassthroughMode PostProcessMode = Mode_Disabled;
+
+	float ProjectionDistanceFar = 5.0;
+	float ProjectionDistanceNear = 1.0;
+
+	int32 StencilTestValue = -1;
+	bool bSceneAlphaMask = false;
+	FLinearColor ClearColor = FLinearColor::Black;
+
+	ESteamVRPassthroughInjectionPoint InjectionPoint = Injection_AfterTonemap;
+
+	FSteamVRPassthroughPreprocessSettings Preprocess;
+
+	// Color adjustment of the camera frames in the simple mode, applied in linear space before the color LUT.
+	float CameraExposure = 0.0;
+	FLinearColor CameraWhiteBalance = FLinearColor::White;
+
+	// Maps OpenVR tracking space to the engine world space, captured with each view family.
+	FMatrix TrackingToWorld = FMatrix::Identity;
+	// Maps OpenVR tracking space to the engine tracking space.
+	FMatrix OpenVRToTracking = FMatrix::Identity;
+	bool bHasTrackingToWorld = false;
+};
+
+
+/** Display settings requested by one user of a shared renderer, merged with the other users into the renderer settings. */
+struct FSteamVRPassthroughUserSettings
+{
+	ESteamVRPostProcessPassthroughMode PostProcessMode = Mode_Disabled;
+
+	float ProjectionDistanceFar = 5.0;
+	float ProjectionDistanceNear = 1.0;
+
+	int32 StencilTestValue = -1;
+	bool bSceneAlphaMask = false;
+	FLinearColor ClearColor = FLinearColor::Black;
+
+	ESteamVRPassthroughInjectionPoint InjectionPoint = Injection_AfterTonemap;
+
+	FSteamVRPassthroughPreprocessSettings Preprocess;
+
+	float CameraExposure = 0.0;
+	FLinearColor CameraWhiteBalance = FLinearColor::White;
+
+	UMaterialInstanceDynamic* PostProcessMaterial = nullptr;
+	UVolumeTexture* CameraColorLUT = nullptr;
+};
+
+
+// Most projection planes the simple mode can select between by scene depth.
+#define MAX_PROJECTION_PLANES 8
+
+
+/** Camera frame transforms for a single view, valid for the frame they were computed on. */
+struct FSteamVRPassthroughViewTransforms
+{
+	FMatrix MVP = FMatrix::Identity;
+	FMatrix FrameTransformFar = FMatrix::Identity;
+	FMatrix FrameTransformNear = FMatrix::Identity;
+
+	// Which camera in a stereo frame the view samples.
+	uint32 CameraId = 0;
+
+	// Transforms for the depth selected projection planes of the simple mode, nearest first. Unused unless NumPlanes is above one.
+	FMatrix FrameTransformPlanes[MAX_PROJECTION_PLANES];
+	float PlaneDistances[MAX_PROJECTION_PLANES];
+	int32 NumPlanes = 0;
+
+	// The part of the view covered by the camera frame, in view UVs. Invalid if nothing is covered.
+	FBox2D CameraFootprint = FBox2D(FVector2D(0, 0), FVector2D(1, 1));
+};
+
+
+/** GPU timestamps around the draws of one warp grid benchmark measurement. */
+struct FSteamVRPassthroughBenchmarkSample
+{
+	FIntPoint Size = FIntPoint::ZeroValue;
+	bool bWarpGrid = false;
+
+	FRenderQueryRHIRef StartQuery;
+	FRenderQueryRHIRef EndQuery;
+};
+
+
+/** 
+ * UV transforms at log-spaced projection distances for a single eye, built on frames with enough parameter distances to pay off.
+ * The transforms are near linear in inverse distance, so values in between are interpolated.
+ */
+struct FSteamVRPassthroughUVTransformTable
+{
+	TArray<float> Distances;
+
+	// Camera projections for the entries at even indices and the segment midpoints at odd ones, since they stay constant.
+	TArray<FMatrix> ProjectionInv;
+
+	TArray<FMatrix> Transforms;
+
+	// Whether interpolating between an entry and the next one stays within the error limit.
+	TArray<bool> SegmentWithinLimit;
+
+	// Camera to clip space transform and error limit the segments were last checked with.
+	FMatrix VerifiedCameraToClip = FMatrix::Identity;
+	float VerifiedMaxError = 0.0f;
+
+	bool bIsValid = false;
+};
+
+
+/** 
+ * Estimates the camera frame period and arrival time from the exposure times in the frame headers.
+ * Arrival is estimated from the lowest exposure to pickup delay seen, since frames can only be seen once they have arrived.
+ * All times are in platform cycles, which the OpenVR host ticks match.
+ */
+struct FSteamVRCameraFramePredictor
+{
+	/** Records a frame pickup, with the header of the frame if a new one was received. */
+	void AddPickup(uint64 PickupCycles, bool bNewFrame, uint32 FrameSequence, uint64 ExposureCycles);
+
+	/** Returns the predicted arrival time of the next frame, or 0 if there is not enough history. */
+	uint64 PredictNextArrival() const;
+
+	void Reset()
+	{
+		*this = FSteamVRCameraFramePredictor();
+	}
+
+	double PeriodCycles = 0.0;
+	double ArrivalLatencyCycles = 0.0;
+
+	// How long after the previous pickup the latest frame is estimated to have arrived.
+	double LastMissedByCycles = 0.0;
+
+	uint32 LastFrameSequence = 0;
+	uint64 LastExposureCycles = 0;
+	uint64 LastPickupCycles = 0;
+	int32 NumFrames = 0;
+};
+
+
+/**
+ * Steps the passthrough quality down while the frames run over budget, and back up once they have stayed well under it.
+ * The tier only changes after the smoothed frame time has stayed past a threshold for a while, with a band between the thresholds
+ * where it is kept. Upgrades that have to be undone soon after wait longer the next time, so a tier at the edge of the budget does not oscillate.
+ */
+struct FSteamVRPassthroughQualityGovernor
+{
+	/** Adds the latest frame time as a fraction of the frame budget, and changes the tier if needed. */
+	void Update(double FrameBudgetRatio, double CurrentTime, float DowngradeRatio, float UpgradeRatio);
+
+	void Reset()
+	{
+		*this = FSteamVRPassthroughQualityGovernor();
+	}
+
+	ESteamVRPassthroughQualityTier Tier = QualityTier_Full;
+
+	// Smoothed frame time to budget ratio.
+	double BudgetRatio = 0.0;
+
+	double OverBudgetStartTime = 0.0;
+	double UnderBudgetStartTime = 0.0;
+	double LastUpgradeTime = 0.0;
+	double UpgradeDelay = 0.0;
+};
+
+
+/** Keeps the exposure to photon latencies of the latest displayed frames, for the percentiles. */
+struct FSteamVRPassthroughLatencyHistory
+{
+	void AddSample(float LatencyMs);
+
+	/** Returns the latency at the given percentile from 0 to 100, or 0 if there are no samples. */
+	float GetPercentile(float Percentile) const;
+
+	void Reset()
+	{
+		Samples.Reset();
+		NextSample = 0;
+		SortedSamples.Reset();
+		bSortedSamplesValid = false;
+	}
+
+	TArray<float> Samples;
+	int32 NextSample = 0;
+
+	// Sorted copy of the samples, rebuilt when the percentiles are read after new samples.
+	mutable TArray<float> SortedSamples;
+	mutable bool bSortedSamplesValid = false;
+};
+
+
+DECLARE_MULTICAST_DELEGATE_TwoParams(FOnPassthroughQualityTierChanged, ESteamVRPassthroughQualityTier /* NewTier */, float /* FrameBudgetRatio */);
+
+
 class FSteamVRPassthroughRenderer : public FSceneViewExtensionBase
 {
 	
@@ -115,55 +462,184 @@ public:
 	~FSteamVRPassthroughRenderer();
 
 
+	/** 
+	 * Returns the renderer streaming the frame type, creating it if nothing else holds one.
+	 * Sharing it keeps a single streaming service, frame upload and set of passes per camera stream,
+	 * with the settings shared between the users. The shared texture setting of the user creating it applies to all of them.
+	 */
+	static TSharedRef<FSteamVRPassthroughRenderer, ESPMode::ThreadSafe> GetSharedRenderer(ESteamVRTrackedCameraFrameType InFrameType, bool bInUseSharedCameraTexture);
+
 	bool Initialize();
+
+	/** 
+	 * Initializes the runtime and camera on a worker thread, finishing on the game thread. 
+	 * The result is set on the game thread, and calls made while initializing share it.
+	 */
+	TFuture<bool> InitializeAsync();
+
 	void Shutdown();
-	void UpdateFrame_RenderThread();
+
+	/** Returns true once a camera frame has been picked up since initializing. */
+	bool HasReceivedFrame() const
+	{
+		return bHasReceivedFrame;
+	}
+
+	/** Picks up the latest camera frame, returns true if a new one was received. */
+	bool UpdateFrame_RenderThread();
+
+	/**
+	 * Enables the stream for a user of a shared renderer, returning the handle its settings are set with.
+	 * The stream stays enabled until every user has removed itself.
+	 */
+	uint32 AddStreamUser();
+	void RemoveStreamUser(uint32 UserHandle);
+
+	/**
+	 * Sets the display settings of a stream user. The renderer draws a single passthrough pass,
+	 * so the settings are taken from the most recently added user with a post process mode enabled,
+	 * or the most recently added user if none have. Preprocessing is enabled if any user enables it.
+	 */
+	void SetUserSettings(uint32 UserHandle, const FSteamVRPassthroughUserSettings& InSettings);
+
+	/** Controls if the view extension picks up new camera frames and draws the passthrough. */
+	void SetStreamEnabled(bool bInStreamEnabled)
+	{
+		{
+			FScopeLock Lock(&SettingsLock);
+			GameThreadSettings.bStreamEnabled = bInStreamEnabled;
+		}
+
+		// The extension stops being called when disabled, so the layer needs to be removed here.
+		if (!bInStreamEnabled)
+		{
+			DestroyCompositorLayer_GameThread();
+		}
+	}
 
 	void SetDepthStencilTestValue(int32 InStencilTestValue)
 	{
-		StencilTestValue = InStencilTestValue;
+		FScopeLock Lock(&SettingsLock);
+		GameThreadSettings.StencilTestValue = InStencilTestValue;
 	}
 
 	void SetSceneAlphaMask(bool InSceneAlphaMask)
 	{
-		SceneAlphaMask = InSceneAlphaMask;
+		FScopeLock Lock(&SettingsLock);
+		GameThreadSettings.bSceneAlphaMask = InSceneAlphaMask;
 	}
 
 	void SetPostProcessOverlayMode(ESteamVRPostProcessPassthroughMode InPostProcessMode)
 	{
-		PostProcessMode = InPostProcessMode;
+		FScopeLock Lock(&SettingsLock);
+		GameThreadSettings.PostProcessMode = InPostProcessMode;
+	}
+
+	void SetClearColor(FLinearColor InClearColor)
+	{
+		FScopeLock Lock(&SettingsLock);
+		GameThreadSettings.ClearColor = InClearColor;
+	}
+
+	void SetInjectionPoint(ESteamVRPassthroughInjectionPoint InInjectionPoint)
+	{
+		FScopeLock Lock(&SettingsLock);
+		GameThreadSettings.InjectionPoint = InInjectionPoint;
+	}
+
+	/** Sets the exposure offset in stops, and per channel white balance gains, applied to the camera frames in the simple mode. */
+	void SetCameraColorAdjustment(float InExposure, FLinearColor InWhiteBalance)
+	{
+		FScopeLock Lock(&SettingsLock);
+		GameThreadSettings.CameraExposure = InExposure;
+		GameThreadSettings.CameraWhiteBalance = InWhiteBalance;
 	}
 
 	void SetPostProcessMaterial(UMaterialInstanceDynamic* Instance);
 
+	/** Returns the tier the quality governor has last picked, as seen on the game thread. */
+	ESteamVRPassthroughQualityTier GetQualityTier() const
+	{
+		return GameThreadQualityTier;
+	}
+
+	/**
+	 * Returns the latest camera latency estimate. Safe to call from any thread,
+	 * the render thread publishes the estimate without blocking the readers.
+	 */
+	FSteamVRPassthroughLatencyStats GetLatencyStats() const;
+
+	/** Broadcast on the game thread when the quality governor changes the tier. */
+	FOnPassthroughQualityTierChanged& OnQualityTierChanged()
+	{
+		return QualityTierChangedDelegate;
+	}
+
+	/** Configures the camera frame preprocessing. Materials need to be given the texture from GetCameraTexture() again after enabling or disabling it. */
+	void SetPreprocessSettings(const FSteamVRPassthroughPreprocessSettings& InSettings);
+
+	/** Sets the volume texture the simple mode grades the camera frames with, indexed by sRGB color. Pass nullptr to disable. */
+	void SetCameraColorLUT(UVolumeTexture* Texture);
+
+	/** 
+	 * Overrides the stereo layer implementation the compositor layer mode submits to. 
+	 * Mainly for testing against a stub implementation, pass nullptr to use the active XR system.
+	 */
+	void SetStereoLayersOverride(IStereoLayers* InStereoLayers);
+
 	void AddPassthoughTransformParameter(FSteamVRPassthoughUVTransformParameter& InParameter);
 	void RemovePassthoughTransformParameters(const UMaterialInstance* Instance);
 
+	/** Returns the texture the camera frames are displayed from, which is the preprocessed texture when preprocessing is enabled. */
 	UTexture* GetCameraTexture();
 
+	/** 
+	 * Returns a view of the camera texture that skips the sRGB to linear conversion, 
+	 * for passes that write into gamma space render targets. The texture itself stays sRGB for materials.
+	 */
+	FShaderResourceViewRHIRef GetCameraTextureGammaSRV_RenderThread();
+
+	/** Returns a view of the camera texture that decodes sRGB, for passes writing linear scene color. */
+	FShaderResourceViewRHIRef GetCameraTextureLinearSRV_RenderThread();
+
+	/** Returns the color LUT texture for the simple mode, or nullptr if none is set. */
+	FRHITexture* GetCameraColorLUT_RenderThread() const;
+
 	void SetPostProcessProjectionDistance(float InDistanceFar, float InDistanceNear)
 	{
-		PostProcessProjectionDistanceFar = InDistanceFar;
-		PostProcessProjectionDistanceNear = InDistanceNear;
+		FScopeLock Lock(&SettingsLock);
+		GameThreadSettings.ProjectionDistanceFar = InDistanceFar;
+		GameThreadSettings.ProjectionDistanceNear = InDistanceNear;
 	}
 
 	static bool InitBackgroundRuntime();
 	static void ShutdownBackgroundRuntime();
 	static ESteamVRRuntimeStatus GetRuntimeStatus();
+
+	/**
+	 * Camera presence and frame layout. On the game thread with no runtime running, these return the results of an earlier query,
+	 * or false and mono until a background query started by the call has connected to the runtime.
+	 */
 	static bool HasCamera();
 	static ESteamVRStereoFrameLayout GetFrameLayout();
 
+	/** Times the simple mode drawn per pixel and with the warp grid on the next frame of every running renderer. Takes the draws per measurement. */
+	static void RequestWarpGridBenchmark(const TArray<FString>& Args);
+
+	/** Logs for how many unique material parameter sets the blendable location filter compiled and skipped the passthrough shaders. Registered for commandlets by the module. */
+	static void LogMaterialShaderCounts();
+
 	// ISceneViewExtension
 	virtual void SetupViewFamily(FSceneViewFamily& InViewFamily) override {}
 	virtual void SetupView(FSceneViewFamily& InViewFamily, FSceneView& InView) override {}
-	virtual void BeginRenderViewFamily(FSceneViewFamily& InViewFamily) override {}
+	virtual void BeginRenderViewFamily(FSceneViewFamily& InViewFamily) override;
 	virtual void PreRenderView_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneView& InView) override {}
 	virtual void PreRenderViewFamily_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneViewFamily& InViewFamily) override;
-	virtual void PrePostProcessPass_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& View, const FPostProcessingInputs& Inputs) {}
+	virtual void PrePostProcessPass_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& View, const FPostProcessingInputs& Inputs) override;
 
 	virtual void SubscribeToPostProcessingPass(EPostProcessingPass PassId, FAfterPassCallbackDelegateArray& InOutPassCallbacks, bool bIsPassEnabled) override;
 
-	virtual void PostRenderView_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneView& InView) override {}
+	virtual void PostRenderView_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneView& InView) override;
 	virtual int32 GetPriority() const override;
 	virtual bool IsActiveThisFrame(FViewport* InViewport) const override;
 
@@ -176,15 +652,113 @@ private:
 	
 	FScreenPassTexture DrawFullscreenPassthrough_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& InView, const FPostProcessMaterialInputs& Inputs);
 
+	/** Draws the simple mode into the view family target at display resolution, after any upscaling. */
+	void DrawPassthroughAfterUpscale_RenderThread(FRHICommandListImmediate& RHICmdList, const FSceneView& View);
+
+	/** Draws the simple mode both ways into offscreen targets of several sizes, with timestamps around each set of draws. */
+	void AddWarpGridBenchmarkPasses_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& View);
+
+	/** Logs the benchmark results once the GPU has written all the timestamps. */
+	void ReportWarpGridBenchmark_RenderThread();
+
+	/** Fills a part of the view with the clear color, using the same blending and stencil as the passthrough. */
+	void AddClearPass_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& View, const FScreenPassRenderTarget& Target, const FIntRect& Rect, const FLinearColor& ClearColor, const FRenderTargetBindingSlots& RenderTargets, FRHIBlendState* BlendState, FRHIDepthStencilState* StencilState, int32 StencilVal);
+
+	/** Returns true if the draw should be limited to OutDrawRect, with the rest of the view cleared. */
+	bool GetFootprintDrawRect(const FSteamVRPassthroughViewTransforms& ViewTransforms, const FIntRect& OutputRect, FIntRect& OutDrawRect) const;
+
+	FLinearColor GetOutputClearColor(const bool bLinearOutput, const float PreExposure) const;
+
 	FScreenPassTexture DrawPostProcessMatPassthrough_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& InView, const FPostProcessMaterialInputs& Inputs);
 
-	void UpdateFrameTransforms();
+	/** Creates the shaders and pipeline states the passthrough can use with the current settings, if they have changed since the last time. */
+	void PrecachePipelines_RenderThread(FRHICommandListImmediate& RHICmdList);
+	void PrecachePipeline_RenderThread(FRHICommandListImmediate& RHICmdList, FRHIVertexDeclaration* VertexDeclaration, FRHIVertexShader* VertexShader, FRHIPixelShader* PixelShader, FRHIBlendState* BlendState, FRHIDepthStencilState* DepthStencilState, bool bDepthStencilTarget);
+
+	/** Sets the target formats to precache for from the injection point, until a draw at it has recorded the actual ones. */
+	void UpdatePipelineTargetFormats_RenderThread(FRHICommandListImmediate& RHICmdList);
+
+	/** Counts a draw with a pipeline the precache didn't cover, and returns its key. */
+	uint32 TrackPipelineUse_RenderThread(FRHIVertexShader* VertexShader, FRHIPixelShader* PixelShader, FRHIBlendState* BlendState, FRHIDepthStencilState* DepthStencilState, bool bDepthStencilTarget);
+
+	uint32 GetPipelineKey(FRHIVertexShader* VertexShader, FRHIPixelShader* PixelShader, FRHIBlendState* BlendState, FRHIDepthStencilState* DepthStencilState, bool bDepthStencilTarget) const;
+	uint32 GetPipelineSettingsHash_RenderThread() const;
+
+	IStereoLayers* GetStereoLayers() const;
+
+	/** Creates, updates or removes the compositor layer depending on the mode. */
+	void UpdateCompositorLayer_GameThread(const FSteamVRPassthroughSettings& Settings);
+	void DestroyCompositorLayer_GameThread();
+
+	/** Places the camera frame quad at the projection distance in front of the camera it was captured with. */
+	void UpdateCompositorLayerPose_RenderThread();
+
+	/** Computes the frame transforms for all views in the family, reusing the results for views with identical projections. */
+	void UpdateViewTransforms_RenderThread(const FSceneViewFamily& ViewFamily);
+
+	/** Returns the cached transforms for the view, computing them if the view was not part of a family seen this frame. */
+	const FSteamVRPassthroughViewTransforms& GetViewTransforms_RenderThread(const FSceneView& View);
+
+	bool GetViewMVP(const FSceneView& View, FMatrix& OutMVP, uint32& OutCameraId);
 	
+	/** Applies the settings of the stream users to the renderer settings. */
+	void MergeUserSettings_GameThread();
+
+	/** Checks the engine state and decides if the background runtime is needed. */
+	bool BeginInitialize_GameThread();
+
+	/** Starts the runtime, reads the camera parameters and acquires the stream. Does not touch engine objects. */
+	bool InitializeRuntime_AnyThread();
+
+	/** Creates the textures once the runtime is initialized. */
+	bool InitializeResources_GameThread();
+	void CreateUndistortionMap_GameThread();
+
+	void CompleteAsyncInitialize_GameThread(bool bSuccess);
+
+	/** Releases the stream before SteamVR quits, and acquires it again once the background session reconnects. */
+	void OnRuntimeSessionLost_GameThread();
+	void OnRuntimeSessionRestored_GameThread();
+
 	bool AcquireVideoStreamingService();
 	void ReleaseVideoStreamingService();
 
+	/** 
+	 * Suspends the frame pickup once no passthrough mode or material has used the camera frames for a while, 
+	 * releasing the stream if it stays suspended. Resumes on the first frame something uses them again.
+	 */
+	void UpdateStreamSuspension_GameThread();
+	void SuspendStream_GameThread();
+	void ResumeStream_GameThread();
+
 	void GetSharedCameraTexture_RenderThread();
 
+	/** Feeds the latest frame timings to the quality governor once per frame, and announces tier changes on the game thread. */
+	void UpdateQualityGovernor_RenderThread(uint32 FrameNumber);
+
+	/** Estimates the exposure to photon latency of the frame displayed this frame, and publishes it with the percentiles. */
+	void UpdateLatencyEstimate_RenderThread();
+
+	/** Writes the latency estimate for GetLatencyStats. Writers need to hold the render lock. */
+	void PublishLatencyStats(const FSteamVRPassthroughLatencyStats& Stats);
+
+	/**
+	 * Waits for the next camera frame if it is predicted to arrive within the wait limit, before the frame pickup for the view family.
+	 * Takes the render lock itself, and must be called without holding it.
+	 */
+	void WaitForCameraFrame_RenderThread(const FSceneView& View);
+
+	/** Runs the preprocessing filters on the current camera frame into the preprocessed texture. Returns the texture registered with the graph, or null if nothing was dispatched. */
+	FRDGTextureRef AddPreprocessPass_RenderThread(FRDGBuilder& GraphBuilder);
+
+	/** Returns an SRV for passes of the graph that sample the camera frame, making them wait on a preprocess dispatch in the same graph. Null otherwise. */
+	FRDGTextureSRVRef GetPreprocessedFrameSRV_RenderThread(FRDGBuilder& GraphBuilder) const;
+
+	/** Returns the texture the passthrough modes sample, either the raw or the preprocessed camera frame. */
+	UTexture* GetDisplayedCameraTexture_RenderThread() const;
+
+	void CreatePreprocessedTexture_GameThread();
+
 	void UpdateVideoStreamFrameBuffer_RenderThread();
 
 	bool UpdateVideoStreamFrameHeader();
@@ -193,11 +767,30 @@ private:
 
 	void UpdateTransformParameters();
 
-	void GetCameraIntrinsics(const uint32 CameraId, FVector2D& FocalLength, FVector2D& Center);
+	/** Returns the key the calibration is cached with, or an empty string if the headset can't be identified. */
+	static FString GetCalibrationCacheKey(vr::EVRTrackedCameraFrameType InFrameType);
+
+	/** Reads the static camera calibration from the runtime. */
+	static bool QueryCameraCalibration(vr::EVRTrackedCameraFrameType InFrameType, FSteamVRCameraCalibration& OutCalibration);
+	void ApplyCameraCalibration(const FSteamVRCameraCalibration& Calibration);
+
+	/** Switches the running renderer to a calibration that differs from the cached one it started with. */
+	void ApplyLiveCameraCalibration_GameThread(const FSteamVRCameraCalibration& Calibration, vr::EVRTrackedCameraFrameType InFrameType);
+
+	static bool GetCameraIntrinsics(vr::EVRTrackedCameraFrameType InFrameType, const uint32 CameraId, FVector2D& FocalLength, FVector2D& Center);
+
+	/**
+	 * Builds a lookup texture that maps the ideal pinhole UVs the transforms output 
+	 * to the UVs of the distorted camera frame, from the device distortion parameters.
+	 */
+	bool BuildUndistortionMap();
 	FMatrix GetCameraProjection(const uint32 CameraId, const float ZNear, const float ZFar);
 	FMatrix GetCameraProjectionInv(const uint32 CameraId, const float ZNear, const float ZFar);
-	bool GetTrackedCameraEyePoses(FMatrix& LeftPose, FMatrix& RightPose);
+	static bool GetTrackedCameraEyePoses(const ESteamVRStereoFrameLayout Layout, FMatrix& LeftPose, FMatrix& RightPose);
 	FMatrix GetHMDRawMVPMatrix(const EStereoscopicPass Eye);
+
+	/** Maps the projection the engine rendered the view with into OpenVR tracking space. */
+	FMatrix GetEngineViewMVP(const FSceneView& View) const;
 	
 	/**
 	 * Returns a matrix that can transform a [-1 to 1] screenspace quad with the camera frame UV mapped it, 
@@ -211,40 +804,99 @@ private:
 	 * the output Uvs will need to be passed as homogenous coordinates to the fragment shader.
 	 */
 	FMatrix GetTrackedCameraUVTransform(const EStereoscopicPass Eye, const float ProjectionDistance);
+	FMatrix GetTrackedCameraUVTransform(const uint32 CameraId, const FMatrix& MVP, const float ProjectionDistance);
+	FMatrix GetTrackedCameraUVTransform(const uint32 CameraId, const FMatrix& MVP, const FMatrix& CameraProjectionInv);
+
+	void BuildUVTransformTable(const EStereoscopicPass Eye, const FMatrix& MVP, const int32 TableSize, const float MaxError);
+	bool GetTableUVTransform(const EStereoscopicPass Eye, const float ProjectionDistance, FMatrix& OutTransform) const;
 
 private:
 
-	static bool bIsSteamVRRuntimeInitialized;
-	static bool bDeferredRuntimeShutdown;
+	/** Queries the camera, starting the runtime in the background if needed. Not for the game thread. */
+	static bool QueryHasCamera_AnyThread();
+	static ESteamVRStereoFrameLayout QueryFrameLayout_AnyThread();
+
+	/** Queries the camera on a worker thread if it is not yet known, for the game thread getters. */
+	static void QueryCameraAsync();
+
 	static int HMDDeviceId;
+
+	// Renderers handed out by GetSharedRenderer, keyed by the frame type.
+	static TMap<uint32, TWeakPtr<FSteamVRPassthroughRenderer, ESPMode::ThreadSafe>> SharedRenderers;
+
+	TArray<TSharedRef<TPromise<bool>, ESPMode::ThreadSafe>> PendingInitPromises;
+	FThreadSafeBool bHasReceivedFrame;
+	
+	// Stream users in the order they were added, with the settings each has requested.
+	TArray<TPair<uint32, FSteamVRPassthroughUserSettings>> StreamUsers;
+	uint32 NextStreamUserHandle;
+
+	// Results of the latest merge, to only push the material when it changes and log conflicts once.
+	UMaterialInstanceDynamic* MergedPostProcessMaterial;
+	bool bMergedPreprocessEnabled;
+	bool bHasUserConflict;
 	
 
 	bool bIsInitialized;
 	bool bUsingBackgroundRuntime;
+	// Set while holding a reference to the background runtime session.
+	bool bHoldsRuntimeSession;
+	FDelegateHandle SessionLostHandle;
+	FDelegateHandle SessionRestoredHandle;
 
 
-	ESteamVRPostProcessPassthroughMode PostProcessMode;
-
-	float PostProcessProjectionDistanceFar;
-	float PostProcessProjectionDistanceNear;
+	FSteamVRPassthroughSettings GameThreadSettings;
+	FSteamVRPassthroughSettings RenderSettings;
 
-	int32 StencilTestValue;
-	bool SceneAlphaMask;
-
-	FMatrix LeftFrameTransformFar;
-	FMatrix LeftFrameTransformNear;
-	FMatrix RightFrameTransformFar;
-	FMatrix RightFrameTransformNear;
+	// Transforms keyed by the view state key, or by the view itself for views without state. Cleared each frame.
+	TMap<uint64, FSteamVRPassthroughViewTransforms> ViewTransformCache;
+	uint32 ViewTransformCacheFrameNumber;
 
 	FMatrix FramePose;
 	
 	vr::EVRTrackedCameraFrameType FrameType;
 	vr::TrackedCameraHandle_t CameraHandle;
 	vr::CameraVideoStreamFrameHeader_t CameraFrameHeader;
+	FSteamVRCameraFramePredictor FramePredictor;
 	ESteamVRStereoFrameLayout FrameLayout;
 
+	// Quality governor state, only accessed on the render thread.
+	FSteamVRPassthroughQualityGovernor QualityGovernor;
+	uint32 LastGovernorFrameNumber;
+
+	ESteamVRPassthroughQualityTier GameThreadQualityTier;
+	FOnPassthroughQualityTierChanged QualityTierChangedDelegate;
+
+	// Display timing of the headset, read when initializing.
+	float DisplayFrequency;
+	float VsyncToPhotonsSeconds;
+
+	// When the displayed camera frame was picked up, and when its upload was submitted.
+	uint64 FramePickupCycles;
+	uint64 FrameUploadCycles;
+
+	FSteamVRPassthroughLatencyHistory LatencyHistory;
+	uint32 LatencySamplesSincePercentiles;
+
+	// Published latency estimate, guarded by a sequence counter that is odd while the render thread writes it.
+	FSteamVRPassthroughLatencyStats PublishedLatencyStats;
+	TAtomic<uint32> LatencyStatsSequence;
+
 	FMatrix CameraLeftToRightPose;
 	FMatrix CameraLeftToHMDPose;
+	FVector2D CameraFocalLength[2];
+	FVector2D CameraCenter[2];
+	bool bCalibrationFromCache;
+
+	// Automatic suspension state, only accessed on the game thread.
+	bool bStreamSuspended;
+	bool bStreamReleasedWhileSuspended;
+	double StreamSuspendTime;
+	double LastStreamConsumerTime;
+	uint64 LastSuspensionCheckFrame;
+
+	// When the latest initialization started, for measuring the time to the first frame.
+	uint64 InitializeStartCycles;
 	FMatrix FrameCameraToTrackingPose;
 
 	FMatrix RawHMDProjectionLeft;
@@ -252,27 +904,92 @@ private:
 	FMatrix RawHMDProjectionRight;
 	FMatrix RawHMDViewRight;
 
+	// Eye projections from the engine views, used for the material transform parameters.
+	FMatrix ViewMVPLeft;
+	FMatrix ViewMVPRight;
+	bool bUseViewMVP;
+
 	TUniquePtr<TMap<FVector2D, FMatrix>> LeftCameraMatrixCache;
 	TUniquePtr<TMap<FVector2D, FMatrix>> RightCameraMatrixCache;
 
+	// Left and right eye UV transforms at fixed distances, interpolated for the material transform parameters.
+	FSteamVRPassthroughUVTransformTable UVTransformTables[2];
+
 	UTexture* CameraTexture;
 	TUniquePtr<FUpdateTextureRegion2D> UpdateTextureRegion;
 
+	UTexture* PreprocessedCameraTexture;
+	// Set once the preprocessed texture has been written, until preprocessing is disabled.
+	bool bHasPreprocessedFrame;
+	// The preprocessed texture in the graph it was written in this frame, only valid while that graph is being built.
+	FRDGTextureRef PreprocessedFrameRDG;
+	const FRDGBuilder* PreprocessedFrameGraph;
+	TRefCountPtr<IPooledRenderTarget> PreprocessedFrameExtracted;
+
+	FShaderResourceViewRHIRef CameraTextureGammaSRV;
+	FTextureRHIRef CameraTextureGammaSRVSource;
+	FShaderResourceViewRHIRef CameraTextureLinearSRV;
+	FTextureRHIRef CameraTextureLinearSRVSource;
+
+	FTexture2DRHIRef UndistortionMapRHI;
+	// Built during initialization, and uploaded from the game thread.
+	TArray<FVector2D> UndistortionMapData;
+	FIntPoint UndistortionMapSize;
+	bool bUndistortFrames;
+
 	uint32 CameraTextureWidth;
 	uint32 CameraTextureHeight;
 	uint32 CameraFrameBufferSize;
 	TUniquePtr<uint8[]> FrameBuffer;
 	bool bUseSharedCameraTexture;
+	// The setting of the user that created the renderer, before checking for D3D11 support.
+	bool bSharedCameraTextureRequested;
 
 	bool bHasValidFrame;
 
+	// Frame number of the view family the camera frame was last picked up for.
+	uint32 LastFrameUpdateNumber;
+	const FSceneViewFamily* LastTransformUpdateFamily;
+
 	TUniquePtr<TArray<FSteamVRPassthoughUVTransformParameter>> TransformParameters;
 
 	UMaterialInstanceDynamic* PostProcessMaterial;
 	UMaterialInstanceDynamic* PostProcessMaterialTemp;
+
+	UVolumeTexture* CameraColorLUT;
+	UVolumeTexture* CameraColorLUTTemp;
+
+	// Draws per measurement of a requested warp grid benchmark, or 0 if none is pending.
+	int32 PendingBenchmarkDraws;
+	int32 BenchmarkDraws;
+	TArray<FSteamVRPassthroughBenchmarkSample> BenchmarkSamples;
+
+	// Keys of the pipelines created ahead of the draws, or already drawn with.
+	TSet<uint32> PrecachedPipelines;
+	uint32 PrecachedSettingsHash;
+	// Keys of the material pipelines, dropped when the material shader map changes.
+	TArray<uint32> MaterialPipelineKeys;
+	const FMaterialShaderMap* PrecachedMaterialShaderMap;
+
+	// Target formats the pipeline states are precached for, derived from the injection point until a draw has seen the actual ones.
+	ESteamVRPassthroughInjectionPoint PipelineFormatsInjectionPoint;
+	EPixelFormat PipelineColorFormat;
+	ETextureCreateFlags PipelineColorFlags;
+	EPixelFormat PipelineDepthStencilFormat;
+	ETextureCreateFlags PipelineDepthStencilFlags;
+
+	IStereoLayers* StereoLayersOverride;
+	IStereoLayers* CompositorLayerOwner;
+	uint32 CompositorLayerId;
+
+	// Quad to OpenVR tracking space pose and size in meters, written on the render thread under the settings lock.
+	FMatrix CompositorLayerPose;
+	FVector2D CompositorLayerSize;
+	bool bHasCompositorLayerPose;
 	
 public:
 	mutable FCriticalSection ParameterLock;
 	mutable FCriticalSection MaterialUpdateLock;
 	mutable FCriticalSection RenderLock;
+	mutable FCriticalSection SettingsLock;
 };